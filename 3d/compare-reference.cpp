@@ -0,0 +1,96 @@
+/*
+ * Run every stage of FLIP::step_FLIP from the model state stored in the
+ * reference file before it, and print the errors of the resulting state
+ * against the one stored after it (see NcReader::computeErrors). Unlike the
+ * validation tests this only reports the errors, e.g. to compare the single
+ * precision build (compare-reference-f32) to the double precision one.
+ */
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "NcReader.h"
+#include "FLIP.h"
+
+
+#ifdef CMAKE_SOURCE_DIR
+	#define STRINGIFY(x) #x
+	#define TOSTRING(x) STRINGIFY(x)
+	const std::string default_data_dir = std::string(TOSTRING(CMAKE_SOURCE_DIR)) + "/validation_data/";
+#else
+	const std::string default_data_dir = "validation_data/";
+#endif
+
+
+/**
+ * Load the state of breakpoint breakPt, run the stage on it and print the
+ * errors against the state of breakpoint breakPt + 1
+ */
+void compare_stage(const std::string& refFile, const std::string& cfgFile, const unsigned breakPt,
+                   const std::string& name, const std::function<void(NcReader&, FLIP&)>& stage) {
+
+	NcReader ncReader(refFile, cfgFile);
+	ncReader.readAll(breakPt);
+	ncReader.toFlipStructures();
+
+	FLIP flip(*(ncReader.particles), ncReader.MACGrid, ncReader.cfg);
+	stage(ncReader, flip);
+
+	ncReader.readAll(breakPt + 1);
+	std::printf("\n%s\n", name.c_str());
+	std::printf("  %-12s %14s %14s\n", "variable", "max rel. err", "max norm. err");
+	for (const NcReader::VarError& err : ncReader.computeErrors()) {
+		std::printf("  %-12s %14.6e %14.6e\n", err.varName.c_str(), err.maxRelErr, err.maxNormErr);
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+
+	if (argc > 1 and std::string(argv[1]) == "-h") {
+		std::printf("Usage: ./compare-reference [-h] [<ref.nc> <config>]\n");
+		std::printf("\nDefault: '%sref.nc' and '%svalidation-config.json'.\n",
+		            default_data_dir.c_str(), default_data_dir.c_str());
+		return 0;
+	}
+	const std::string refFile = (argc > 2) ? argv[1] : default_data_dir + "ref.nc";
+	const std::string cfgFile = (argc > 2) ? argv[2] : default_data_dir + "validation-config.json";
+
+	std::printf("Particle and grid values stored in %s precision\n", (sizeof(real_t) == sizeof(float)) ? "single" : "double");
+
+	compare_stage(refFile, cfgFile, 0, "particle_to_grid", [](NcReader& ncReader, FLIP& flip) {
+		flip.particle_to_grid();
+		ncReader.MACGrid->set_uvw_star();
+	});
+
+	compare_stage(refFile, cfgFile, 1, "apply_forces", [](NcReader& ncReader, FLIP& flip) {
+		const double dt = ncReader.cfg.getTimeStep();
+		flip.apply_forces(dt);
+		const unsigned step = ncReader.timestep;
+		if (ncReader.cfg.getApplyMeteorForce() && step <= 200) {
+			flip.explode(dt, step, 15, 0, 15, 2, 800);
+		}
+	});
+
+	compare_stage(refFile, cfgFile, 2, "apply_boundary_conditions", [](NcReader&, FLIP& flip) {
+		flip.apply_boundary_conditions();
+	});
+
+	compare_stage(refFile, cfgFile, 3, "apply_pressure_correction", [](NcReader& ncReader, FLIP& flip) {
+		flip.apply_pressure_correction(ncReader.cfg.getTimeStep());
+	});
+
+	compare_stage(refFile, cfgFile, 4, "grid_to_particle", [](NcReader&, FLIP& flip) {
+		flip.grid_to_particle();
+	});
+
+	compare_stage(refFile, cfgFile, 5, "advance_particles", [](NcReader& ncReader, FLIP& flip) {
+		const double dt = ncReader.cfg.getTimeStep();
+		const double dt_new = flip.compute_timestep(dt);
+		const int num_substeps = std::ceil(dt/dt_new);
+		flip.advance_particles(dt/num_substeps, num_substeps);
+	});
+
+	return 0;
+}
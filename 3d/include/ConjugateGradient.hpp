@@ -4,7 +4,10 @@
 // NOTE included new header
 #include<algorithm>
 #include<cmath>
+#include<utility>
+#include<vector>
 #include "Mac3d.h"
+#include "MultigridPreconditioner.h"
 // incomplete cholesky conjugate gradient
 struct SparseMat {
 	SparseMat(unsigned a, unsigned b);
@@ -20,18 +23,142 @@ struct SparseMat {
 	unsigned *row_idx;
 };
 
+/**
+ * Preconditioned conjugate gradient solver for the pressure equations.
+ *
+ * The unknowns are the fluid cells of the grid only. Each time the fluid cells
+ * change, update_fluid_cells builds a compact numbering of them in k-j-i order,
+ * together with tables of the compact indices of their neighbours, so that the
+ * cost of an iteration scales with the volume of the fluid and not with the
+ * size of the grid.
+ * Vectors in compact numbering have get_num_fluid_cells() + 1 entries: the last
+ * entry is a padding zero which stands in for non-fluid neighbours.
+ */
 class ICConjugateGradientSolver {
+	public:
+	/**
+	 * Order in which the triangular solves of the preconditioner visit the cells.
+	 * - SWEEP_LEXICOGRAPHIC: k-j-i order, strictly sequential
+	 * - SWEEP_WAVEFRONT: x-rows are grouped into hyperplanes j+k = const, which
+	 *   are processed one after the other. Rows within a hyperplane only depend
+	 *   on rows of the previous hyperplane and are processed in parallel.
+	 *   Every cell sees the same operations as in the lexicographic sweep,
+	 *   so both orderings give identical results.
+	 */
+	enum SWEEP { SWEEP_LEXICOGRAPHIC, SWEEP_WAVEFRONT };
+
+	/**
+	 * Preconditioner of the conjugate gradient method.
+	 * - PRECONDITIONER_NONE: plain conjugate gradient
+	 * - PRECONDITIONER_JACOBI: division by the diagonal of the matrix
+	 * - PRECONDITIONER_IC0: incomplete Cholesky factorization
+	 * - PRECONDITIONER_MIC0: modified incomplete Cholesky factorization, which
+	 *   adds a fraction tau of the dropped fill-in to the diagonal
+	 *   (see set_mic_parameters)
+	 * - PRECONDITIONER_CHEBYSHEV: fixed number of Jacobi-preconditioned
+	 *   Chebyshev iterations, i.e. a polynomial in the matrix. Consists of
+	 *   matrix-vector products only, so unlike the incomplete Cholesky
+	 *   variants it has no sequential sweeps.
+	 * - PRECONDITIONER_MULTIGRID: one geometric multigrid V-cycle
+	 *   (see MultigridPreconditioner)
+	 */
+	enum PRECONDITIONER {
+		PRECONDITIONER_NONE, PRECONDITIONER_JACOBI, PRECONDITIONER_IC0,
+		PRECONDITIONER_MIC0, PRECONDITIONER_CHEBYSHEV, PRECONDITIONER_MULTIGRID
+	};
+
+	/**
+	 * Floating point precision of the solver.
+	 * - PRECISION_DOUBLE: all vectors and the preconditioner are double
+	 * - PRECISION_MIXED: the CG iterations and the preconditioner work on
+	 *   single precision vectors, which halves the memory traffic and doubles
+	 *   the SIMD width. The solution and its residual are periodically updated
+	 *   in double precision (reliable updates), so that the residual reaches
+	 *   the threshold of the double precision solver.
+	 */
+	enum PRECISION { PRECISION_DOUBLE, PRECISION_MIXED };
+
+	/**
+	 * Formulation of the double precision CG iteration.
+	 * - VARIANT_STANDARD: textbook preconditioned CG, six passes over the
+	 *   vectors per iteration besides the preconditioner (matrix product,
+	 *   two dot products, three updates)
+	 * - VARIANT_CHRONOPOULOS_GEAR: the product A s of the search direction is
+	 *   updated by a recurrence instead (Chronopoulos and Gear, 1989), so that
+	 *   both dot products are computed in the same pass as the matrix product,
+	 *   and all vector updates together with the residual norm in one pass.
+	 *   Mathematically equivalent, results differ by rounding.
+	 */
+	enum VARIANT { VARIANT_STANDARD, VARIANT_CHRONOPOULOS_GEAR };
+
+	/**
+	 * Upper limit of the size of the components solved directly (see
+	 * set_direct_solve_size): their dense factor takes 512 KB per thread
+	 */
+	static constexpr unsigned max_direct_solve_size = 256;
+
+	private:
 	const Mac3d& grid;
 	const unsigned n_cells_x, n_cells_y, n_cells_z;
 
-	const unsigned stride_x = 1;
-	const unsigned stride_y = n_cells_x;
-	const unsigned stride_z = n_cells_x * n_cells_y;
+	const index_t stride_x = 1;
+	const index_t stride_y = n_cells_x;
+	const index_t stride_z = index_t(n_cells_x) * n_cells_y;
+
+	// MIC(0): fraction of the dropped fill-in added to the diagonal, and the
+	// fraction of the diagonal of A below which a pivot is replaced by it
+	double tau, mic_safety;
+
+	// Chebyshev preconditioner: number of matrix-vector products and ratio of
+	// the bounds of the interval of eigenvalues of D⁻¹A it is tuned to
+	const unsigned chebyshev_degree = 4;
+	const double chebyshev_ratio = 30;
+
+	// number of threads the kernels are distributed over
+	const int num_threads;
+
+	// ordering of the preconditioner sweeps
+	SWEEP sweep;
+
+	// preconditioner in use; the multigrid hierarchy is only allocated when selected
+	PRECONDITIONER preconditioner;
+	MultigridPreconditioner* multigrid;
+
+	// precision of the solver; the single precision vectors are only
+	// allocated when the mixed precision is selected
+	PRECISION precision;
+
+	// formulation of the CG iteration; its additional vectors are only
+	// allocated when the Chronopoulos-Gear variant is selected
+	VARIANT variant;
+
+	// fluid components of at most this many cells which touch air are solved
+	// directly instead of by CG (0: all fluid cells are solved by CG)
+	unsigned direct_solve_size;
+
+	// the mixed precision solver updates the solution and residual in double
+	// precision whenever the single precision residual dropped by this factor
+	const float inner_reduction = 0.1;
+
+	// and restarts the iteration from the updated residual when an update
+	// reduced the residual by less than this factor
+	const double stagnation_reduction = 0.5;
+
+	// grid-sized buffers to apply the multigrid preconditioner
+	double* multigrid_r;
+	double* multigrid_z;
+
+	// buffers of the Chebyshev preconditioner, for double and single precision
+	double *chebyshev_d, *chebyshev_y;
+	float *chebyshev_d_f, *chebyshev_y_f;
+
+	// grid-sized buffers for the grid-based solve interface, allocated on first use
+	double* compact_rhs;
+	double* compact_p;
 
-	const double tau;
 	public:
 	// number of rows aka. len of rhs aka. len of res, guess vector ect.
-	const unsigned num_cells;
+	const index_t num_cells;
 
 	protected:
 	// intermediate vector for pressure solution
@@ -52,22 +179,274 @@ class ICConjugateGradientSolver {
 	// diagonal of matrix A
 	double* A_diag;
 
-	// current step and max steps
+	// product of A and the auxiliary vector z, and of A and the search vector s
+	// (Chronopoulos-Gear variant)
+	double *w, *t;
+
+	// single precision versions of q, r, z, s, precon_diag and A_diag, and
+	// the correction computed by the inner iterations of the mixed precision solver
+	float *q_f, *r_f, *z_f, *s_f, *precon_diag_f, *A_diag_f, *x_f;
+
+	// number of fluid cells solved by CG, i.e. unknowns of the CG system
+	index_t num_fluid;
+
+	// number of fluid cells in components solved directly. They follow the
+	// cells of the CG system in the compact numbering, grouped by component.
+	// direct_begin holds the compact index of the first cell of every such
+	// component, and num_fluid + num_direct as last entry.
+	index_t num_direct;
+	std::vector<index_t> direct_begin;
+
+	// scratch space of split_components: component of every fluid cell, next
+	// compact index of every component, cells to visit and a copy of fluid_cells
+	std::vector<index_t> component, component_next, flood_stack, cells_copy;
+
+	// grid index of every fluid cell
+	index_t* fluid_cells;
+
+	// compact index of every fluid cell (entries of other cells are undefined)
+	index_t* compact_index;
+
+	// bits of the neighbour codes
+	enum NEIGHBOUR { NB_XM = 1, NB_XP = 2, NB_YM = 4, NB_YP = 8, NB_ZM = 16, NB_ZP = 32 };
+
+	// one byte per fluid cell, with the bit of a direction set if the neighbour
+	// in that direction is a fluid cell. Within an x-row, the fluid neighbours
+	// in x direction are the adjacent unknowns, so their indices need no table.
+	unsigned char* nb_code;
+
+	// compact indices of the neighbours in -y, +y, -z and +z direction,
+	// num_fluid if the neighbour is not a fluid cell
+	index_t *nb_ym, *nb_yp, *nb_zm, *nb_zp;
+
+	// compact indices of the neighbours in -x and +x direction, num_fluid if
+	// the neighbour is not a fluid cell
+	index_t nb_xm(index_t c) const { return nb_code[c] & NB_XM ? c - 1 : num_fluid; }
+	index_t nb_xp(index_t c) const { return nb_code[c] & NB_XP ? c + 1 : num_fluid; }
+
+	// compact index of the first fluid cell of every x-row (j, k),
+	// row_begin[j + k*n_cells_y]; the last entry is num_fluid
+	std::vector<index_t> row_begin;
+
+	// call f(nb_cellidx) for every fluid neighbour of the grid cell cellidx
+	template<typename F>
+	void for_each_fluid_neighbour(index_t cellidx, F f) const;
+
+	// label the components of the fluid cells numbered row by row, and move
+	// the cells of the components solved directly behind the CG cells
+	void split_components();
+
+	// grid cells written by the last call to scatter_solution
+	std::vector<index_t> scattered_cells;
+	bool has_scattered;
+
+	// number of steps of the last solve and max steps
 	unsigned step, max_steps;
 
+	// max norm of the right-hand side and of the initial residual of the last solve
+	double rhs_norm, initial_residual;
+
 	// threshhold
 	const double thresh = 1e-9;
 
+	// per-thread partial results of reductions
+	std::vector<double> partials;
+	std::vector<std::pair<double, double>> pair_partials;
+
+	// run kernel(begin, end) on one chunk of [0, n) per thread
+	template<typename Kernel>
+	void for_each_chunk(index_t n, Kernel kernel) const;
+
+	// run kernel(begin, end) on one chunk of [0, n) per thread and
+	// combine the partial results in chunk order
+	template<typename Kernel>
+	double sum_chunks(index_t n, Kernel kernel);
+	template<typename Kernel>
+	double max_chunks(index_t n, Kernel kernel);
+
+	// same as sum_chunks for kernels computing two sums at once
+	template<typename Kernel>
+	std::pair<double, double> sum_pair_chunks(index_t n, Kernel kernel);
+
+	// run kernel(row) on all x-rows in the order given by sweep, where
+	// row = j + k*n_cells_y; reverse visits the rows in the opposite order
+	template<typename Kernel>
+	void for_each_row(bool reverse, Kernel kernel) const;
+
+	// preconditioner computations on the fluid cells of an x-row,
+	// for double and single precision vectors
+	void computePreconDiagRow(unsigned row);
+	void computeMICPreconDiagRow(unsigned row);
+	template<typename T>
+	void forwardSubstitutionRow(unsigned row, const T *precon_diag, const T *r, T *q) const;
+	template<typename T>
+	void backwardSubstitutionRow(unsigned row, const T *precon_diag, const T *q, T *z) const;
+
+	// y <- A b, for double and single precision vectors
+	template<typename T>
+	void applyStencil(const T *diag, const T *b, T *y) const;
+	template<typename T>
+	void applyStencilCells(index_t begin, index_t end, const T *diag, const T *b, T *y) const;
+
+	// y <- A b on the unknowns [begin, end)
+	void applyACells(index_t begin, index_t end, const double *b, double *y) const;
+
+	// r <- rhs - A s on the unknowns [begin, end) with compensated sums,
+	// returns max |r|
+	double residualCellsCompensated(index_t begin, index_t end, const double *rhs, const double *s, double *r) const;
+
+	// y <- A b, returns (<x,b>, <y,b>) computed in the same pass
+	std::pair<double, double> applyADots(const double *b, const double *x, double *y);
+
+	// preconditioners for double and single precision vectors
+	template<typename T>
+	void applyMultigrid(const T *r, T *z) const;
+	template<typename T>
+	void applyJacobi(const T *inv_diag, const T *r, T *z) const;
+	template<typename T>
+	void applyChebyshev(const T *inv_diag, const T *r, T *z, T *d, T *y) const;
+
+	// allocate the buffers of the Chebyshev preconditioner for the selected precision
+	void allocate_chebyshev_buffers();
+
+	// mixed precision version of solve_compact
+	void solveMixed(const double* rhs, double* p, bool use_initial_guess);
+
+	// solve_compact on the cells of the CG system, and on the components
+	// solved directly
+	void solveIterative(const double* rhs, double* p, bool use_initial_guess);
+	void solveDirect(const double* rhs, double* p) const;
+
+	// Chronopoulos-Gear version of solveIterative, r0 is the initial residual
+	void solveChronopoulosGear(const double* r0, double* p, bool use_initial_guess);
+
 	public:
 	ICConjugateGradientSolver();
 	~ICConjugateGradientSolver();
-	ICConjugateGradientSolver(unsigned max_steps, const Mac3d& grid);
+	/** Params:
+	 * - max_steps is the maximum number of CG iterations per solve
+	 * - grid is the MAC grid whose fluid cells define the system
+	 * - num_threads is the number of threads used by the kernels
+	 *   (< 1: all threads available to OpenMP)
+	 */
+	ICConjugateGradientSolver(unsigned max_steps, const Mac3d& grid, int num_threads = 1);
+
+	/** Select the preconditioner */
+	void set_preconditioner(PRECONDITIONER preconditioner);
+	PRECONDITIONER get_preconditioner() const { return preconditioner; }
 
+	/**
+	 * Parameters of the MIC(0) preconditioner (defaults 0.97 and 0.25):
+	 * - tau is the fraction of the dropped fill-in added to the diagonal
+	 *   (0: IC(0), 1: full modification, which preserves row sums)
+	 * - safety: where the modified diagonal falls below safety times the
+	 *   diagonal of A, the diagonal of A is used instead
+	 */
+	void set_mic_parameters(double tau, double safety) { this->tau = tau; mic_safety = safety; }
+	double get_mic_tau() const { return tau; }
+	double get_mic_safety() const { return mic_safety; }
+
+	/** Select the floating point precision */
+	void set_precision(PRECISION precision);
+	PRECISION get_precision() const { return precision; }
+
+	/**
+	 * Select the formulation of the CG iteration
+	 * (the mixed precision solver always uses the standard one)
+	 */
+	void set_variant(VARIANT variant);
+	VARIANT get_variant() const { return variant; }
+
+	/**
+	 * Solve fluid components of at most max_cells cells which touch air, such
+	 * as the droplets of a splash, with a dense Cholesky factorization instead
+	 * of CG. They leave the CG system, so its iterations no longer need to
+	 * converge on them. 0 (default) solves all fluid cells by CG. The dense
+	 * factor of a component takes max_cells^2 doubles, so max_cells is clamped
+	 * to max_direct_solve_size.
+	 */
+	void set_direct_solve_size(unsigned max_cells) { direct_solve_size = std::min(max_cells, max_direct_solve_size); }
+	unsigned get_direct_solve_size() const { return direct_solve_size; }
+
+	/** Number of components solved directly, as of the last update_fluid_cells */
+	unsigned get_num_direct_components() const { return direct_begin.empty() ? 0 : direct_begin.size() - 1; }
+
+	/** Select the ordering of the IC(0) preconditioner sweeps */
+	void set_sweep(SWEEP sweep) { this->sweep = sweep; }
+	SWEEP get_sweep() const { return sweep; }
+
+	/**
+	 * Number of CG iterations performed by the last call to solve
+	 * (with mixed precision: the total number of inner iterations)
+	 */
+	unsigned get_num_iterations() const { return step; }
+
+	/** Max norm of the right-hand side of the last solve */
+	double get_rhs_norm() const { return rhs_norm; }
+
+	/**
+	 * Max norm of the initial residual of the last solve
+	 * (equal to get_rhs_norm() without initial guess)
+	 */
+	double get_initial_residual() const { return initial_residual; }
+
+	/** Max norm of the residual at which the iteration stops */
+	double get_tolerance() const { return thresh; }
+
+	/**
+	 * Build the compact numbering of the fluid cells from Mac3d::pfluid_.
+	 * Must be called whenever the fluid cells changed, before any other
+	 * method working on compact vectors.
+	 */
+	void update_fluid_cells();
+
+	/** Number of unknowns, i.e. fluid cells, of the compact system */
+	index_t get_num_fluid_cells() const { return num_fluid + num_direct; }
+
+	/** Grid index (i + j*nx + k*nx*ny) of every unknown of the compact system */
+	const index_t* get_fluid_cells() const { return fluid_cells; }
+
+	/**
+	 * Call f(c) for the unknowns c of [begin, end) in descending order, as the
+	 * backward substitution does on an x-row
+	 */
+	template<typename F>
+	static void for_each_cell_reverse(const index_t begin, const index_t end, F f) {
+		for (signed_index_t c = signed_index_t(end) - 1; c >= signed_index_t(begin); c--) f(c);
+	}
+
+	/**
+	 * Write a compact vector to the fluid cells of a grid-sized array.
+	 * Cells written by the previous call, which are no longer fluid, are set
+	 * to zero, so that the array is zero on all non-fluid cells as long as it
+	 * is only written by this method (the first call zeroes the whole array).
+	 */
+	void scatter_solution(const double* p, double* grid_p);
+
+	// set up the preconditioner for the current fluid cells; these kernels
+	// work on the cells of the CG system, i.e. on all fluid cells unless
+	// components are solved directly
 	void computePreconDiag();
 	void applyPreconditioner(const double *r, double *z) const;
 	void applyA(const double *s, double *z) const;
 
-    void solve(const double* rhs, double* p);
+	// single precision versions, which need set_precision(PRECISION_MIXED)
+	void applyPreconditioner(const float *r, float *z) const;
+	void applyA(const float *s, float *z) const;
+
+	/**
+	 * Solve the system for compact vectors rhs and p.
+	 * update_fluid_cells must have been called before.
+	 * If use_initial_guess is set, the iteration starts from the values in p,
+	 * which then needs the padding entry (it is set to zero), otherwise from zero.
+	 */
+	void solve_compact(const double* rhs, double* p, bool use_initial_guess = false);
+
+	/**
+	 * Solve the system for grid-sized vectors rhs and p.
+	 * Updates the fluid cells, p is set to zero on all non-fluid cells.
+	 */
+	void solve(const double* rhs, double* p);
 };
 
 
@@ -85,22 +85,40 @@ public:
 	 */
 	void apply_pressure_correction(const double dt);
 
-	/** Transfer grid velocities to particles
+	/** Transfer grid velocities to particles, in batches of simd::vec::width
+	 *  particles (see Mac3d::grid_interpolate_batch), which interpolate a
+	 *  single blended field per component except in the boundary cells. Also
+	 *  finds the maximal new particle velocity components for the CFL
+	 *  condition (see compute_timestep)
 	 */
 	void grid_to_particle();
 
-	/** Compute timestep to satisfy CFL condition
+	/** Compute timestep to satisfy CFL condition, from the particle
+	 *  velocities
 	 * Params:
 	 * - dt is the amount of time to advance the simulation by, and to 
 	 * 	 subsample
 	 */
 	double compute_timestep( const double dt );
 
-	/** Apply RK2 to update particle positions
+	/** Compute timestep to satisfy CFL condition, from the maximal
+	 *  particle velocity components
 	 * Params:
-	 * - dt is the amount of time to advance the simulation by
+	 * - dt is the amount of time to advance the simulation by, and to 
+	 * 	 subsample
+	 * - u_max, v_max, w_max are the maximal absolute velocity components
 	 */
-	void advance_particles(const double dt);
+	double compute_timestep( const double dt, const double u_max,
+							 const double v_max, const double w_max ) const;
+
+	/** Apply RK2 to update particle positions, in batches of 4 particles
+	 *  which go through all the substeps before the next batch is loaded.
+	 *  The grid velocities must not change between grid_to_particle and this
+	 * Params:
+	 * - dt is the amount of time to advance the simulation by in each substep
+	 * - num_substeps is the number of substeps
+	 */
+	void advance_particles(const double dt, const int num_substeps = 1);
 
 private:
 
@@ -116,7 +134,7 @@ private:
 	Particles& particles_;
 	
 	// Total number of particles
-	const unsigned num_particles_;
+	const Particles::particleIdx_t num_particles_;
 	
 	// Density of the fluid to be simulated
 	const double fluid_density_;
@@ -130,18 +148,91 @@ private:
 	
 	// Pointer to MAC Grid
 	Mac3d* MACGrid_;
+
+	// Number of threads of the parallelized substeps (see SimConfig::getNumThreads)
+	const int num_threads_;
 	
 	// Pressure-Matrix
 	SparseMat_t A_;
 	
-	// RHS of pressure LSE
+	// RHS of pressure LSE (fluid cells only, in the numbering of cg_solver)
 	double* d_;
 
+	// Solution of pressure LSE (fluid cells only, in the numbering of cg_solver)
+	double* p_;
+
 	// Pressure vector
 	std::vector<double> p;
 
 	// Conjugate Gradient Solver
 	ICConjugateGradientSolver cg_solver;
+
+	// Initial guess of the pressure solve (see SimConfig::getPressureInitialGuess)
+	enum PRESSURE_GUESS { PRESSURE_GUESS_ZERO, PRESSURE_GUESS_PREVIOUS, PRESSURE_GUESS_EXTRAPOLATE };
+	PRESSURE_GUESS pressure_guess_;
+
+	// Grid pressure of the solve before the last one (only for extrapolation)
+	double* pressure_old_;
+
+	// Kernel of the particle-to-grid transfer (see SimConfig::getParticleToGridKernel)
+	enum P2G_KERNEL { P2G_KERNEL_SPH, P2G_KERNEL_TRILINEAR, P2G_KERNEL_QUADRATIC };
+	P2G_KERNEL p2g_kernel_;
+
+	// Method of the particle-to-grid transfer (see SimConfig::getParticleToGridMethod)
+	enum P2G_METHOD { P2G_METHOD_SCATTER, P2G_METHOD_GATHER };
+	P2G_METHOD p2g_method_;
+
+	// Particles sorted by cell for the gathering particle-to-grid transfer:
+	// the particles of cell c are offsets[c], ..., offsets[c+1]-1
+	struct CellList {
+		std::vector<Particles::particleIdx_t> offsets;
+		std::vector<Mac3d::globalCellIdx_t> cell_idx;
+		std::vector<real_t> x, y, z, u, v, w;
+	};
+	CellList cell_list_;
+
+	// Particles binned by z-slab for the scattering particle-to-grid transfer
+	// (see particle_to_grid_scatter): the z-index of the cell of every
+	// particle, and the indices of the particles reaching each slab
+	std::vector<int> particle_layer_;
+	std::vector<Particles::particleIdx_t> slab_particles_;
+
+	// Sort the particles by cell every this many steps (see SimConfig::getParticleSortInterval)
+	int particle_sort_interval_;
+	Particles::SORT_ORDER particle_sort_order_;
+
+	// Number of layers of the velocity extrapolation, 0 to follow the CFL
+	// number (see SimConfig::getExtrapolationLayers)
+	int extrapolation_layers_;
+
+	// Number of advection substeps of the last step, i.e. the number of cells
+	// the fastest particle could travel
+	int last_num_substeps_;
+
+	// Layer in which every face of the extrapolated velocity field got its
+	// velocity, and the lowest layer of the faces of every row (j, k)
+	std::vector<unsigned char> extrapolation_layer_;
+	std::vector<unsigned char> extrapolation_row_layer_;
+
+	// Faces which got a velocity in the current layer of the extrapolation,
+	// per thread, flagged in extrapolation_layer_ once the layer is complete
+	std::vector<std::vector<Mac3d::globalCellIdx_t>> extrapolation_new_faces_;
+
+	// Maximal absolute particle velocity components after the last
+	// grid_to_particle
+	double u_max_;
+	double v_max_;
+	double w_max_;
+
+	// Whether the ghost fields of the grid (see Mac3d::update_ghost_fields)
+	// hold the current velocities: set by grid_to_particle, so that the
+	// advection substeps which follow it don't copy them again, and cleared
+	// by every method which writes the grid velocities
+	bool ghost_fields_current_;
+
+	// Number of consecutive previous pressure solves, up to 2, in which each
+	// cell was a fluid cell (only with an initial guess)
+	unsigned char* fluid_age_;
 	
 	/** Compute the weight using the SPH Kernels multiplied by the norm 
 	 * 	||x_p - x_uij||
@@ -178,40 +269,82 @@ private:
 						 const double h,
 						 const Mac3d::globalCellIdx_t idx );
 	
-	/** Normalize accumulated velocities
+	/** Accumulate the particle velocities and weights on the faces of a slab
+	 *  of z-layers, and flag the cells of the particles in the slab as fluid
+	 * Params:
+	 * - k_begin, k_end is the range of z-indices of the faces and cells
+	 *   written (face k of w is the lower face of cell layer k)
+	 * - slab_particles are the indices of the particles which may reach the
+	 *   slab, in increasing order, or nullptr for all the particles
+	 * - num_slab_particles is the number of particles visited
+	 */
+	void particle_to_grid_slab( const int k_begin,
+								const int k_end,
+								const Particles::particleIdx_t* const slab_particles,
+								const Particles::particleIdx_t num_slab_particles );
+
+	/** Same as particle_to_grid_slab with the separable B-spline kernel of
+	 *  the given width (2: trilinear, 3: quadratic) instead of the SPH kernel
+	 */
+	template <int width>
+	void particle_to_grid_slab_bspline( const int k_begin,
+										const int k_end,
+										const Particles::particleIdx_t* const slab_particles,
+										const Particles::particleIdx_t num_slab_particles );
+
+	/** Accumulate the particle velocities and weights on the faces by
+	 *  scattering each particle onto its neighboring faces (in parallel over
+	 *  slabs, see particle_to_grid_slab), and flag the fluid cells. With more
+	 *  than one thread, the particles are first binned by slab (in parallel),
+	 *  so every thread only visits the particles reaching its slab
+	 */
+	void particle_to_grid_scatter();
+
+	/** Sort the particles into the cell list cell_list_
+	 */
+	void build_cell_list();
+
+	/** Compute the normalized velocities on the faces by gathering, for each
+	 *  face, the contributions of the particles in the neighboring cells from
+	 *  the cell list, and flag the fluid cells and the visited faces (in the
+	 *  visited masks of the grid)
+	 */
+	template <P2G_KERNEL kernel>
+	void particle_to_grid_gather();
+
+	/** Normalize accumulated velocities, and flag the visited faces in the
+	 *  visited masks of the grid
 	 * Params:
-	 * - visited_u is a lists of flags for visited grid-velocities: 
-	 * 	 1 -> visited from particle_to_grid
-	 * - visited_v is a lists of flags for visited grid-velocities: 
-	 * 	 1 -> visited from particle_to_grid
-	 * - visited_w is a lists of flags for visited grid-velocities: 
-	 * 	 1 -> visited from particle_to_grid
 	 * - nx, ny, nz are the grid dimensions
 	 */
-	void normalize_accumulated_vels( bool* const visited_u, 
-									 bool* const visited_v, 
-									 bool* const visited_w, 
-									 Mac3d::cellIdx_t nx, 
+	void normalize_accumulated_vels( Mac3d::cellIdx_t nx, 
 									 Mac3d::cellIdx_t ny, 
 									 Mac3d::cellIdx_t nz );
 	
-	/** Extrapolate velocities into air cells
+	/** Extrapolate velocities into air cells, in layers: the faces of layer
+	 *  L are the faces without a velocity next to a face of a layer < L (the
+	 *  visited faces being layer 0), and get the average velocity of those
+	 *  neighbors
 	 * Params:
 	 * - vel is the velocity field on the grid
-	 * - visited_vel is a lists of flags for visited grid-velocities: 
-	 * 	 1 -> visited from particle_to_grid
+	 * - visited_vel is the bit mask of visited grid-velocities (see
+	 *   Mac3d::pvisited_u_): 1 -> visited from particle_to_grid
 	 * - n, m, l are the dimensions of the velocity fields (beware that 
 	 *   velocities are stored on faces, thus a +1 is needed on the primary 
 	 *   dimension, e.g. size(u) = (nx+1)*ny*nz -> n=nx+1, m=ny, l=nz)
+	 * - num_layers is the number of layers to extrapolate
 	 */
-	void extrapolate_vel( double* const vel,
-						  const bool* const visited_vel,
+	void extrapolate_vel( real_t* const vel,
+						  const std::uint64_t* const visited_vel,
 						  const Mac3d::cellIdx_t n,
 						  const Mac3d::cellIdx_t m,
-						  const Mac3d::cellIdx_t l );
+						  const Mac3d::cellIdx_t l,
+						  const int num_layers );
 
 	void compute_pressure_matrix();
 	void compute_pressure_rhs(const double dt);
+	void compute_pressure_guess();
+	void update_pressure_history();
 	void apply_pressure_gradients(const double dt);
 };
 
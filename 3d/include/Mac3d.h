@@ -9,6 +9,10 @@
 #include <algorithm>	//std::fill
 #include <cassert>		//assertions
 #include <cstdlib>
+#include <cstdint>		//std::uint64_t
+#include <immintrin.h>	//AVX2 batch interpolation
+#include "precision.h"	//real_t
+#include "indices.h"	//index_t
 #include <stdlib.h>
 
 class Mac3d{
@@ -23,9 +27,10 @@ class Mac3d{
 		using cellIdx_t = int;
 
 		/**
-		 * Index type for global cell indices.
+		 * Index type for global cell and face indices, 64-bit with
+		 * WATERSIM_64BIT_INDICES (see indices.h).
 		 */
-		using globalCellIdx_t = int;
+		using globalCellIdx_t = signed_index_t;
 
 		/**
 		 * Used to tell methods which grid to operate on.
@@ -37,6 +42,31 @@ class Mac3d{
 		 */
 		enum INTERPOLATION_MODE { INTERPOLATE_ONE, INTERPOLATE_BOTH };
 
+		/**
+		 * Used to tell grid_interpolate_batch which ghost field to interpolate
+		 * (see update_ghost_fields and update_blend_ghost_fields)
+		 */
+		enum GHOST_FIELD { GHOST_VELOCITY, GHOST_BLEND };
+
+		/**
+		 * Stencil of simd::vec::width positions, shared by the batch
+		 * interpolations of the three velocity components at these positions
+		 * (see compute_stencil_batch). Along every axis, the grid of a
+		 * component is either the cell-centered one or the one staggered along
+		 * that axis.
+		 */
+		struct BatchStencil {
+			//base cells along x, y, z, clamped to the ghost layer, and
+			//weights clamped to [0, 1], on the cell-centered grid
+			simd::vec::type cell_c[3];
+			simd::vec::type weight_c[3];
+
+			//same on the grid staggered along each axis, whose base cells are
+			//the cells containing the positions (see get_cell_index)
+			simd::vec::type cell_s[3];
+			simd::vec::type weight_s[3];
+		};
+
 		//------------------- GRID Properties --------------------------
 		//number of cells respectively in x-direction,
 		//y-direction, z-direction
@@ -65,15 +95,15 @@ class Mac3d{
 		
 		//pointer to array for the velocities respecitvely in x-direction
 		//y-direction, z-direction
-		double* pu_;
-		double* pv_;
-		double* pw_;
+		real_t* pu_;
+		real_t* pv_;
+		real_t* pw_;
 		
 		//pointer to the temporary copy of velocity field u*, v*, w*
 		//respectively in x-direction, y-direction, z-direction
-		double* pu_star_;
-		double* pv_star_;
-		double* pw_star_;
+		real_t* pu_star_;
+		real_t* pv_star_;
+		real_t* pw_star_;
 		
 		//pointer to array for specifing if a cell is solid (1) or not(0)
 		bool* psolid_;
@@ -88,9 +118,36 @@ class Mac3d{
 		std::vector<double> A_diag_val;
 		
 		//pointer to the weights for particle-to-grid respectively for u, v, w
-		double* pweights_u_;
-		double* pweights_v_;
-		double* pweights_w_;
+		real_t* pweights_u_;
+		real_t* pweights_v_;
+		real_t* pweights_w_;
+
+		//bit masks of the faces which received a weight in the last
+		//particle-to-grid transfer, respectively for u, v, w (bit idx%64 of
+		//word idx/64 for the face with global index idx)
+		std::uint64_t* pvisited_u_;
+		std::uint64_t* pvisited_v_;
+		std::uint64_t* pvisited_w_;
+
+		//generation of the current particle-to-grid accumulation, and for every
+		//row (j, k) of faces along x, the generation in which the velocities and
+		//weights of the row were last reset. The rows of an older generation were
+		//not reached by any particle: their weights are stale and never read
+		unsigned p2g_generation_;
+		unsigned* prow_generation_;
+
+		//copies of u, v, w with a ghost layer of faces around the grid, which
+		//repeats the outermost faces (see update_ghost_fields). The face
+		//(i, j, k) of u is pu_ghost_[(i+1) + (N_+3)*((j+1) + (M_+2)*(k+1))]
+		real_t* pu_ghost_;
+		real_t* pv_ghost_;
+		real_t* pw_ghost_;
+
+		//same for the blended fields u - c*u*, v - c*v*, w - c*w* of the
+		//FLIP/PIC update (see update_blend_ghost_fields)
+		real_t* pu_blend_ghost_;
+		real_t* pv_blend_ghost_;
+		real_t* pw_blend_ghost_;
 		
 		/** Default Constructor
 		*/
@@ -122,11 +179,23 @@ class Mac3d{
 			delete[] pweights_u_;
 			delete[] pweights_v_;
 			delete[] pweights_w_;
+			delete[] pvisited_u_;
+			delete[] pvisited_v_;
+			delete[] pvisited_w_;
+			delete[] prow_generation_;
+			delete[] pu_ghost_;
+			delete[] pv_ghost_;
+			delete[] pw_ghost_;
+			delete[] pu_blend_ghost_;
+			delete[] pv_blend_ghost_;
+			delete[] pw_blend_ghost_;
 		}
 
 		/**Initialize the arrays of the class to zero, in particular:
 		 * ppressure_, pu_, pv_, pw_, pu_star_, pv_star_, pw_star_,
-		 * psolid_, pfluid_, pweights_u_,  pweights_v_, pweights_w_.
+		 * psolid_, pfluid_, pweights_u_,  pweights_v_, pweights_w_,
+		 * pvisited_u_, pvisited_v_, pvisited_w_, prow_generation_ and the ghost
+		 * fields pu_ghost_, ..., pw_blend_ghost_.
 		 */
 		void initArrays();
 
@@ -219,7 +288,13 @@ class Mac3d{
 		
 		/**Return the total number of cells of the grid
 		 */
-		unsigned get_num_cells() const;
+		index_t get_num_cells() const;
+
+		/**Return the number of faces of the grid of u, v or w
+		 */
+		inline index_t get_num_faces(const GRID grid_name) const {
+			return index_t(N_ + (grid_name == GRID_U)) * (M_ + (grid_name == GRID_V)) * (L_ + (grid_name == GRID_W));
+		}
 		
 		/**Return the dimension of one cell in x-direction in meter
 		 */
@@ -329,6 +404,73 @@ class Mac3d{
 		 */
 		void reset_fluid();
 
+		/**Start a new particle-to-grid accumulation: clear the visited masks and
+		 * advance the generation, which marks all rows of faces as not reset
+		 */
+		void begin_accumulation();
+
+		/**Reset the velocities and weights of the u, v and w faces in the row
+		 * (j, k) to zero, unless it was already done in the current accumulation.
+		 * Rows outside of the grid are ignored
+		 * Params:
+		 * - j, k are the indices of the row of faces along x
+		 */
+		inline void touch_row(const cellIdx_t j, const cellIdx_t k) {
+			if (j < 0 || k < 0 || j > (cellIdx_t) M_ || k > (cellIdx_t) L_) return;
+			unsigned& generation = prow_generation_[j + (M_+1)*k];
+			if (generation == p2g_generation_) return;
+			generation = p2g_generation_;
+			if (j < (cellIdx_t) M_ && k < (cellIdx_t) L_) {
+				const index_t row = index_t(N_+1)*(j + M_*k);
+				std::fill(pu_ + row, pu_ + row + N_+1, 0.);
+				std::fill(pweights_u_ + row, pweights_u_ + row + N_+1, 0.);
+			}
+			if (k < (cellIdx_t) L_) {
+				const index_t row = index_t(N_)*(j + (M_+1)*k);
+				std::fill(pv_ + row, pv_ + row + N_, 0.);
+				std::fill(pweights_v_ + row, pweights_v_ + row + N_, 0.);
+			}
+			if (j < (cellIdx_t) M_) {
+				const index_t row = index_t(N_)*(j + M_*k);
+				std::fill(pw_ + row, pw_ + row + N_, 0.);
+				std::fill(pweights_w_ + row, pweights_w_ + row + N_, 0.);
+			}
+		}
+
+		/**Return if the row (j, k) of faces was reset in the current accumulation
+		 * Params:
+		 * - j, k are the indices of the row of faces along x
+		 */
+		inline bool is_row_touched(const cellIdx_t j, const cellIdx_t k) const {
+			return prow_generation_[j + (M_+1)*k] == p2g_generation_;
+		}
+
+		/**Return if the bit of the face with global index idx is set in the mask
+		 * Params:
+		 * - mask is one of pvisited_u_, pvisited_v_, pvisited_w_
+		 * - idx is the global index of the face
+		 */
+		static inline bool is_visited(const std::uint64_t* mask, const globalCellIdx_t idx) {
+			return (mask[idx >> 6] >> (idx & 63)) & 1;
+		}
+
+		/**Copy u, v, w into the ghost fields used by grid_interpolate_batch,
+		 * which must be called again whenever these velocities change
+		 * Params:
+		 * - num_threads is the number of threads copying the z-layers
+		 */
+		void update_ghost_fields(const int num_threads = 1);
+
+		/**Compute the blended fields u - coeff*u*, v - coeff*v*, w - coeff*w*
+		 * into their ghost fields: the interpolation of the FLIP/PIC update
+		 * interp(u) + (u_p - interp(u*))*coeff is interp(u - coeff*u*) + coeff*u_p,
+		 * as interpolation is linear
+		 * Params:
+		 * - coeff is the FLIP coefficient of the update
+		 * - num_threads is the number of threads computing the z-layers
+		 */
+		void update_blend_ghost_fields(const double coeff, const int num_threads = 1);
+
 		/** Return the indices in which the point with coordinate (x,y,z)
 		 * lies as a Eigen::Vector3d
 		 * Params:
@@ -386,11 +528,11 @@ class Mac3d{
 			// intersection points of the grid.
 			// This means the grid will have different dimensions and offsets depending
 			// on which one we are working on, given by template parameter grid_name.
-			unsigned nx = N_;
-			unsigned ny = M_;
-			unsigned nz = L_;
-			double* g;
-			double* g_star;
+			index_t nx = N_;
+			index_t ny = M_;
+			index_t nz = L_;
+			real_t* g;
+			real_t* g_star;
 			double offset_x = 0;
 			double offset_y = 0;
 			double offset_z = 0;
@@ -444,14 +586,14 @@ class Mac3d{
 			bool inside = inside_left && inside_right && inside_bottom && inside_top && inside_front && inside_back;
 			if (inside) {
 				// If we're inside the domain, perform trilinear interpolation
-				unsigned i000 = (cell_x) + nx * (cell_y) + ny * nx * (cell_z);
-				unsigned i001 = (cell_x) + nx * (cell_y) + ny * nx * (cell_z + 1);
-				unsigned i010 = (cell_x) + nx * (cell_y + 1) + ny * nx * (cell_z);
-				unsigned i011 = (cell_x) + nx * (cell_y + 1) + ny * nx * (cell_z + 1);
-				unsigned i100 = (cell_x + 1) + nx * (cell_y) + ny * nx * (cell_z);
-				unsigned i101 = (cell_x + 1) + nx * (cell_y) + ny * nx * (cell_z + 1);
-				unsigned i110 = (cell_x + 1) + nx * (cell_y + 1) + ny * nx * (cell_z);
-				unsigned i111 = (cell_x + 1) + nx * (cell_y + 1) + ny * nx * (cell_z + 1);
+				index_t i000 = (cell_x) + nx * (cell_y) + ny * nx * (cell_z);
+				index_t i001 = (cell_x) + nx * (cell_y) + ny * nx * (cell_z + 1);
+				index_t i010 = (cell_x) + nx * (cell_y + 1) + ny * nx * (cell_z);
+				index_t i011 = (cell_x) + nx * (cell_y + 1) + ny * nx * (cell_z + 1);
+				index_t i100 = (cell_x + 1) + nx * (cell_y) + ny * nx * (cell_z);
+				index_t i101 = (cell_x + 1) + nx * (cell_y) + ny * nx * (cell_z + 1);
+				index_t i110 = (cell_x + 1) + nx * (cell_y + 1) + ny * nx * (cell_z);
+				index_t i111 = (cell_x + 1) + nx * (cell_y + 1) + ny * nx * (cell_z + 1);
 
 				double alpha = (pos_x - min_x) * rcell_sizex_;
 				double beta  = (pos_y - min_y) * rcell_sizey_;
@@ -469,8 +611,8 @@ class Mac3d{
 
 			// On the boundaries of the domain, handle special cases
 			else {
-				unsigned i0, i1;
-				unsigned i00, i01, i10, i11;
+				index_t i0, i1;
+				index_t i00, i01, i10, i11;
 
 				if (!inside_left) {
 					if (!inside_top) {
@@ -594,6 +736,128 @@ class Mac3d{
 
 		}
 
+		/**
+		 * Compute the stencil of simd::vec::width positions for
+		 * grid_interpolate_batch, in real_t.
+		 * Cell indices are clamped to the ghost layer [-1, n-1] and weights to
+		 * [0, 1]: outside of the grid the ghost faces repeat the outermost
+		 * ones, which gives the value on the boundary
+		 * @param pos_x 				Positions x.
+		 * @param pos_y					Positions y.
+		 * @param pos_z					Positions z.
+		 * @return 						The stencil.
+		 */
+		inline BatchStencil compute_stencil_batch(const simd::vec::type pos_x, const simd::vec::type pos_y,
+		                                          const simd::vec::type pos_z) const {
+			namespace vec = simd::vec;
+			const vec::type pos[3] = {pos_x, pos_y, pos_z};
+			const double rcell_size[3] = {rcell_sizex_, rcell_sizey_, rcell_sizez_};
+			const double num_cells[3] = {(double)N_, (double)M_, (double)L_};
+
+			const vec::type minus_one = vec::set1(-1.);
+			const vec::type zero = vec::zero();
+			const vec::type one = vec::set1(1.);
+			const vec::type half = vec::set1(0.5);
+
+			BatchStencil stencil;
+			for (unsigned a = 0; a < 3; ++a) {
+				// Positions in cells on the cell-centered grid, and on the
+				// staggered grid, which starts half a cell lower
+				const vec::type t_c = vec::mul(pos[a], vec::set1(rcell_size[a]));
+				const vec::type t_s = vec::fmadd(pos[a], vec::set1(rcell_size[a]), half);
+
+				stencil.cell_c[a] = vec::min(vec::max(vec::floor(t_c), minus_one), vec::set1(num_cells[a] - 1.));
+				stencil.cell_s[a] = vec::min(vec::max(vec::floor(t_s), minus_one), vec::set1(num_cells[a]));
+				stencil.weight_c[a] = vec::min(vec::max(vec::sub(t_c, stencil.cell_c[a]), zero), one);
+				stencil.weight_s[a] = vec::min(vec::max(vec::sub(t_s, stencil.cell_s[a]), zero), one);
+			}
+			return stencil;
+		}
+
+		/**
+		 * Find the positions of a stencil which are in a boundary cell, i.e. a
+		 * cell with index 0 or n-1 along some axis
+		 * @param stencil 				Stencil of simd::vec::width positions
+		 *								in the grid.
+		 * @return 						Bit b is set if position b is in a
+		 *								boundary cell.
+		 */
+		inline int stencil_on_boundary(const BatchStencil& stencil) const {
+			namespace vec = simd::vec;
+			const double num_cells[3] = {(double)N_, (double)M_, (double)L_};
+			vec::type on_boundary = vec::zero();
+			for (unsigned a = 0; a < 3; ++a) {
+				on_boundary = vec::bit_or(on_boundary, vec::cmp<_CMP_EQ_OQ>(stencil.cell_s[a], vec::zero()));
+				on_boundary = vec::bit_or(on_boundary, vec::cmp<_CMP_EQ_OQ>(stencil.cell_s[a], vec::set1(num_cells[a] - 1.)));
+			}
+			return vec::movemask(on_boundary);
+		}
+
+		/**
+		 * Interpolate a velocity component from the MAC grid at
+		 * simd::vec::width positions at once, in real_t, with the same result
+		 * as grid_interpolate up to rounding.
+		 * Reads the ghost fields (see update_ghost_fields), on which the
+		 * positions on and outside of the boundaries take the trilinear path
+		 * with clamped cell indices and weights instead of the special cases
+		 * for the boundary faces, edges and corners.
+		 * @tparam grid_name			The grid to interpolate from.
+		 * @tparam field				The velocities, or the blended field of
+		 *								the FLIP/PIC update.
+		 * @param stencil 				Stencil of the positions to interpolate
+		 *								to (see compute_stencil_batch).
+		 * @return 						Interpolated values.
+		 */
+		template<GRID grid_name, GHOST_FIELD field = GHOST_VELOCITY>
+		inline simd::vec::type grid_interpolate_batch(const BatchStencil& stencil) const {
+			static_assert(grid_name == GRID_U || grid_name == GRID_V || grid_name == GRID_W,
+			              "[Mac3d::grid_interpolate_batch] Invalid template arguments!");
+
+			// Dimensions of the staggered grid, see grid_interpolate
+			constexpr unsigned axis = (grid_name == GRID_U) ? 0 : (grid_name == GRID_V) ? 1 : 2;
+			const unsigned nx = N_ + (axis == 0);
+			const unsigned ny = M_ + (axis == 1);
+			const real_t* g;
+
+			if constexpr(grid_name == GRID_U) {
+				g = (field == GHOST_BLEND) ? pu_blend_ghost_ : pu_ghost_;
+			} else if constexpr(grid_name == GRID_V) {
+				g = (field == GHOST_BLEND) ? pv_blend_ghost_ : pv_ghost_;
+			} else if constexpr(grid_name == GRID_W) {
+				g = (field == GHOST_BLEND) ? pw_blend_ghost_ : pw_ghost_;
+			}
+
+			// The staggered axis of the grid takes the staggered stencil
+			const simd::vec::type cell_x = (axis == 0) ? stencil.cell_s[0] : stencil.cell_c[0];
+			const simd::vec::type cell_y = (axis == 1) ? stencil.cell_s[1] : stencil.cell_c[1];
+			const simd::vec::type cell_z = (axis == 2) ? stencil.cell_s[2] : stencil.cell_c[2];
+			const simd::vec::type alpha = (axis == 0) ? stencil.weight_s[0] : stencil.weight_c[0];
+			const simd::vec::type beta  = (axis == 1) ? stencil.weight_s[1] : stencil.weight_c[1];
+			const simd::vec::type gamma = (axis == 2) ? stencil.weight_s[2] : stencil.weight_c[2];
+
+			// Index of the face (cell_x, cell_y, cell_z) in the ghost field
+			const int stride_y = nx + 2;
+			const int stride_z = (nx + 2) * (ny + 2);
+			const simd::vec::index_t i000 = simd::vec::face_index(cell_x, cell_y, cell_z, stride_y, ny + 2);
+
+			return trilinear_interpolation_gather(g, i000, stride_y, stride_z, alpha, beta, gamma);
+		}
+
+		/**
+		 * Interpolate a velocity component from the MAC grid at
+		 * simd::vec::width positions at once, see
+		 * grid_interpolate_batch(stencil)
+		 * @param pos_x 				Positions x to interpolate to.
+		 * @param pos_y					Positions y to interpolate to
+		 * @param pos_z					Positions z to interpolate to
+		 * @return 						Interpolated values.
+		 */
+		template<GRID grid_name, GHOST_FIELD field = GHOST_VELOCITY>
+		inline simd::vec::type grid_interpolate_batch(const simd::vec::type pos_x, const simd::vec::type pos_y,
+		                                              const simd::vec::type pos_z) const {
+			return grid_interpolate_batch<grid_name, field>(compute_stencil_batch(pos_x, pos_y, pos_z));
+		}
+
 	/**
 	 * Perform linear interpolation on the normalized [0, 1] domain.
 	 * @param value0 	Value at position x=0
@@ -653,10 +917,56 @@ class Mac3d{
 
 private:
 
+	/**
+	 * Gather the 8 values around the faces i000 of g and perform trilinear
+	 * interpolation on the normalized domain, as trilinear_interpolation_normalized
+	 * @param g 		Field to interpolate, with the strides stride_y, stride_z
+	 * @param i000 		Indices of the faces at position (0, 0, 0)
+	 * @param alpha 	Positions on the x-axis in [0, 1] space to interpolate to
+	 * @param beta 		Positions on the y-axis in [0, 1] space to interpolate to
+	 * @param gamma 	Positions on the z-axis in [0, 1] space to interpolate to
+	 */
+	static inline simd::vec::type trilinear_interpolation_gather(const real_t* g, const simd::vec::index_t i000,
+	                                                             const int stride_y, const int stride_z,
+	                                                             const simd::vec::type alpha, const simd::vec::type beta,
+	                                                             const simd::vec::type gamma) {
+		namespace vec = simd::vec;
+		const vec::index_t i010 = vec::add_index(i000, stride_y);
+		const vec::index_t i001 = vec::add_index(i000, stride_z);
+		const vec::index_t i011 = vec::add_index(i010, stride_z);
+
+		const vec::type v000 = vec::gather(g,     i000);
+		const vec::type v100 = vec::gather(g + 1, i000);
+		const vec::type v010 = vec::gather(g,     i010);
+		const vec::type v110 = vec::gather(g + 1, i010);
+		const vec::type v001 = vec::gather(g,     i001);
+		const vec::type v101 = vec::gather(g + 1, i001);
+		const vec::type v011 = vec::gather(g,     i011);
+		const vec::type v111 = vec::gather(g + 1, i011);
+
+		const vec::type v00 = vec::fmadd(alpha, vec::sub(v100, v000), v000);
+		const vec::type v01 = vec::fmadd(alpha, vec::sub(v101, v001), v001);
+		const vec::type v10 = vec::fmadd(alpha, vec::sub(v110, v010), v010);
+		const vec::type v11 = vec::fmadd(alpha, vec::sub(v111, v011), v011);
+
+		const vec::type v0 = vec::fmadd(beta, vec::sub(v10, v00), v00);
+		const vec::type v1 = vec::fmadd(beta, vec::sub(v11, v01), v01);
+
+		return vec::fmadd(gamma, vec::sub(v1, v0), v0);
+	}
+
+	/**
+	 * Copy the field g - coeff*g_star (g if g_star is null) of dimensions
+	 * n, m, l into g_ghost, of dimensions n+2, m+2, l+2, with the ghost faces
+	 * repeating the outermost faces, in parallel over the z-layers of g_ghost
+	 */
+	static void fill_ghost_field(const real_t* g, const real_t* g_star, const double coeff, real_t* g_ghost,
+	                             const cellIdx_t n, const cellIdx_t m, const cellIdx_t l, const int num_threads);
+
 	template<INTERPOLATION_MODE interpolation_mode>
-	inline std::pair<double, double> do_lerp(const int i0, const int i1, const double min_pos,
+	inline std::pair<double, double> do_lerp(const index_t i0, const index_t i1, const double min_pos,
 										  const double r_size, const double pos,
-										  const double* g, const double* g_star) const {
+										  const real_t* g, const real_t* g_star) const {
 		double alpha = (pos - min_pos) * r_size;
 		double ret = linear_interpolation_normalized(g[i0], g[i1], alpha);
 		double ret_star = 0;
@@ -667,11 +977,11 @@ private:
 	}
 
 	template<INTERPOLATION_MODE interpolation_mode>
-	inline std::pair<double, double> do_blerp(const int i00, const int i01, int i10, int i11,
+	inline std::pair<double, double> do_blerp(const index_t i00, const index_t i01, index_t i10, index_t i11,
 										   const double min_x, const double min_y,
 										   const double r_size_x, const double r_size_y,
 										   const double pos_x, const double pos_y,
-										   const double* g, const double* g_star) const {
+										   const real_t* g, const real_t* g_star) const {
 		double alpha = (pos_x - min_x) * r_size_x;
 		double beta = (pos_y - min_y) * r_size_y;
 		double ret = bilinear_interpolation_normalized(g[i00], g[i01], g[i10], g[i11], alpha, beta);
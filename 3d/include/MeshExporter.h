@@ -24,7 +24,7 @@ class MeshExporter{
 		Particles& particles_;
 		
 		//number of fluid particles in the list particles_
-		unsigned num_particles_;
+		Particles::particleIdx_t num_particles_;
 		
 		//counter for the number of exported meshes
 		unsigned num_exported_ = 0;
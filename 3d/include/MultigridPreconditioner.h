@@ -0,0 +1,89 @@
+#ifndef WATERSIM_MULTIGRIDPRECONDITIONER_H
+#define WATERSIM_MULTIGRIDPRECONDITIONER_H
+
+#include <vector>
+#include "Mac3d.h"
+
+/**
+ * Matrix-free geometric multigrid V-cycle, used as preconditioner for the
+ * pressure solve (MGPCG, see McAdams et al., "A parallel multigrid Poisson
+ * solver for fluids simulation on large grids", 2010).
+ *
+ * The finest level applies the same 7-point operator as
+ * ICConjugateGradientSolver::applyA on the cells flagged in Mac3d::pfluid_.
+ * Coarser levels are built by merging 2x2x2 blocks of cells:
+ * - a coarse cell is air if any of its fine cells is air
+ * - otherwise it is fluid if any of its fine cells is fluid
+ * - otherwise it is solid
+ * and use the same 7-point operator, rediscretized on the coarse cells.
+ *
+ * Smoothing is done with red-black Gauss-Seidel, prolongation is trilinear and
+ * restriction is its (scaled) transpose. Pre- and post-smoothing visit the
+ * colours in opposite order, so that the V-cycle is a symmetric operator, as
+ * required for a preconditioner of the conjugate gradient method.
+ */
+class MultigridPreconditioner {
+	public:
+		/** Params:
+		 * - grid is the MAC grid whose fluid cells define the system
+		 * - num_threads is the number of threads used by the smoother and
+		 *   transfer operators
+		 */
+		MultigridPreconditioner(const Mac3d& grid, int num_threads = 1);
+		~MultigridPreconditioner();
+
+		/**
+		 * Rebuild the cell types of all levels from Mac3d::pfluid_ and
+		 * Mac3d::psolid_. Must be called whenever the fluid cells changed.
+		 */
+		void update();
+
+		/**
+		 * Apply one V-cycle with zero initial guess: z <- M⁻¹ r.
+		 * Both vectors are defined on all cells of the grid,
+		 * non-fluid entries of z are set to zero.
+		 */
+		void apply(const double* r, double* z);
+
+		/** Number of levels, including the finest one */
+		unsigned get_num_levels() const { return levels.size(); }
+
+	private:
+		enum CELL_TYPE : unsigned char { CELL_AIR, CELL_FLUID, CELL_SOLID };
+
+		struct Level {
+			unsigned nx, ny, nz;
+			// cell types
+			unsigned char* type;
+			// inverse of the diagonal of the operator (zero for non-fluid cells)
+			double* diag_inv;
+			// diagonal of the operator
+			double* diag;
+			// solution, right-hand side and residual
+			// (on the finest level, x and b point to the vectors passed to apply)
+			double* x;
+			const double* b;
+			double* r;
+			// storage of the right-hand side on coarse levels
+			double* rhs;
+		};
+
+		const Mac3d& grid;
+		const int num_threads;
+		std::vector<Level> levels;
+
+		// number of red-black sweeps before and after the coarse grid correction
+		const unsigned num_smoothing_sweeps = 2;
+		// number of red-black sweeps on the coarsest level (in each direction)
+		const unsigned num_bottom_sweeps = 20;
+		// levels are added until one dimension is smaller than this
+		const unsigned min_coarsening_size = 8;
+
+		void vcycle(unsigned l);
+		void smooth(Level& level, unsigned colour) const;
+		void computeResidual(Level& level) const;
+		void restrictResidual(const Level& fine, Level& coarse) const;
+		void prolongateCorrection(const Level& coarse, Level& fine) const;
+};
+
+#endif //WATERSIM_MULTIGRIDPRECONDITIONER_H
@@ -111,6 +111,16 @@ class NcReader {
 	}
 
 
+	/** Same for a component of the particles, read through a buffer
+	 */
+	void read( const unsigned breakPt, const std::string& varName, const Particles::Component& destination ){
+
+		std::vector<double> buffer(num_particles);
+		read(breakPt, varName, buffer.data());
+		for(unsigned i = 0; i < num_particles; ++i) destination[i] = buffer[i];
+	}
+
+
 	/** Convert the linear arrays read from _filePath to the data structures of 
 	 *  the FLIP algorithm implementation (Particles and Mac3d)
 	 */
@@ -126,6 +136,24 @@ class NcReader {
 	void readAll( unsigned breakPt );
 
 
+	/** Maximum errors of a variable against the reference file
+	 * - maxRelErr is the maximum relative error of the values (see rErr)
+	 * - maxNormErr is the maximum absolute error relative to the largest
+	 *   reference magnitude, which stays meaningful for values close to zero
+	 */
+	struct VarError {
+		std::string varName;
+		double maxRelErr;
+		double maxNormErr;
+	};
+
+
+	/** Compute the errors of every variable of the model state against the
+	 *  reference arrays of the last readAll
+	 */
+	std::vector<VarError> computeErrors();
+
+
 	/** Check if the model state validates
 	 */
 	void validate();
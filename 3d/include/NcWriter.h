@@ -115,6 +115,18 @@ class NcWriter {
 	}
 	
 
+	/** Same for a component of the num_particles particles, written through a
+	 *  buffer
+	 */
+	void write( const unsigned breakPt, const std::string& varName, const Particles::Component& data,
+	            const unsigned num_particles ){
+
+		std::vector<double> buffer(num_particles);
+		for(unsigned i = 0; i < num_particles; ++i) buffer[i] = data[i];
+		write(breakPt, varName, buffer.data());
+	}
+
+
 	/** Write all the relevant arrays of the FLIP::step_FLIP() function to the 
 	 *  reference file for a specific break point
 	 * - breakPt is the number of the desired break point (see FLIP::step_FLIP 
@@ -7,24 +7,85 @@
 
 #include "Mac3d.h"
 #include "SimConfig.h"
+#include "parallel.h"
+
+#include <cstddef>
+#include <vector>
 
 struct Particles {
 	/**
-	 * Index type for particles.
+	 * Index type for particles, 64-bit with WATERSIM_64BIT_INDICES (see
+	 * indices.h).
+	 */
+	using particleIdx_t = index_t;
+
+	/**
+	 * The number of particles stored is padded to a multiple of block_size.
+	 * The padding particles are at the origin with zero velocity, and stay
+	 * there.
+	 */
+	static constexpr particleIdx_t block_size = 8;
+	static constexpr unsigned num_components = 6;
+
+	/**
+	 * Position of particle n in the storage of its component. With
+	 * WATERSIM_PARTICLES_AOSOA, the particles are stored in blocks of
+	 * block_size, x[8], y[8], z[8], u[8], v[8], w[8], which start on cache
+	 * lines, and positions go up to num_components times the number of
+	 * particles. Otherwise every component is an array of its own.
+	 */
+	static inline std::size_t storage_index(const particleIdx_t n) {
+#ifdef WATERSIM_PARTICLES_AOSOA
+		return n + std::size_t(n / block_size) * ((num_components - 1) * block_size);
+#else
+		return n;
+#endif
+	}
+
+	/**
+	 * One component (x, y, z, u, v or w) of the particles.
 	 */
-	using particleIdx_t = unsigned int;
+	class Component {
+	public:
+		inline real_t& operator[](const particleIdx_t n) const { return base_[storage_index(n)]; }
+
+		/**
+		 * Pointer to the component of particle n. The particles n, n+1, ...
+		 * up to the end of the block of n are contiguous, and batches of
+		 * simd::vec::width particles starting at a multiple of it are aligned
+		 * to a register (see precision.h).
+		 */
+		inline real_t* batch(const particleIdx_t n) const { return base_ + storage_index(n); }
+
+	private:
+		friend struct Particles;
+		real_t* base_ = nullptr;
+	};
 
 	// Positions
-	double *x = nullptr;
-	double *y = nullptr;
-	double *z = nullptr;
+	Component x;
+	Component y;
+	Component z;
 
 	// Velocities
-	double *u = nullptr;
-	double *v = nullptr;
-	double *w = nullptr;
+	Component u;
+	Component v;
+	Component w;
+
+	/**
+	 * Order of the particles after sort_by_cell.
+	 */
+	enum SORT_ORDER {
+		SORT_CELL,   //!< by cell index, i.e. lexicographic with x fastest
+		SORT_MORTON  //!< by cell along the Morton (Z-order) curve
+	};
 
-	Particles(Particles::particleIdx_t nParticles, const Mac3d &macGrid);
+	/**
+	 * The particle arrays are zeroed by numThreads threads, each in its range
+	 * of get_thread_range, such that their pages are first touched (and, on
+	 * NUMA machines, placed) by the threads which later process them.
+	 */
+	Particles(Particles::particleIdx_t nParticles, const Mac3d &macGrid, int numThreads = 1);
 
 	~Particles();
 
@@ -43,6 +104,27 @@ struct Particles {
 	 */
 	inline particleIdx_t get_num_particles() const { return num_particles_; }
 
+	/**
+	 * Returns the number of particles including the padding.
+	 */
+	inline particleIdx_t get_num_padded() const { return num_padded_; }
+
+	/**
+	 * Get the contiguous range [begin, end) of particles processed by thread
+	 * threadIdx out of numThreads. The ranges are whole blocks of the padded
+	 * particles, which start on cache lines.
+	 */
+	inline void get_thread_range(int threadIdx, int numThreads, particleIdx_t &begin, particleIdx_t &end) const {
+		parallel::chunk_range(num_padded_, threadIdx, numThreads, begin, end, block_size);
+	}
+
+	/**
+	 * Reorder the particles (all six arrays) such that particles in the same
+	 * and in neighbouring cells are close in memory. Counting sort, stable,
+	 * i.e. the particles of a cell keep their relative order.
+	 */
+	void sort_by_cell(SORT_ORDER order);
+
 private:
 
 	//! 1 / cell_size_xyz
@@ -50,8 +132,43 @@ private:
 	double rcell_size_y_;
 	double rcell_size_z_;
 
-	//! Number of particles
+	//! Number of particles, and number including the padding
 	particleIdx_t num_particles_;
+	particleIdx_t num_padded_;
+
+	//! Number of threads which first touched the particle arrays
+	int num_threads_;
+
+	/**
+	 * Allocate an array of the given number of components of the padded
+	 * particles, aligned to cache lines, and zero it in the ranges of the
+	 * threads (see the constructor).
+	 */
+	real_t* allocate_array(unsigned components = 1) const;
+
+	//! Storage of all components in blocks (WATERSIM_PARTICLES_AOSOA)
+	real_t *storage_ = nullptr;
+
+	/**
+	 * Compute the position of every cell in the given order.
+	 */
+	void compute_cell_rank(SORT_ORDER order);
+
+	//! Number of cells of the grid along x, y, z
+	Mac3d::cellIdx_t num_cells_x_;
+	Mac3d::cellIdx_t num_cells_y_;
+	Mac3d::cellIdx_t num_cells_z_;
+
+	//! Position of every cell in the sorted order, computed by the first sort
+	std::vector<index_t> cell_rank_;
+	SORT_ORDER cell_rank_order_;
+
+	//! Scratch space of the sort: sorted position and rank of every particle,
+	//! number of particles per rank, and an array to permute into
+	std::vector<particleIdx_t> sorted_idx_;
+	std::vector<index_t> particle_rank_;
+	std::vector<particleIdx_t> rank_count_;
+	real_t *scratch_ = nullptr;
 };
 
 
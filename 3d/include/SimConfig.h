@@ -148,6 +148,127 @@ class SimConfig {
 		   */
 		  void setRandomSeed(int seed);
 		  int getRandomSeed();
+
+		  /**
+		   * Number of threads used by the parallelized parts of the simulation.
+		   * If < 1, all threads available to OpenMP are used.
+		   */
+		  void setNumThreads(int numThreads);
+		  int getNumThreads() const;
+
+		  /**
+		   * Ordering of the sweeps of the pressure solver's preconditioner.
+		   * "lexicographic": sequential k-j-i order
+		   * "wavefront": hyperplanes of x-rows processed in parallel
+		   */
+		  void setPreconditionerSweep(const std::string& sweep);
+		  std::string getPreconditionerSweep() const;
+
+		  /**
+		   * Preconditioner of the pressure solver.
+		   * "none": unpreconditioned CG
+		   * "jacobi": inverse of the diagonal
+		   * "ic0": incomplete Cholesky
+		   * "mic0": modified incomplete Cholesky, see setMICParameters
+		   * "chebyshev": Jacobi-preconditioned Chebyshev polynomial
+		   * "multigrid": geometric multigrid V-cycle
+		   */
+		  void setPreconditioner(const std::string& preconditioner);
+		  std::string getPreconditioner() const;
+
+		  /**
+		   * Initial guess of the pressure solve.
+		   * "zero": start from zero pressure
+		   * "previous": start from the pressure of the previous step
+		   * "extrapolate": linear extrapolation from the two previous steps
+		   */
+		  void setPressureInitialGuess(const std::string& guess);
+		  std::string getPressureInitialGuess() const;
+
+		  /**
+		   * Whether to print, for every pressure solve from an initial guess,
+		   * the number of iterations and an estimate of the iterations saved
+		   */
+		  void setLogPressureSolve(bool log);
+		  bool getLogPressureSolve() const;
+
+		  /**
+		   * Floating point precision of the pressure solver.
+		   * "double": double precision
+		   * "mixed": single precision iterations with double precision refinement
+		   */
+		  void setPressureSolverPrecision(const std::string& precision);
+		  std::string getPressureSolverPrecision() const;
+
+		  /**
+		   * Formulation of the conjugate gradient iteration of the pressure solver.
+		   * "standard": textbook preconditioned CG
+		   * "chronopoulos-gear": fused kernels, fewer passes over memory
+		   */
+		  void setPressureSolverVariant(const std::string& variant);
+		  std::string getPressureSolverVariant() const;
+
+		  /**
+		   * Fraction of the fill-in dropped by IC(0) which the "mic0"
+		   * preconditioner adds back to the diagonal, 0 gives IC(0)
+		   */
+		  void setMICTau(double tau);
+		  double getMICTau() const;
+
+		  /**
+		   * The "mic0" preconditioner falls back to the diagonal of A where the
+		   * modified pivot drops below this fraction of it
+		   */
+		  void setMICSafety(double safety);
+		  double getMICSafety() const;
+
+		  /**
+		   * Fluid components of at most this many cells which touch air are
+		   * solved directly instead of by the CG pressure solver, 0 disables this
+		   */
+		  void setPressureDirectSolveSize(int size);
+		  int getPressureDirectSolveSize() const;
+
+		  /**
+		   * Sort the particles by cell every this many steps, 0 disables sorting
+		   */
+		  void setParticleSortInterval(int interval);
+		  int getParticleSortInterval() const;
+
+		  /**
+		   * Order of the cells by which the particles are sorted.
+		   * "morton": along the Morton (Z-order) curve
+		   * "cell": by cell index
+		   */
+		  void setParticleSortOrder(const std::string& order);
+		  std::string getParticleSortOrder() const;
+
+		  /**
+		   * Kernel of the particle-to-grid transfer.
+		   * "sph": SPH kernel with a radius of two cells
+		   * "trilinear": 2x2x2 faces per particle and component
+		   * "quadratic": quadratic B-spline, 3x3x3 faces per particle and component
+		   */
+		  void setParticleToGridKernel(const std::string& kernel);
+		  std::string getParticleToGridKernel() const;
+
+		  /**
+		   * Method of the particle-to-grid transfer.
+		   * "scatter": every particle adds its contributions to the nearby faces
+		   * "gather": every face sums the contributions of the nearby particles,
+		   *           found in a list of the particles per cell
+		   */
+		  void setParticleToGridMethod(const std::string& method);
+		  std::string getParticleToGridMethod() const;
+
+		  /**
+		   * Number of layers of faces around the fluid into which the grid
+		   * velocities are extrapolated after the particle-to-grid transfer.
+		   * If < 1, the number of cells the fastest particle travelled in the
+		   * previous step (its CFL number, rounded up) is used
+		   */
+		  void setExtrapolationLayers(int layers);
+		  int getExtrapolationLayers() const;
 };
 
 #endif //WATERSIM_SIMCONFIG_H
@@ -21,7 +21,7 @@
 class WaterSim {
 
 	// Number of particles in simulation
-	unsigned int m_num_particles;
+	Particles::particleIdx_t m_num_particles;
 
 	double m_dt = 0.0;         // length of timestep
 	double m_time = 0.0;       // current time
@@ -79,7 +79,7 @@ public:
 	 */
 	bool advance();
 
-	unsigned int getNumParticles() const { return m_num_particles; }
+	Particles::particleIdx_t getNumParticles() const { return m_num_particles; }
 
 	void setTimestep(double t) { m_dt = t; }
 
@@ -0,0 +1,55 @@
+/**
+ * Integer type of the global cell, face and particle indices, selected at
+ * build time, and AVX helpers to compute and use 4 of them in registers.
+ */
+
+#ifndef WATERSIM_INDICES_H
+#define WATERSIM_INDICES_H
+
+#include <immintrin.h>
+#include <cstdint>
+
+/**
+ * Type of the indices into the arrays of cells, faces and particles:
+ * 64-bit if WATERSIM_64BIT_INDICES is defined, 32-bit otherwise. The 32-bit
+ * build supports up to 2^31 faces of each component and particles, the
+ * 64-bit one is for larger problems. Indices along one axis of the grid
+ * always stay int (Mac3d::cellIdx_t).
+ */
+#ifdef WATERSIM_64BIT_INDICES
+using index_t = std::uint64_t;
+using signed_index_t = std::int64_t;
+#else
+using index_t = unsigned;
+using signed_index_t = int;
+#endif
+
+namespace simd {
+
+	/**
+	 * 4 indices in a register, as taken by the gathers of precision.h:
+	 * 4 x 64 bits if WATERSIM_64BIT_INDICES is defined, 4 x 32 bits otherwise.
+	 */
+#ifdef WATERSIM_64BIT_INDICES
+	using index4_t = __m256i;
+
+	/** Convert 4 non-negative integral doubles below 2^52 to indices, by
+	 *  adding 2^52, which moves them to the low bits of the mantissa */
+	inline index4_t to_index(const __m256d a) {
+		const __m256d shift = _mm256_set1_pd(4503599627370496.);
+		return _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(a, shift)), _mm256_castpd_si256(shift));
+	}
+	inline index4_t add_index(const index4_t a, const signed_index_t b) { return _mm256_add_epi64(a, _mm256_set1_epi64x(b)); }
+	inline index4_t load_index(const index_t* p) { return _mm256_loadu_si256((const __m256i*) p); }
+#else
+	using index4_t = __m128i;
+
+	/** Convert 4 integral doubles to indices */
+	inline index4_t to_index(const __m256d a) { return _mm256_cvtpd_epi32(a); }
+	inline index4_t add_index(const index4_t a, const signed_index_t b) { return _mm_add_epi32(a, _mm_set1_epi32(b)); }
+	inline index4_t load_index(const index_t* p) { return _mm_loadu_si128((const __m128i*) p); }
+#endif
+
+}
+
+#endif //WATERSIM_INDICES_H
@@ -0,0 +1,41 @@
+/**
+ * Helpers for distributing work across OpenMP threads.
+ */
+
+#ifndef WATERSIM_PARALLEL_H
+#define WATERSIM_PARALLEL_H
+
+#include <omp.h>
+
+namespace parallel {
+
+	/**
+	 * Translate a configured thread count into an actual one.
+	 * Values smaller than 1 select all threads available to OpenMP.
+	 */
+	inline int resolve_num_threads(int requested) {
+		return requested > 0 ? requested : omp_get_max_threads();
+	}
+
+	/**
+	 * Compute the range [begin, end) of chunk chunk_idx when [0, n) is split into
+	 * num_chunks contiguous chunks of (almost) equal length.
+	 * Chunk boundaries are multiples of align, so that every chunk of an aligned
+	 * array starts on an aligned address.
+	 */
+	template<typename idx_t>
+	inline void chunk_range(const idx_t n, const int chunk_idx, const int num_chunks,
+	                        idx_t& begin, idx_t& end, const idx_t align = 1) {
+		const idx_t num_blocks = (n + align - 1) / align;
+		const idx_t blocks_per_chunk = num_blocks / num_chunks;
+		const idx_t remainder = num_blocks % num_chunks;
+		const idx_t c = chunk_idx;
+		begin = align * (c * blocks_per_chunk + (c < remainder ? c : remainder));
+		end   = begin + align * (blocks_per_chunk + (c < remainder ? 1 : 0));
+		if (begin > n) begin = n;
+		if (end > n) end = n;
+	}
+
+}
+
+#endif //WATERSIM_PARALLEL_H
@@ -0,0 +1,222 @@
+/**
+ * Floating point type of the particle and grid velocity arrays, selected at
+ * build time, and AVX helpers to move them between memory and registers and
+ * to compute on registers of them.
+ */
+
+#ifndef WATERSIM_PRECISION_H
+#define WATERSIM_PRECISION_H
+
+#include <immintrin.h>
+#include <algorithm>
+#include "indices.h"
+
+/**
+ * Type of the particle positions and velocities, and of the grid velocities
+ * and weights: float if WATERSIM_SINGLE_PRECISION is defined, double
+ * otherwise. The batch kernels of the particles (grid_to_particle,
+ * advance_particles and the batch interpolation of Mac3d) compute in this
+ * type, on registers of simd::vec::width values. All other kernels compute
+ * in double precision and only store in this type.
+ */
+#ifdef WATERSIM_SINGLE_PRECISION
+using real_t = float;
+#else
+using real_t = double;
+#endif
+
+namespace simd {
+
+	/**
+	 * Load, store and gather 4 values of a double or float array as 4
+	 * doubles. The masks have all bits of a 64-bit lane set to select it.
+	 */
+	inline __m256d load(const double* p) { return _mm256_loadu_pd(p); }
+	inline __m256d load(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+
+	inline void store(double* p, const __m256d a) { _mm256_storeu_pd(p, a); }
+	inline void store(float* p, const __m256d a) { _mm_storeu_ps(p, _mm256_cvtpd_ps(a)); }
+
+	/** Same for p aligned to 4 values */
+	inline __m256d load_aligned(const double* p) { return _mm256_load_pd(p); }
+	inline __m256d load_aligned(const float* p) { return _mm256_cvtps_pd(_mm_load_ps(p)); }
+
+	inline void store_aligned(double* p, const __m256d a) { _mm256_store_pd(p, a); }
+	inline void store_aligned(float* p, const __m256d a) { _mm_store_ps(p, _mm256_cvtpd_ps(a)); }
+
+	/** The 32-bit lane mask of the floats of a 64-bit lane mask */
+	inline __m128i narrow_mask(const __m256i mask) {
+		return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(mask, _mm256_set_epi32(7, 5, 3, 1, 6, 4, 2, 0)));
+	}
+
+	inline __m256d maskload(const double* p, const __m256i mask) { return _mm256_maskload_pd(p, mask); }
+	inline __m256d maskload(const float* p, const __m256i mask) {
+		return _mm256_cvtps_pd(_mm_maskload_ps(p, narrow_mask(mask)));
+	}
+
+	inline void maskstore(double* p, const __m256i mask, const __m256d a) { _mm256_maskstore_pd(p, mask, a); }
+	inline void maskstore(float* p, const __m256i mask, const __m256d a) {
+		_mm_maskstore_ps(p, narrow_mask(mask), _mm256_cvtpd_ps(a));
+	}
+
+	/** Gather g[idx] for the 4 indices idx (masked gathers of all lanes, the
+	 *  unmasked ones read an undefined source) */
+	inline __m256d gather(const double* g, const __m128i idx) {
+		return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), g, idx, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+	}
+	inline __m256d gather(const float* g, const __m128i idx) {
+		return _mm256_cvtps_pd(_mm_mask_i32gather_ps(_mm_setzero_ps(), g, idx, _mm_castsi128_ps(_mm_set1_epi32(-1)), 4));
+	}
+
+	/** Same for 4 64-bit indices (see indices.h) */
+	inline __m256d gather(const double* g, const __m256i idx) {
+		return _mm256_mask_i64gather_pd(_mm256_setzero_pd(), g, idx, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+	}
+	inline __m256d gather(const float* g, const __m256i idx) {
+		return _mm256_cvtps_pd(_mm256_mask_i64gather_ps(_mm_setzero_ps(), g, idx, _mm_castsi128_ps(_mm_set1_epi32(-1)), 4));
+	}
+
+	/** Indices (cell_x+1) + stride_y*((cell_y+1) + ny2*(cell_z+1)) of 4
+	 *  integral cells >= -1 (exact in double precision) */
+	inline index4_t face_index(const __m256d cell_x, const __m256d cell_y, const __m256d cell_z,
+	                           const int stride_y, const int ny2) {
+		const __m256d one = _mm256_set1_pd(1.);
+		return to_index(_mm256_add_pd(_mm256_add_pd(cell_x, one),
+		                              _mm256_mul_pd(_mm256_set1_pd(stride_y),
+		                                            _mm256_add_pd(_mm256_add_pd(cell_y, one),
+		                                                          _mm256_mul_pd(_mm256_set1_pd(ny2), _mm256_add_pd(cell_z, one))))));
+	}
+
+	/**
+	 * Registers of width values of real_t: 8 floats with
+	 * WATERSIM_SINGLE_PRECISION, 4 doubles otherwise, and the operations of
+	 * the batch kernels on them. index_t holds the width indices of a gather.
+	 */
+	namespace vec {
+
+#ifdef WATERSIM_SINGLE_PRECISION
+		using type = __m256;
+		constexpr unsigned width = 8;
+
+		inline type set1(const double a) { return _mm256_set1_ps((float) a); }
+		inline type zero() { return _mm256_setzero_ps(); }
+		inline type load_aligned(const float* p) { return _mm256_load_ps(p); }
+		inline void store_aligned(float* p, const type a) { _mm256_store_ps(p, a); }
+
+		inline type add(const type a, const type b) { return _mm256_add_ps(a, b); }
+		inline type sub(const type a, const type b) { return _mm256_sub_ps(a, b); }
+		inline type mul(const type a, const type b) { return _mm256_mul_ps(a, b); }
+		inline type fmadd(const type a, const type b, const type c) { return _mm256_fmadd_ps(a, b, c); }
+		inline type min(const type a, const type b) { return _mm256_min_ps(a, b); }
+		inline type max(const type a, const type b) { return _mm256_max_ps(a, b); }
+		inline type floor(const type a) { return _mm256_floor_ps(a); }
+		inline type abs(const type a) { return _mm256_and_ps(_mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)), a); }
+
+		template<int predicate>
+		inline type cmp(const type a, const type b) { return _mm256_cmp_ps(a, b, predicate); }
+		inline type bit_and(const type a, const type b) { return _mm256_and_ps(a, b); }
+		inline type bit_or(const type a, const type b) { return _mm256_or_ps(a, b); }
+		inline type blend(const type a, const type b, const type mask) { return _mm256_blendv_ps(a, b, mask); }
+		inline int movemask(const type mask) { return _mm256_movemask_ps(mask); }
+
+		/** Mask of the lanes below count */
+		inline type first_lanes(const long long count) {
+			return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32((int) std::min(count, (long long) width)),
+			                                              _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)));
+		}
+
+		/** Largest lane */
+		inline double max_lane(const type a) {
+			alignas(32) float lanes[width];
+			_mm256_store_ps(lanes, a);
+			return *std::max_element(lanes, lanes + width);
+		}
+
+#ifdef WATERSIM_64BIT_INDICES
+		/** The indices of the lower and upper 4 lanes */
+		struct index_t { index4_t lo, hi; };
+
+		/** See simd::face_index, computed on the lower and upper 4 lanes in
+		 *  double precision */
+		inline index_t face_index(const type cell_x, const type cell_y, const type cell_z,
+		                          const int stride_y, const int ny2) {
+			auto lo = [](const type a) { return _mm256_cvtps_pd(_mm256_castps256_ps128(a)); };
+			auto hi = [](const type a) { return _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)); };
+			return {simd::face_index(lo(cell_x), lo(cell_y), lo(cell_z), stride_y, ny2),
+			        simd::face_index(hi(cell_x), hi(cell_y), hi(cell_z), stride_y, ny2)};
+		}
+		inline index_t add_index(const index_t a, const signed_index_t b) {
+			return {simd::add_index(a.lo, b), simd::add_index(a.hi, b)};
+		}
+		inline type gather(const float* g, const index_t idx) {
+			const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			return _mm256_set_m128(_mm256_mask_i64gather_ps(_mm_setzero_ps(), g, idx.hi, all, 4),
+			                       _mm256_mask_i64gather_ps(_mm_setzero_ps(), g, idx.lo, all, 4));
+		}
+#else
+		using index_t = __m256i;
+
+		/** See simd::face_index, in 32-bit integers */
+		inline index_t face_index(const type cell_x, const type cell_y, const type cell_z,
+		                          const int stride_y, const int ny2) {
+			const __m256i one = _mm256_set1_epi32(1);
+			const __m256i i = _mm256_add_epi32(_mm256_cvtps_epi32(cell_x), one);
+			const __m256i j = _mm256_add_epi32(_mm256_cvtps_epi32(cell_y), one);
+			const __m256i k = _mm256_add_epi32(_mm256_cvtps_epi32(cell_z), one);
+			return _mm256_add_epi32(i, _mm256_mullo_epi32(_mm256_set1_epi32(stride_y),
+			                                              _mm256_add_epi32(j, _mm256_mullo_epi32(_mm256_set1_epi32(ny2), k))));
+		}
+		inline index_t add_index(const index_t a, const signed_index_t b) { return _mm256_add_epi32(a, _mm256_set1_epi32(b)); }
+		inline type gather(const float* g, const index_t idx) {
+			return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), g, idx, _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4);
+		}
+#endif
+
+#else
+		using type = __m256d;
+		constexpr unsigned width = 4;
+
+		inline type set1(const double a) { return _mm256_set1_pd(a); }
+		inline type zero() { return _mm256_setzero_pd(); }
+		inline type load_aligned(const double* p) { return _mm256_load_pd(p); }
+		inline void store_aligned(double* p, const type a) { _mm256_store_pd(p, a); }
+
+		inline type add(const type a, const type b) { return _mm256_add_pd(a, b); }
+		inline type sub(const type a, const type b) { return _mm256_sub_pd(a, b); }
+		inline type mul(const type a, const type b) { return _mm256_mul_pd(a, b); }
+		inline type fmadd(const type a, const type b, const type c) { return _mm256_fmadd_pd(a, b, c); }
+		inline type min(const type a, const type b) { return _mm256_min_pd(a, b); }
+		inline type max(const type a, const type b) { return _mm256_max_pd(a, b); }
+		inline type floor(const type a) { return _mm256_floor_pd(a); }
+		inline type abs(const type a) { return _mm256_and_pd(_mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffff)), a); }
+
+		template<int predicate>
+		inline type cmp(const type a, const type b) { return _mm256_cmp_pd(a, b, predicate); }
+		inline type bit_and(const type a, const type b) { return _mm256_and_pd(a, b); }
+		inline type bit_or(const type a, const type b) { return _mm256_or_pd(a, b); }
+		inline type blend(const type a, const type b, const type mask) { return _mm256_blendv_pd(a, b, mask); }
+		inline int movemask(const type mask) { return _mm256_movemask_pd(mask); }
+
+		/** Mask of the lanes below count */
+		inline type first_lanes(const long long count) {
+			return _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(count), _mm256_set_epi64x(3, 2, 1, 0)));
+		}
+
+		/** Largest lane */
+		inline double max_lane(const type a) {
+			alignas(32) double lanes[width];
+			_mm256_store_pd(lanes, a);
+			return *std::max_element(lanes, lanes + width);
+		}
+
+		using index_t = index4_t;
+		using simd::face_index;
+		using simd::add_index;
+		using simd::gather;
+#endif
+
+	}
+
+}
+
+#endif //WATERSIM_PRECISION_H
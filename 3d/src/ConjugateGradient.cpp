@@ -1,6 +1,9 @@
 #include "ConjugateGradient.hpp"
+#include "parallel.h"
+#include "precision.h"
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 
 #define square(X)	((X) * (X))
@@ -12,17 +15,17 @@ const unsigned d_size_inv = 1/sizeof(double);
 
 // returns x.T * y
 /*
-double dot(const double *x, const double *y, const unsigned int n) {
+double dot(const double *x, const double *y, const index_t n) {
 	double tmp = 0;
-	for(unsigned i = 0 ; i < n; ++i ) {
+	for(index_t i = 0 ; i < n; ++i ) {
 		tmp += x[i]*y[i];
 	}
 	return tmp;
 }
  */
-double dot(const double *x, const double *y, const unsigned int n) {
+double dot(const double *x, const double *y, const index_t n) {
     double tmp = 0;
-    unsigned i = 0;
+    index_t i = 0;
     // we want 8 FMAs because of Skylake ports lat 4, 2 per cycle
     // so we do 8 doubles per step
     __m256d sol1, sol2, sol3, sol4;
@@ -48,7 +51,7 @@ double dot(const double *x, const double *y, const unsigned int n) {
         }
     }
     //! b should be unalligned loads?
-    for(; i < n-32; i +=32 ) {
+    for(; i + 32 < n; i += 32 ) {
         vec_x1 = _mm256_load_pd(x+i);
         vec_x2 = _mm256_load_pd(x+i+4);
         vec_x3 = _mm256_load_pd(x+i+8);
@@ -99,14 +102,14 @@ double dot(const double *x, const double *y, const unsigned int n) {
 
 // y <- a * x
 /*
-void axy(const unsigned int n, const double a, const double *x, double *y) {
-	for(unsigned i = 0 ; i < n; ++i ) {
+void axy(const index_t n, const double a, const double *x, double *y) {
+	for(index_t i = 0 ; i < n; ++i ) {
 		y [i] = x[i] * a;
 	}
 }
  */
-void axy(const unsigned int n, const double a, const double *x, double *y) {
-    unsigned i = 0;
+void axy(const index_t n, const double a, const double *x, double *y) {
+    index_t i = 0;
     // we want Mul has lat 4 and 2 ports on skylake
     // https://www.agner.org/optimize/instruction_tables.pdf p 275.
     // so we do 8 doubles per step
@@ -136,7 +139,7 @@ void axy(const unsigned int n, const double a, const double *x, double *y) {
             y [i] = x[i] * a;
         }
     }
-    for(; i < n-32; i +=32 ) {
+    for(; i + 32 < n; i += 32 ) {
         vec_x1      = _mm256_load_pd(x+i);
         vec_x2      = _mm256_load_pd(x+i+4);
         vec_x3      = _mm256_load_pd(x+i+8);
@@ -170,15 +173,15 @@ void axy(const unsigned int n, const double a, const double *x, double *y) {
 
 // y <- a * x + y
 /*
-void axpy(const unsigned int n, const double a, const double *x, double *y) {
-	for(unsigned i = 0 ; i < n; ++i ) {
+void axpy(const index_t n, const double a, const double *x, double *y) {
+	for(index_t i = 0 ; i < n; ++i ) {
 		y [i] += x[i] * a;
 	}
 }
 */
 
-void axpy(const unsigned int n, const double a, const double *x, double *y) {
-    unsigned i = 0;
+void axpy(const index_t n, const double a, const double *x, double *y) {
+    index_t i = 0;
     // we want 8 FMAs because of Skylake ports
     // so we do 8 doubles per step
     __m256d vec_x1, vec_x2;
@@ -210,7 +213,7 @@ void axpy(const unsigned int n, const double a, const double *x, double *y) {
             y [i] += x[i] * a;
         }
     }
-    for(; i < n-32; i +=32 ) {
+    for(; i + 32 < n; i += 32 ) {
         vec_x1      = _mm256_load_pd(x+i);
         vec_x2      = _mm256_load_pd(x+i+4);
         vec_x3      = _mm256_load_pd(x+i+8);
@@ -254,14 +257,14 @@ void axpy(const unsigned int n, const double a, const double *x, double *y) {
 }
 //z <- a * x + y
 /*
-void axpyz(const unsigned int n, const double a, const double *x, const double *y, double *z) {
-    for(unsigned i = 0 ; i < n; ++i ) {
+void axpyz(const index_t n, const double a, const double *x, const double *y, double *z) {
+    for(index_t i = 0 ; i < n; ++i ) {
         z[i] = x[i] * a + y[i];
     }
 }
  */
-void axpyz(const unsigned int n, const double a, const double *x, const double *y, double *z) {
-    unsigned i = 0;
+void axpyz(const index_t n, const double a, const double *x, const double *y, double *z) {
+    index_t i = 0;
     // we want 8 FMAs because of Skylake ports
 
     __m256d vec_x1, vec_x2;
@@ -293,7 +296,7 @@ void axpyz(const unsigned int n, const double a, const double *x, const double *
             z[i] = x[i] * a + y[i];
         }
     }
-    for(; i < n-32; i +=32 ) {
+    for(; i + 32 < n; i += 32 ) {
         vec_x1 = _mm256_load_pd(x + i);
         vec_x2 = _mm256_load_pd(x + i + 4);
         vec_x3 = _mm256_load_pd(x + i + 8);
@@ -339,9 +342,9 @@ void axpyz(const unsigned int n, const double a, const double *x, const double *
 
 // y <- a * x + y; returns max |y[i]|
 /*
-double axpymax(const unsigned int n, const double a, const double *x, double *y) {
+double axpymax(const index_t n, const double a, const double *x, double *y) {
 	double max_abs_val = 0;
-	for(unsigned i = 0 ; i < n; ++i ) {
+	for(index_t i = 0 ; i < n; ++i ) {
 		y [i] += x[i] * a;
 		const double abs_val = std::abs(y[i]);
 		if (max_abs_val < abs_val) max_abs_val = abs_val;
@@ -349,9 +352,9 @@ double axpymax(const unsigned int n, const double a, const double *x, double *y)
 	return max_abs_val;
 }
 */
-double axpymax(const unsigned int n, const double a, const double *x, double *y) {
+double axpymax(const index_t n, const double a, const double *x, double *y) {
     double max_abs_val = 0;
-    unsigned i = 0;
+    index_t i = 0;
     // we want 8 FMAs because of Skylake ports
     // so we do 8 doubles per step
     __m256d vec_x1, vec_x2;
@@ -393,7 +396,7 @@ double axpymax(const unsigned int n, const double a, const double *x, double *y)
             if (max_abs_val < square_val) max_abs_val = square_val;
         }
     }
-    for(; i < n-32; i +=32 ) {
+    for(; i + 32 < n; i += 32 ) {
         vec_x1      = _mm256_load_pd(x+i);
         vec_x2      = _mm256_load_pd(x+i+4);
         vec_x3      = _mm256_load_pd(x+i+8);
@@ -487,9 +490,9 @@ double axpymax(const unsigned int n, const double a, const double *x, double *y)
 
 // z <- a * x + y; returns max |z[i]|
 /*
-double axpyzmax(const unsigned int n, const double a, const double *x, const double *y, double *z) {
+double axpyzmax(const index_t n, const double a, const double *x, const double *y, double *z) {
    double max_abs_val = 0;
-   for(unsigned i = 0 ; i < n; ++i ) {
+   for(index_t i = 0 ; i < n; ++i ) {
        z[i] = x[i] * a + y[i];
        const double abs_val = std::abs(z[i]);
        if (max_abs_val < abs_val) max_abs_val = abs_val;
@@ -497,9 +500,9 @@ double axpyzmax(const unsigned int n, const double a, const double *x, const dou
    return max_abs_val;
 }
 */
-double axpyzmax(const unsigned int n, const double a, const double *x, const double *y, double *z) {
+double axpyzmax(const index_t n, const double a, const double *x, const double *y, double *z) {
     double max_abs_val = 0;
-    unsigned i = 0;
+    index_t i = 0;
     // we want 8 FMAs because of Skylake ports
     // so we do 8 doubles per step
     __m256d vec_x1, vec_x2;
@@ -541,7 +544,7 @@ double axpyzmax(const unsigned int n, const double a, const double *x, const dou
             if (max_abs_val < square_val) max_abs_val = square_val;
         }
     }
-    for (; i < n - 32; i += 32) {
+    for (; i + 32 < n; i += 32) {
         vec_x1 = _mm256_load_pd(x + i);
         vec_x2 = _mm256_load_pd(x + i + 4);
         vec_x3 = _mm256_load_pd(x + i + 8);
@@ -636,7 +639,7 @@ double axpyzmax(const unsigned int n, const double a, const double *x, const dou
 
 // returns max |x[i]| for i in 0:n-1
 /*
-double xmax(const int n, const double* x) {
+double xmax(const index_t n, const double* x) {
    double max_abs_val = 0;
    for (int i = 0; i < n; i++) {
        const double abs_val = std::abs(x[i]);
@@ -645,9 +648,9 @@ double xmax(const int n, const double* x) {
    return max_abs_val;
 }
  */
-double xmax(const int n, const double* x) {
+double xmax(const index_t n, const double* x) {
     double max_abs_val = 0;
-    unsigned i = 0;
+    index_t i = 0;
     // we want 8 Mults because of Skylake ports
     __m256d vec_x1, vec_x2;
     __m256d vec_x3, vec_x4;
@@ -671,7 +674,7 @@ double xmax(const int n, const double* x) {
             if (max_abs_val < square_val) max_abs_val = square_val;
         }
     }
-    for (; i < n - 32; i += 32) {
+    for (; i + 32 < n; i += 32) {
         vec_x1 = _mm256_load_pd(x + i);
         vec_x2 = _mm256_load_pd(x + i + 4);
         vec_x3 = _mm256_load_pd(x + i + 8);
@@ -724,131 +727,853 @@ double xmax(const int n, const double* x) {
     return std::sqrt(std::max(std::max(sol0[0], sol0[2]), max_abs_val));
 }
 
-ICConjugateGradientSolver::ICConjugateGradientSolver(unsigned max_steps, const Mac3d& grid)
+// ********* Single precision kernels **********
+// used by the inner iterations of the mixed precision solver; 8 floats per
+// register instead of 4 doubles, dot products are accumulated in double
+
+// returns x.T * y
+double dot(const float *x, const float *y, const index_t n) {
+    double tmp = 0;
+    index_t i = 0;
+    __m256 vec_x1, vec_x2, vec_y1, vec_y2;
+    __m256d vec_por1 = _mm256_setzero_pd();
+    __m256d vec_por2 = _mm256_setzero_pd();
+    __m256d vec_por3 = _mm256_setzero_pd();
+    __m256d vec_por4 = _mm256_setzero_pd();
+
+    // peel loop for alligned loads
+    auto peel = (unsigned long) x & 0x1f;
+    if (peel != 0){
+        peel = (32 - peel) / sizeof(float);
+        for(; i < peel && i < n; ++i){
+            tmp += (double) x[i] * y[i];
+        }
+    }
+    for(; i + 16 < n; i += 16 ) {
+        vec_x1 = _mm256_load_ps(x+i);
+        vec_x2 = _mm256_load_ps(x+i+8);
+        vec_y1 = _mm256_load_ps(y+i);
+        vec_y2 = _mm256_load_ps(y+i+8);
+
+        // products are exact in double
+        vec_por1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(vec_x1)),
+                                   _mm256_cvtps_pd(_mm256_castps256_ps128(vec_y1)), vec_por1);
+        vec_por2 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(vec_x1, 1)),
+                                   _mm256_cvtps_pd(_mm256_extractf128_ps(vec_y1, 1)), vec_por2);
+        vec_por3 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(vec_x2)),
+                                   _mm256_cvtps_pd(_mm256_castps256_ps128(vec_y2)), vec_por3);
+        vec_por4 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(vec_x2, 1)),
+                                   _mm256_cvtps_pd(_mm256_extractf128_ps(vec_y2, 1)), vec_por4);
+    }
+    vec_por1 = _mm256_add_pd(vec_por1, vec_por2);
+    vec_por3 = _mm256_add_pd(vec_por3, vec_por4);
+    vec_por1 = _mm256_add_pd(vec_por1, vec_por3);
+    double sol0[4];
+    _mm256_storeu_pd(sol0, vec_por1);
+
+    tmp += (sol0[0] + sol0[1]) + (sol0[2] + sol0[3]);
+    for(; i < n; ++i ) {
+        tmp += (double) x[i] * y[i];
+    }
+    return tmp;
+}
+
+// y <- a * x
+void axy(const index_t n, const float a, const float *x, float *y) {
+    index_t i = 0;
+    const __m256 vec_a = _mm256_set1_ps(a);
+
+    auto peel = (unsigned long) x & 0x1f;
+    if (peel != 0){
+        peel = (32 - peel) / sizeof(float);
+        for(; i < peel && i < n; ++i){
+            y[i] = x[i] * a;
+        }
+    }
+    for(; i + 32 < n; i += 32 ) {
+        _mm256_storeu_ps(y+i,    _mm256_mul_ps(_mm256_load_ps(x+i),    vec_a));
+        _mm256_storeu_ps(y+i+8,  _mm256_mul_ps(_mm256_load_ps(x+i+8),  vec_a));
+        _mm256_storeu_ps(y+i+16, _mm256_mul_ps(_mm256_load_ps(x+i+16), vec_a));
+        _mm256_storeu_ps(y+i+24, _mm256_mul_ps(_mm256_load_ps(x+i+24), vec_a));
+    }
+    for(; i < n; ++i ) {
+        y[i] = x[i] * a;
+    }
+}
+
+//z <- a * x + y
+void axpyz(const index_t n, const float a, const float *x, const float *y, float *z) {
+    index_t i = 0;
+    const __m256 vec_a = _mm256_set1_ps(a);
+
+    auto peel = (unsigned long) x & 0x1f;
+    if (peel != 0){
+        peel = (32 - peel) / sizeof(float);
+        for(; i < peel && i < n; ++i){
+            z[i] = x[i] * a + y[i];
+        }
+    }
+    for(; i + 32 < n; i += 32 ) {
+        _mm256_storeu_ps(z+i,    _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i),    _mm256_load_ps(y+i)));
+        _mm256_storeu_ps(z+i+8,  _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i+8),  _mm256_load_ps(y+i+8)));
+        _mm256_storeu_ps(z+i+16, _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i+16), _mm256_load_ps(y+i+16)));
+        _mm256_storeu_ps(z+i+24, _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i+24), _mm256_load_ps(y+i+24)));
+    }
+    for(; i < n; ++i ) {
+        z[i] = x[i] * a + y[i];
+    }
+}
+
+// y <- a * x + y
+void axpy(const index_t n, const float a, const float *x, float *y) {
+    axpyz(n, a, x, y, y);
+}
+
+// z <- a * x + y; returns max |z[i]|
+float axpyzmax(const index_t n, const float a, const float *x, const float *y, float *z) {
+    float max_abs_val = 0;
+    index_t i = 0;
+    const __m256 vec_a = _mm256_set1_ps(a);
+    const __m256 sign_mask = _mm256_set1_ps(-0.f);
+    __m256 vec_res1, vec_res2, vec_res3, vec_res4;
+    __m256 vec_max1 = _mm256_setzero_ps();
+    __m256 vec_max2 = _mm256_setzero_ps();
+    __m256 vec_max3 = _mm256_setzero_ps();
+    __m256 vec_max4 = _mm256_setzero_ps();
+
+    auto peel = (unsigned long) x & 0x1f;
+    if (peel != 0){
+        peel = (32 - peel) / sizeof(float);
+        for(; i < peel && i < n; ++i){
+            z[i] = x[i] * a + y[i];
+            max_abs_val = std::max(max_abs_val, std::abs(z[i]));
+        }
+    }
+    for(; i + 32 < n; i += 32 ) {
+        vec_res1 = _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i),    _mm256_load_ps(y+i));
+        vec_res2 = _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i+8),  _mm256_load_ps(y+i+8));
+        vec_res3 = _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i+16), _mm256_load_ps(y+i+16));
+        vec_res4 = _mm256_fmadd_ps(vec_a, _mm256_load_ps(x+i+24), _mm256_load_ps(y+i+24));
+        _mm256_storeu_ps(z+i,    vec_res1);
+        _mm256_storeu_ps(z+i+8,  vec_res2);
+        _mm256_storeu_ps(z+i+16, vec_res3);
+        _mm256_storeu_ps(z+i+24, vec_res4);
+        vec_max1 = _mm256_max_ps(_mm256_andnot_ps(sign_mask, vec_res1), vec_max1);
+        vec_max2 = _mm256_max_ps(_mm256_andnot_ps(sign_mask, vec_res2), vec_max2);
+        vec_max3 = _mm256_max_ps(_mm256_andnot_ps(sign_mask, vec_res3), vec_max3);
+        vec_max4 = _mm256_max_ps(_mm256_andnot_ps(sign_mask, vec_res4), vec_max4);
+    }
+    for(; i < n; ++i ) {
+        z[i] = x[i] * a + y[i];
+        max_abs_val = std::max(max_abs_val, std::abs(z[i]));
+    }
+    vec_max1 = _mm256_max_ps(_mm256_max_ps(vec_max1, vec_max2), _mm256_max_ps(vec_max3, vec_max4));
+    float sol0[8];
+    _mm256_storeu_ps(sol0, vec_max1);
+    return std::max(max_abs_val, *std::max_element(sol0, sol0 + 8));
+}
+
+// y <- a * x + y; returns max |y[i]|
+float axpymax(const index_t n, const float a, const float *x, float *y) {
+    return axpyzmax(n, a, x, y, y);
+}
+
+// ********* Fused kernels of the Chronopoulos-Gear iteration **********
+
+// s <- z + b * s
+// t <- w + b * t
+// p <- p + a * s
+// r <- r - a * t; returns max |r[i]|
+// one pass over all six vectors instead of four separate updates
+double cg_update(const index_t n, const double a, const double b, const double *z, const double *w,
+                 double *s, double *t, double *p, double *r) {
+    double max_abs_val = 0;
+    for (index_t i = 0; i < n; ++i) {
+        const double s_i = z[i] + b * s[i];
+        const double t_i = w[i] + b * t[i];
+        s[i] = s_i;
+        t[i] = t_i;
+        p[i] += a * s_i;
+        r[i] -= a * t_i;
+        max_abs_val = std::max(max_abs_val, std::abs(r[i]));
+    }
+    return max_abs_val;
+}
+
+// first iteration: s <- z, t <- w, p <- a * s (p <- p + a * s with an initial
+// guess), r <- r0 - a * t; returns max |r[i]|
+double cg_update_first(const index_t n, const double a, const double *z, const double *w,
+                       const bool use_initial_guess, double *s, double *t, double *p,
+                       const double *r0, double *r) {
+    double max_abs_val = 0;
+    for (index_t i = 0; i < n; ++i) {
+        s[i] = z[i];
+        t[i] = w[i];
+        p[i] = use_initial_guess ? p[i] + a * z[i] : a * z[i];
+        r[i] = r0[i] - a * w[i];
+        max_abs_val = std::max(max_abs_val, std::abs(r[i]));
+    }
+    return max_abs_val;
+}
+
+ICConjugateGradientSolver::ICConjugateGradientSolver(unsigned max_steps, const Mac3d& grid, int num_threads)
    :
        grid{grid},
        n_cells_x{grid.get_num_cells_x()}, n_cells_y{grid.get_num_cells_y()}, n_cells_z{grid.get_num_cells_z()},
        tau{0.97},
-       num_cells{n_cells_x * n_cells_y * n_cells_z},
-       max_steps(max_steps)
+       mic_safety{0.25},
+       num_threads{parallel::resolve_num_threads(num_threads)},
+       sweep{SWEEP_LEXICOGRAPHIC},
+       preconditioner{PRECONDITIONER_IC0},
+       multigrid{nullptr},
+       precision{PRECISION_DOUBLE},
+       variant{VARIANT_STANDARD},
+       direct_solve_size{0},
+       multigrid_r{nullptr},
+       multigrid_z{nullptr},
+       chebyshev_d{nullptr},
+       chebyshev_y{nullptr},
+       chebyshev_d_f{nullptr},
+       chebyshev_y_f{nullptr},
+       compact_rhs{nullptr},
+       compact_p{nullptr},
+       num_cells{grid.get_num_cells()},
+       num_fluid{0},
+       num_direct{0},
+       row_begin(n_cells_y * n_cells_z + 1, 0),
+       has_scattered{false},
+       max_steps(max_steps),
+       rhs_norm{0},
+       initial_residual{0},
+       partials(this->num_threads),
+       pair_partials(this->num_threads)
 {
    step = 0;
    unsigned chunk_size = 32;
-   q = new (std::align_val_t(chunk_size)) double [num_cells];
-   r = new (std::align_val_t(chunk_size)) double [num_cells];
-   z = new (std::align_val_t(chunk_size)) double [num_cells];
-   s = new (std::align_val_t(chunk_size)) double [num_cells];
-   precon_diag = new (std::align_val_t(chunk_size)) double [num_cells];
-   A_diag = new (std::align_val_t(chunk_size)) double [num_cells];
-
-   // load A_diag
-   unsigned cellidx = 0;
-   for (unsigned k = 0; k < n_cells_z; k++) {
-       for (unsigned j = 0; j < n_cells_y; j++) {
-           for (unsigned i = 0; i < n_cells_x; i++, cellidx++) {
-               A_diag[cellidx] = grid.A_diag_val[i + j*stride_y + k*stride_z];
-           }
+   // one additional entry for the padding zero referenced by non-fluid neighbours
+   q = new (std::align_val_t(chunk_size)) double [num_cells + 1];
+   r = new (std::align_val_t(chunk_size)) double [num_cells + 1];
+   z = new (std::align_val_t(chunk_size)) double [num_cells + 1];
+   s = new (std::align_val_t(chunk_size)) double [num_cells + 1];
+   precon_diag = new (std::align_val_t(chunk_size)) double [num_cells + 1];
+   A_diag = new (std::align_val_t(chunk_size)) double [num_cells + 1];
+   w = t = nullptr;
+   q_f = r_f = z_f = s_f = precon_diag_f = A_diag_f = x_f = nullptr;
+
+   fluid_cells = new (std::align_val_t(chunk_size)) index_t [num_cells];
+   compact_index = new (std::align_val_t(chunk_size)) index_t [num_cells];
+   nb_code = new (std::align_val_t(chunk_size)) unsigned char [num_cells + 1];
+   nb_ym = new (std::align_val_t(chunk_size)) index_t [num_cells];
+   nb_yp = new (std::align_val_t(chunk_size)) index_t [num_cells];
+   nb_zm = new (std::align_val_t(chunk_size)) index_t [num_cells];
+   nb_zp = new (std::align_val_t(chunk_size)) index_t [num_cells];
+}
+
+void ICConjugateGradientSolver::set_precision(const PRECISION precision) {
+   this->precision = precision;
+   if (precision == PRECISION_MIXED && q_f == nullptr) {
+       const unsigned chunk_size = 32;
+       q_f = new (std::align_val_t(chunk_size)) float [num_cells + 1];
+       r_f = new (std::align_val_t(chunk_size)) float [num_cells + 1];
+       z_f = new (std::align_val_t(chunk_size)) float [num_cells + 1];
+       s_f = new (std::align_val_t(chunk_size)) float [num_cells + 1];
+       precon_diag_f = new (std::align_val_t(chunk_size)) float [num_cells + 1];
+       A_diag_f = new (std::align_val_t(chunk_size)) float [num_cells + 1];
+       x_f = new (std::align_val_t(chunk_size)) float [num_cells + 1];
+       // set up the single precision matrix if the fluid cells are already numbered
+       for (index_t c = 0; c < num_fluid; c++) A_diag_f[c] = A_diag[c];
+       q_f[num_fluid] = r_f[num_fluid] = z_f[num_fluid] = s_f[num_fluid] = 0;
+       precon_diag_f[num_fluid] = A_diag_f[num_fluid] = 0;
+   }
+   allocate_chebyshev_buffers();
+}
+
+void ICConjugateGradientSolver::set_variant(const VARIANT variant) {
+   this->variant = variant;
+   if (variant == VARIANT_CHRONOPOULOS_GEAR && w == nullptr) {
+       w = new (std::align_val_t(32)) double [num_cells + 1];
+       t = new (std::align_val_t(32)) double [num_cells + 1];
+   }
+}
+
+void ICConjugateGradientSolver::set_preconditioner(const PRECONDITIONER preconditioner) {
+   this->preconditioner = preconditioner;
+   if (preconditioner == PRECONDITIONER_MULTIGRID && multigrid == nullptr) {
+       multigrid = new MultigridPreconditioner(grid, num_threads);
+       multigrid_r = new (std::align_val_t(32)) double [num_cells];
+       multigrid_z = new (std::align_val_t(32)) double [num_cells];
+   }
+   allocate_chebyshev_buffers();
+}
+
+void ICConjugateGradientSolver::allocate_chebyshev_buffers() {
+   if (preconditioner != PRECONDITIONER_CHEBYSHEV) return;
+   if (chebyshev_d == nullptr) {
+       chebyshev_d = new (std::align_val_t(32)) double [num_cells + 1];
+       chebyshev_y = new (std::align_val_t(32)) double [num_cells + 1];
+   }
+   if (precision == PRECISION_MIXED && chebyshev_d_f == nullptr) {
+       chebyshev_d_f = new (std::align_val_t(32)) float [num_cells + 1];
+       chebyshev_y_f = new (std::align_val_t(32)) float [num_cells + 1];
+   }
+}
+
+// ********* Thread distribution **********
+
+// chunk boundaries are multiples of 32 doubles, so that the aligned loads
+// of the kernels stay aligned and each chunk covers whole cache lines
+const index_t chunk_align = 32;
+
+template<typename Kernel>
+void ICConjugateGradientSolver::for_each_chunk(const index_t n, Kernel kernel) const {
+   if (num_threads == 1) {
+       kernel(0u, n);
+       return;
+   }
+   #pragma omp parallel for schedule(static) num_threads(num_threads)
+   for (int c = 0; c < num_threads; c++) {
+       index_t begin, end;
+       parallel::chunk_range(n, c, num_threads, begin, end, chunk_align);
+       kernel(begin, end);
+   }
+}
+
+template<typename Kernel>
+double ICConjugateGradientSolver::sum_chunks(const index_t n, Kernel kernel) {
+   if (num_threads == 1) return kernel(0u, n);
+   #pragma omp parallel for schedule(static) num_threads(num_threads)
+   for (int c = 0; c < num_threads; c++) {
+       index_t begin, end;
+       parallel::chunk_range(n, c, num_threads, begin, end, chunk_align);
+       partials[c] = kernel(begin, end);
+   }
+   // fixed summation order: the result does not depend on thread scheduling
+   double sum = 0;
+   for (int c = 0; c < num_threads; c++) sum += partials[c];
+   return sum;
+}
+
+template<typename Kernel>
+double ICConjugateGradientSolver::max_chunks(const index_t n, Kernel kernel) {
+   if (num_threads == 1) return kernel(0u, n);
+   #pragma omp parallel for schedule(static) num_threads(num_threads)
+   for (int c = 0; c < num_threads; c++) {
+       index_t begin, end;
+       parallel::chunk_range(n, c, num_threads, begin, end, chunk_align);
+       partials[c] = kernel(begin, end);
+   }
+   return *std::max_element(partials.begin(), partials.end());
+}
+
+template<typename Kernel>
+std::pair<double, double> ICConjugateGradientSolver::sum_pair_chunks(const index_t n, Kernel kernel) {
+   if (num_threads == 1) return kernel(0u, n);
+   #pragma omp parallel for schedule(static) num_threads(num_threads)
+   for (int c = 0; c < num_threads; c++) {
+       index_t begin, end;
+       parallel::chunk_range(n, c, num_threads, begin, end, chunk_align);
+       pair_partials[c] = kernel(begin, end);
+   }
+   std::pair<double, double> sum(0, 0);
+   for (int c = 0; c < num_threads; c++) {
+       sum.first += pair_partials[c].first;
+       sum.second += pair_partials[c].second;
+   }
+   return sum;
+}
+
+template<typename Kernel>
+void ICConjugateGradientSolver::for_each_row(const bool reverse, Kernel kernel) const {
+   if (sweep == SWEEP_LEXICOGRAPHIC || num_threads == 1) {
+       const int num_rows = n_cells_y * n_cells_z;
+       if (not reverse) {
+           for (int row = 0; row < num_rows; row++) kernel(row);
+       } else {
+           for (int row = num_rows-1; row >= 0; row--) kernel(row);
+       }
+       return;
+   }
+
+   // row (j, k) depends on rows (j-1, k) and (j, k-1) only (or (j+1, k) and
+   // (j, k+1) when reversed), so all rows of a hyperplane j+k = l are independent
+   const int num_levels = n_cells_y + n_cells_z - 1;
+   #pragma omp parallel num_threads(num_threads)
+   for (int level = 0; level < num_levels; level++) {
+       const int l = reverse ? num_levels - 1 - level : level;
+       const int k_begin = std::max(0, l - (int) n_cells_y + 1);
+       const int k_end = std::min(l, (int) n_cells_z - 1);
+       // implicit barrier at the end of the loop separates the hyperplanes
+       #pragma omp for schedule(static)
+       for (int k = k_begin; k <= k_end; k++) {
+           kernel((l - k) + k*n_cells_y);
        }
    }
 }
 
-// apply the preconditioner (L L^T)^-1 by solving Lq = d and Lp = q
-void ICConjugateGradientSolver::applyPreconditioner(const double *r, double *z) const {
-   for (unsigned k = 0; k < n_cells_z; k++) {
-       for (unsigned j = 0; j < n_cells_y; j++) {
-           for (unsigned i = 0; i < n_cells_x; i++) {
-               const unsigned cellidx = i + j*stride_y + k*stride_z;
-               if (not grid.pfluid_[cellidx]) {
-                   q[cellidx] = 0;
-                   continue;
-               }
-               double t = r[cellidx];
-               if (i > 0 && grid.pfluid_[cellidx - stride_x]) t += precon_diag[cellidx - stride_x] * q[cellidx - stride_x];
-               if (j > 0 && grid.pfluid_[cellidx - stride_y]) t += precon_diag[cellidx - stride_y] * q[cellidx - stride_y];
-               if (k > 0 && grid.pfluid_[cellidx - stride_z]) t += precon_diag[cellidx - stride_z] * q[cellidx - stride_z];
-               q[cellidx] = t * precon_diag[cellidx];
-           }
+// ********* Compact numbering of the fluid cells **********
+
+void ICConjugateGradientSolver::update_fluid_cells() {
+   const int num_rows = n_cells_y * n_cells_z;
+
+   // number of fluid cells per x-row, stored shifted by one for the prefix sum
+   #pragma omp parallel for schedule(static) num_threads(num_threads) if(num_threads > 1)
+   for (int row = 0; row < num_rows; row++) {
+       const bool* fluid = grid.pfluid_ + row*stride_y;
+       index_t count = 0;
+       for (unsigned i = 0; i < n_cells_x; i++) count += fluid[i];
+       row_begin[row + 1] = count;
+   }
+   row_begin[0] = 0;
+   for (int row = 0; row < num_rows; row++) row_begin[row + 1] += row_begin[row];
+   num_fluid = row_begin[num_rows];
+
+   #pragma omp parallel for schedule(static) num_threads(num_threads) if(num_threads > 1)
+   for (int row = 0; row < num_rows; row++) {
+       index_t c = row_begin[row];
+       for (index_t cellidx = row*stride_y; cellidx < (row + 1)*stride_y; cellidx++) {
+           if (not grid.pfluid_[cellidx]) continue;
+           fluid_cells[c] = cellidx;
+           compact_index[cellidx] = c;
+           c++;
        }
    }
-   for (int k = n_cells_z-1; k >= 0; k--) {
-       for (int j = n_cells_y-1; j >= 0; j--) {
-           for (int i = n_cells_x-1; i >= 0; i--) {
-               const unsigned cellidx = i + j*stride_y + k*stride_z;
-               if (not grid.pfluid_[cellidx]) {
-                   z[cellidx] = 0;
-                   continue;
-               }
-               double t = q[cellidx];
-               if (i + 1 < (int) n_cells_x && grid.pfluid_[cellidx + stride_x]) t += precon_diag[cellidx] * z[cellidx + stride_x];
-               if (j + 1 < (int) n_cells_y && grid.pfluid_[cellidx + stride_y]) t += precon_diag[cellidx] * z[cellidx + stride_y];
-               if (k + 1 < (int) n_cells_z && grid.pfluid_[cellidx + stride_z]) t += precon_diag[cellidx] * z[cellidx + stride_z];
-               z[cellidx] = t * precon_diag[cellidx];
-           }
+   split_components();
+
+   // neighbour tables, which need the compact indices of all cells
+   #pragma omp parallel for schedule(static) num_threads(num_threads) if(num_threads > 1)
+   for (int row = 0; row < num_rows; row++) {
+       const unsigned j = row % n_cells_y;
+       const unsigned k = row / n_cells_y;
+       for (index_t c = row_begin[row]; c < row_begin[row + 1]; c++) {
+           const index_t cellidx = fluid_cells[c];
+           const unsigned i = cellidx - row*stride_y;
+           auto neighbour = [&](bool in_range, index_t nb_cellidx) {
+               return in_range && grid.pfluid_[nb_cellidx] ? compact_index[nb_cellidx] : num_fluid;
+           };
+           nb_ym[c] = neighbour(j > 0, cellidx - stride_y);
+           nb_yp[c] = neighbour(j + 1 < n_cells_y, cellidx + stride_y);
+           nb_zm[c] = neighbour(k > 0, cellidx - stride_z);
+           nb_zp[c] = neighbour(k + 1 < n_cells_z, cellidx + stride_z);
+           nb_code[c] = (i > 0 && grid.pfluid_[cellidx - stride_x] ? NB_XM : 0)
+                      | (i + 1 < n_cells_x && grid.pfluid_[cellidx + stride_x] ? NB_XP : 0)
+                      | (nb_ym[c] != num_fluid ? NB_YM : 0)
+                      | (nb_yp[c] != num_fluid ? NB_YP : 0)
+                      | (nb_zm[c] != num_fluid ? NB_ZM : 0)
+                      | (nb_zp[c] != num_fluid ? NB_ZP : 0);
+           A_diag[c] = grid.A_diag_val[cellidx];
+           if (A_diag_f != nullptr) A_diag_f[c] = A_diag[c];
        }
    }
+
+   // padding entries read in place of non-fluid neighbours
+   q[num_fluid] = r[num_fluid] = z[num_fluid] = s[num_fluid] = 0;
+   precon_diag[num_fluid] = A_diag[num_fluid] = 0;
+   nb_code[num_fluid] = 0;
+   if (precision == PRECISION_MIXED) {
+       q_f[num_fluid] = r_f[num_fluid] = z_f[num_fluid] = s_f[num_fluid] = 0;
+       precon_diag_f[num_fluid] = A_diag_f[num_fluid] = 0;
+   }
 }
 
-void ICConjugateGradientSolver::computePreconDiag() {
-   for (unsigned k = 0; k < n_cells_z; k++) {
-       for (unsigned j = 0; j < n_cells_y; j++) {
-           for (unsigned i = 0; i < n_cells_x; i++) {
-               const unsigned cellidx = i + j*stride_y + k*stride_z;
-               if (not grid.pfluid_[cellidx]) {
-                   precon_diag[cellidx] = 0;
-                   continue;
-               }
-               double e = A_diag[cellidx];
-               if (i > 0 && grid.pfluid_[cellidx - stride_x]) e -= (precon_diag[cellidx - stride_x] * precon_diag[cellidx - stride_x]);
-               if (j > 0 && grid.pfluid_[cellidx - stride_y]) e -= (precon_diag[cellidx - stride_y] * precon_diag[cellidx - stride_y]);
-               if (k > 0 && grid.pfluid_[cellidx - stride_z]) e -= (precon_diag[cellidx - stride_z] * precon_diag[cellidx - stride_z]);
-               precon_diag[cellidx] = 1 / std::sqrt(e + 1e-30);
-           }
+template<typename F>
+void ICConjugateGradientSolver::for_each_fluid_neighbour(const index_t cellidx, F f) const {
+   const unsigned i = cellidx % n_cells_x;
+   const unsigned j = (cellidx / n_cells_x) % n_cells_y;
+   const unsigned k = cellidx / stride_z;
+   if (i > 0 && grid.pfluid_[cellidx - stride_x]) f(cellidx - stride_x);
+   if (i + 1 < n_cells_x && grid.pfluid_[cellidx + stride_x]) f(cellidx + stride_x);
+   if (j > 0 && grid.pfluid_[cellidx - stride_y]) f(cellidx - stride_y);
+   if (j + 1 < n_cells_y && grid.pfluid_[cellidx + stride_y]) f(cellidx + stride_y);
+   if (k > 0 && grid.pfluid_[cellidx - stride_z]) f(cellidx - stride_z);
+   if (k + 1 < n_cells_z && grid.pfluid_[cellidx + stride_z]) f(cellidx + stride_z);
+}
+
+// Flood fill of the fluid components. A component is solved directly if it
+// has at most direct_solve_size cells and one of them has an air neighbour,
+// otherwise its matrix is singular (pure Neumann boundary) and it stays in
+// the CG system. The CG cells keep their row order, so the neighbour tables
+// and the row-based sweeps work as before.
+void ICConjugateGradientSolver::split_components() {
+   const unsigned num_rows = n_cells_y * n_cells_z;
+   const index_t num_total = row_begin[num_rows];
+   const index_t unlabelled = -1, iterative = -1;
+   num_fluid = num_total;
+   num_direct = 0;
+   direct_begin.clear();
+   if (direct_solve_size == 0) return;
+
+   component.assign(num_total, unlabelled);
+   component_next.clear();
+   index_t num_direct_cells = 0;
+   for (index_t seed = 0; seed < num_total; seed++) {
+       if (component[seed] != unlabelled) continue;
+       const index_t label = component_next.size();
+       index_t size = 0;
+       double air_neighbours = 0;
+       component[seed] = label;
+       flood_stack.push_back(seed);
+       while (not flood_stack.empty()) {
+           const index_t cellidx = fluid_cells[flood_stack.back()];
+           flood_stack.pop_back();
+           size++;
+           // A_diag_val counts the non-solid neighbours
+           air_neighbours += grid.A_diag_val[cellidx];
+           for_each_fluid_neighbour(cellidx, [&](index_t nb_cellidx) {
+               air_neighbours -= 1;
+               const index_t nb = compact_index[nb_cellidx];
+               if (component[nb] != unlabelled) return;
+               component[nb] = label;
+               flood_stack.push_back(nb);
+           });
+       }
+       const bool direct = size <= direct_solve_size && air_neighbours > 0;
+       // the size for now, replaced by the first compact index below
+       component_next.push_back(direct ? size : iterative);
+       if (direct) num_direct_cells += size;
+   }
+   if (num_direct_cells == 0) return;
+
+   // components solved directly in the order of their first cell
+   index_t next = num_total - num_direct_cells;
+   for (index_t& comp_next : component_next) {
+       if (comp_next == iterative) continue;
+       direct_begin.push_back(next);
+       const index_t size = comp_next;
+       comp_next = next;
+       next += size;
+   }
+   direct_begin.push_back(next);
+
+   cells_copy.assign(fluid_cells, fluid_cells + num_total);
+   index_t next_iterative = 0;
+   for (unsigned row = 0; row < num_rows; row++) {
+       const index_t begin = row_begin[row], end = row_begin[row + 1];
+       row_begin[row] = next_iterative;
+       for (index_t c = begin; c < end; c++) {
+           index_t& comp_next = component_next[component[c]];
+           const index_t new_c = comp_next == iterative ? next_iterative++ : comp_next++;
+           fluid_cells[new_c] = cells_copy[c];
+           compact_index[cells_copy[c]] = new_c;
        }
    }
+   row_begin[num_rows] = next_iterative;
+   num_fluid = next_iterative;
+   num_direct = num_direct_cells;
+
+   // the multigrid V-cycle works on all fluid cells of the grid, and
+   // applyMultigrid only writes the cells of the CG system
+   if (multigrid_r != nullptr) {
+       for (index_t c = num_fluid; c < num_fluid + num_direct; c++) multigrid_r[fluid_cells[c]] = 0;
+   }
 }
 
-// apply the matrix A: y <- A b
-// element order: k-j-i
-void ICConjugateGradientSolver::applyA(const double *b, double *y) const{
-   for (unsigned k = 0; k < n_cells_z; k++) {
-       for (unsigned j = 0; j < n_cells_y; j++) {
-           for (unsigned i = 0; i < n_cells_x; i++) {
-               const unsigned cellidx = i + j*stride_y + k*stride_z;
-               double diag_val = grid.A_diag_val[cellidx];
-               const double b_cell = b[cellidx];
-
-               if (i == 0 && j == 0 && k == 0) y[cellidx] = 0;
-               y[cellidx] += diag_val * b_cell;
-
-               // avoid filling y with zeroes beforehand
-               if (j == 0 && k == 0 && i+1 < n_cells_x)  y[cellidx+stride_x] = 0;
-               if (k == 0 && j+1 < n_cells_y)  y[cellidx+stride_y] = 0;
-               if (k+1 < n_cells_z) y[cellidx+stride_z] = 0;
-               // Compute off-diagonal entries
-               if (grid.pfluid_[cellidx]){
-                   // x-adjacent cells
-                   if (i+1 < n_cells_x && grid.pfluid_[cellidx+stride_x]){
-                       y[cellidx] 			-= b[cellidx+stride_x];
-                       y[cellidx+stride_x] -= b_cell;
-                   }
-
-                   // y-adjacent cells
-                   if (j+1 < n_cells_y && grid.pfluid_[cellidx+stride_y]){
-                       y[cellidx] 			-= b[cellidx+stride_y];
-                       y[cellidx+stride_y] -= b_cell;
-                   }
-
-                   // z-adjacent cells
-                   if (k+1 < n_cells_z && grid.pfluid_[cellidx+stride_z]){
-                       y[cellidx] 			-= b[cellidx+stride_z];
-                       y[cellidx+stride_z] -= b_cell;
-                   }
-               }
+void ICConjugateGradientSolver::scatter_solution(const double* p, double* grid_p) {
+   if (has_scattered) {
+       for (const index_t cellidx : scattered_cells) grid_p[cellidx] = 0;
+   } else {
+       std::fill(grid_p, grid_p + num_cells, 0);
+       has_scattered = true;
+   }
+   for_each_chunk(num_fluid + num_direct, [&](index_t begin, index_t end) {
+       for (index_t c = begin; c < end; c++) grid_p[fluid_cells[c]] = p[c];
+   });
+   scattered_cells.assign(fluid_cells, fluid_cells + num_fluid + num_direct);
+}
+
+// ********* Preconditioner **********
+
+// The stencil kernels spell out the order of the sums and the fused
+// multiply-adds, so that the results do not depend on how the neighbours are
+// looked up or on the SIMD width. This file is compiled with
+// -fno-associative-math (see CMakeLists.txt), which keeps the compiler from
+// reordering them (-Ofast otherwise chooses an order depending on the
+// surrounding code).
+#if defined(__ASSOCIATIVE_MATH__) || (defined(__clang__) && defined(__FAST_MATH__))
+#error "ConjugateGradient.cpp must be compiled with -fno-associative-math"
+#endif
+
+// non-fluid neighbours refer to the padding entries, whose precon_diag, q and z
+// are zero, so they contribute nothing to the sums
+template<typename T>
+void ICConjugateGradientSolver::forwardSubstitutionRow(const unsigned row, const T *precon_diag, const T *r, T *q) const {
+   for (index_t c = row_begin[row]; c < row_begin[row + 1]; c++) {
+       const index_t xm = nb_xm(c), ym = nb_ym[c], zm = nb_zm[c];
+       const T t = std::fma(precon_diag[xm], q[xm], precon_diag[ym] * q[ym])
+                 + std::fma(precon_diag[zm], q[zm], r[c]);
+       q[c] = t * precon_diag[c];
+   }
+}
+
+template<typename T>
+void ICConjugateGradientSolver::backwardSubstitutionRow(const unsigned row, const T *precon_diag, const T *q, T *z) const {
+   for_each_cell_reverse(row_begin[row], row_begin[row + 1], [&](const index_t c) {
+       const T t = std::fma(precon_diag[c], (z[nb_xp(c)] + z[nb_yp[c]]) + z[nb_zp[c]], q[c]);
+       z[c] = t * precon_diag[c];
+   });
+}
+
+// the V-cycle works on the grid, only its fluid cells are read and written
+template<typename T>
+void ICConjugateGradientSolver::applyMultigrid(const T *r, T *z) const {
+   for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+       for (index_t c = begin; c < end; c++) multigrid_r[fluid_cells[c]] = r[c];
+   });
+   multigrid->apply(multigrid_r, multigrid_z);
+   for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+       for (index_t c = begin; c < end; c++) z[c] = multigrid_z[fluid_cells[c]];
+   });
+}
+
+// z <- D⁻¹ r, inv_diag holds the inverse of the diagonal of A
+template<typename T>
+void ICConjugateGradientSolver::applyJacobi(const T *inv_diag, const T *r, T *z) const {
+   for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+       for (index_t c = begin; c < end; c++) z[c] = inv_diag[c] * r[c];
+   });
+}
+
+// Chebyshev iteration for A z = r starting from zero, preconditioned by D.
+// The eigenvalues of D⁻¹A lie in (0, 2] (Gershgorin), the iteration is tuned
+// to [2 / chebyshev_ratio, 2]. Its result is p(D⁻¹A) D⁻¹ r for a polynomial p
+// which is positive on (0, 2], so the preconditioner is symmetric positive
+// definite and fixed, as required by CG. d and y are buffers.
+template<typename T>
+void ICConjugateGradientSolver::applyChebyshev(const T *inv_diag, const T *r, T *z, T *d, T *y) const {
+   const double lambda_max = 2, lambda_min = lambda_max / chebyshev_ratio;
+   const double theta = (lambda_max + lambda_min) / 2, delta = (lambda_max - lambda_min) / 2;
+   const double sigma = theta / delta;
+   double rho = 1 / sigma;
+
+   // d = D⁻¹ r / θ, z = d
+   z[num_fluid] = 0;
+   for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+       const T scale = 1 / theta;
+       for (index_t c = begin; c < end; c++) {
+           d[c] = scale * inv_diag[c] * r[c];
+           z[c] = d[c];
+       }
+   });
+   for (unsigned k = 1; k < chebyshev_degree; k++) {
+       const double rho_new = 1 / (2 * sigma - rho);
+       // d = ρ_new ρ d + 2 ρ_new / δ D⁻¹ (r - A z), z = z + d
+       applyA(z, y);
+       for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+           const T a = rho_new * rho, b = 2 * rho_new / delta;
+           for (index_t c = begin; c < end; c++) {
+               d[c] = a * d[c] + b * inv_diag[c] * (r[c] - y[c]);
+               z[c] += d[c];
            }
+       });
+       rho = rho_new;
+   }
+}
+
+// apply the preconditioner; for IC(0) and MIC(0), (L L^T)^-1 by solving
+// Lq = d and Lp = q
+void ICConjugateGradientSolver::applyPreconditioner(const double *r, double *z) const {
+   if (preconditioner == PRECONDITIONER_MULTIGRID) {
+       applyMultigrid(r, z);
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_NONE) {
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) { std::copy(r + b, r + e, z + b); });
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_JACOBI) {
+       applyJacobi(precon_diag, r, z);
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_CHEBYSHEV) {
+       applyChebyshev(precon_diag, r, z, chebyshev_d, chebyshev_y);
+       return;
+   }
+   for_each_row(false, [&](unsigned row) { forwardSubstitutionRow(row, precon_diag, r, q); });
+   for_each_row(true, [&](unsigned row) { backwardSubstitutionRow(row, precon_diag, q, z); });
+}
+
+void ICConjugateGradientSolver::applyPreconditioner(const float *r, float *z) const {
+   if (preconditioner == PRECONDITIONER_MULTIGRID) {
+       applyMultigrid(r, z);
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_NONE) {
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) { std::copy(r + b, r + e, z + b); });
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_JACOBI) {
+       applyJacobi(precon_diag_f, r, z);
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_CHEBYSHEV) {
+       applyChebyshev(precon_diag_f, r, z, chebyshev_d_f, chebyshev_y_f);
+       return;
+   }
+   for_each_row(false, [&](unsigned row) { forwardSubstitutionRow(row, precon_diag_f, r, q_f); });
+   for_each_row(true, [&](unsigned row) { backwardSubstitutionRow(row, precon_diag_f, q_f, z); });
+}
+
+void ICConjugateGradientSolver::computePreconDiagRow(const unsigned row) {
+   for (index_t c = row_begin[row]; c < row_begin[row + 1]; c++) {
+       const double xm = precon_diag[nb_xm(c)], ym = precon_diag[nb_ym[c]], zm = precon_diag[nb_zm[c]];
+       const double e = std::fma(-zm, zm, (A_diag[c] + 1e-30) - std::fma(xm, xm, ym * ym));
+       precon_diag[c] = 1 / std::sqrt(e);
+   }
+}
+
+// MIC(0) as in Bridson's notes: with off-diagonal entries -1, the fill-in
+// dropped by IC(0) in row c is, for each lower neighbour, its squared precon_diag
+// times the number of its fluid upper neighbours other than c. The padding
+// entry has no neighbours and a zero precon_diag.
+void ICConjugateGradientSolver::computeMICPreconDiagRow(const unsigned row) {
+   auto count = [&](index_t nb, unsigned char bit1, unsigned char bit2) {
+       return (double) ((nb_code[nb] & bit1) != 0) + ((nb_code[nb] & bit2) != 0);
+   };
+   for (index_t c = row_begin[row]; c < row_begin[row + 1]; c++) {
+       const index_t xm = nb_xm(c), ym = nb_ym[c], zm = nb_zm[c];
+       const double pxm = precon_diag[xm] * precon_diag[xm];
+       const double pym = precon_diag[ym] * precon_diag[ym];
+       const double pzm = precon_diag[zm] * precon_diag[zm];
+       const double fill_in = pxm * count(xm, NB_YP, NB_ZP)
+                            + pym * count(ym, NB_XP, NB_ZP)
+                            + pzm * count(zm, NB_XP, NB_YP);
+       double e = A_diag[c] - pxm - pym - pzm - tau * fill_in;
+       if (e < mic_safety * A_diag[c]) e = A_diag[c];
+       precon_diag[c] = 1 / std::sqrt(e + 1e-30);
+   }
+}
+
+void ICConjugateGradientSolver::computePreconDiag() {
+   if (preconditioner == PRECONDITIONER_MULTIGRID) {
+       multigrid->update();
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_NONE) return;
+   if (preconditioner == PRECONDITIONER_JACOBI || preconditioner == PRECONDITIONER_CHEBYSHEV) {
+       // inverse of the diagonal, cells without fluid or air neighbours have an empty row
+       for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+           for (index_t c = begin; c < end; c++) precon_diag[c] = A_diag[c] > 0 ? 1 / A_diag[c] : 0;
+       });
+       return;
+   }
+   if (preconditioner == PRECONDITIONER_MIC0) {
+       for_each_row(false, [&](unsigned row) { computeMICPreconDiagRow(row); });
+       return;
+   }
+   for_each_row(false, [&](unsigned row) { computePreconDiagRow(row); });
+}
+
+// apply the matrix A: y <- A b
+// every entry is gathered from its neighbours, so entries can be computed by
+// different threads independently; b must have the padding zero entry
+template<typename T>
+void ICConjugateGradientSolver::applyStencilCells(const index_t begin, const index_t end, const T *diag, const T *b, T *y) const {
+   for (index_t c = begin; c < end; c++) {
+       // diagonal entry and off-diagonal entries of the upper y and z neighbours
+       const T t = std::fma(diag[c], b[c], -(b[nb_yp[c]] + b[nb_zp[c]]));
+       // off-diagonal entries of the remaining neighbours
+       y[c] = t - ((b[nb_zm[c]] + b[nb_ym[c]]) + (b[nb_xm(c)] + b[nb_xp(c)]));
+   }
+}
+
+template<typename T>
+void ICConjugateGradientSolver::applyStencil(const T *diag, const T *b, T *y) const {
+   for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+       applyStencilCells(begin, end, diag, b, y);
+   });
+}
+
+// four consecutive unknowns at a time: the x-neighbours are the unaligned
+// loads at c - 1 and c + 1, masked by the neighbour codes, the y- and
+// z-neighbours are gathered. The sums are evaluated in the same order as in
+// applyStencilCells, so that both give identical results.
+void ICConjugateGradientSolver::applyACells(const index_t begin, const index_t end, const double *b, double *y) const {
+   // the vector loop loads b[c - 1]
+   index_t c = std::min(std::max(begin, index_t(1)), end);
+   applyStencilCells(begin, c, A_diag, b, y);
+
+   const __m256i bit_xm = _mm256_set1_epi64x(NB_XM);
+   const __m256i bit_xp = _mm256_set1_epi64x(NB_XP);
+   for (; c + 4 <= end; c += 4) {
+       int codes;
+       std::memcpy(&codes, nb_code + c, sizeof(codes));
+       const __m256i code = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(codes));
+       const __m256d mask_xm = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(code, bit_xm), bit_xm));
+       const __m256d mask_xp = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(code, bit_xp), bit_xp));
+
+       // b[c + 4] is at most the padding entry
+       const __m256d b_xm = _mm256_and_pd(_mm256_loadu_pd(b + c - 1), mask_xm);
+       const __m256d b_xp = _mm256_and_pd(_mm256_loadu_pd(b + c + 1), mask_xp);
+       auto gather = [&](const index_t* nb) { return simd::gather(b, simd::load_index(nb + c)); };
+       const __m256d b_ym = gather(nb_ym);
+       const __m256d b_yp = gather(nb_yp);
+       const __m256d b_zm = gather(nb_zm);
+       const __m256d b_zp = gather(nb_zp);
+
+       const __m256d t = _mm256_fmsub_pd(_mm256_loadu_pd(A_diag + c), _mm256_loadu_pd(b + c),
+                                         _mm256_add_pd(b_yp, b_zp));
+       const __m256d neighbours = _mm256_add_pd(_mm256_add_pd(b_zm, b_ym), _mm256_add_pd(b_xm, b_xp));
+       _mm256_storeu_pd(y + c, _mm256_sub_pd(t, neighbours));
+   }
+   applyStencilCells(c, end, A_diag, b, y);
+}
+
+void ICConjugateGradientSolver::applyA(const double *b, double *y) const {
+   for_each_chunk(num_fluid, [&](index_t begin, index_t end) {
+       applyACells(begin, end, b, y);
+   });
+}
+
+void ICConjugateGradientSolver::applyA(const float *b, float *y) const {
+   applyStencil(A_diag_f, b, y);
+}
+
+// a + b = s + e exactly (Knuth's TwoSum), which relies on this file being
+// compiled without associative math
+static inline void two_sum(const double a, const double b, double& s, double& e) {
+   s = a + b;
+   const double bb = s - a;
+   e = (a - (s - bb)) + (b - bb);
+}
+
+// the residual rhs - A s computed in double precision carries the rounding
+// error of A s, about the unit roundoff times 8 |s|, which exceeds thresh for
+// large pressures. The product with the diagonal entry is split exactly with
+// a fused multiply-add and the sum is compensated, so the residual is accurate
+// to its own magnitude.
+double ICConjugateGradientSolver::residualCellsCompensated(const index_t begin, const index_t end, const double *rhs,
+                                                           const double *s, double *r) const {
+   double max_abs = 0;
+   for (index_t c = begin; c < end; c++) {
+       const double product = A_diag[c] * s[c];
+       double sum, err;
+       two_sum(rhs[c], -product, sum, err);
+       err -= std::fma(A_diag[c], s[c], -product);
+       for (const index_t nb : {nb_xm(c), nb_xp(c), nb_ym[c], nb_yp[c], nb_zm[c], nb_zp[c]}) {
+           double e;
+           two_sum(sum, s[nb], sum, e);
+           err += e;
        }
+       r[c] = sum + err;
+       max_abs = std::max(max_abs, std::abs(r[c]));
    }
+   return max_abs;
 }
 
+// the dot products are computed on blocks of y just written by the stencil,
+// which are still in L1, instead of reading the vectors again
+std::pair<double, double> ICConjugateGradientSolver::applyADots(const double *b, const double *x, double *y) {
+   const index_t block_size = 256;
+   return sum_pair_chunks(num_fluid, [&](index_t begin, index_t end) {
+       double xb = 0, yb = 0;
+       for (index_t c = begin; c < end; c += block_size) {
+           const index_t n = std::min(block_size, end - c);
+           applyACells(c, c + n, b, y);
+           xb += dot(x + c, b + c, n);
+           yb += dot(y + c, b + c, n);
+       }
+       return std::make_pair(xb, yb);
+   });
+}
 void checknan(const double* array, int len, std::string array_name="array") {
    int count_left = 20;
    for (int i = 0; i<len; i++) {
@@ -868,48 +1593,90 @@ void print_array_head(const double* array, std::string prefix="", unsigned numbe
    std::cout << std::endl;
 }
 
+void ICConjugateGradientSolver::solve_compact(const double* rhs, double* p, const bool use_initial_guess) {
+   solveIterative(rhs, p, use_initial_guess);
+   // after the CG solve, which uses the entry of the first directly solved
+   // cell as padding of p
+   if (num_direct > 0) solveDirect(rhs, p);
+}
 
-void ICConjugateGradientSolver::solve(const double* rhs, double* p) {
+void ICConjugateGradientSolver::solveIterative(const double* rhs, double* p, const bool use_initial_guess) {
    // initialize initial guess and residual
    // catch zero rhs early
-   double max_residual_modulus = xmax(num_cells, rhs);
-   if (max_residual_modulus < thresh) {
-       std::fill(p,p+num_cells,0);
+   rhs_norm = max_chunks(num_fluid, [&](index_t b, index_t e) {
+       return xmax(e - b, rhs + b);
+   });
+   initial_residual = rhs_norm;
+   step = 0;
+   if (rhs_norm < thresh) {
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+           std::fill(p + b, p + e, 0);
+       });
+       return;
+   }
+
+   if (precision == PRECISION_MIXED) {
+       solveMixed(rhs, p, use_initial_guess);
+       return;
+   }
+
+   // without initial guess, the initial residual is rhs and the first step
+   // initializes p and r; otherwise r <- rhs - A p
+   const double* r0 = rhs;
+   if (use_initial_guess) {
+       p[num_fluid] = 0;
+       applyA(p, z);
+       initial_residual = max_chunks(num_fluid, [&](index_t b, index_t e) {
+           return axpyzmax(e - b, -1, z + b, rhs + b, r + b);
+       });
+       if (initial_residual < thresh) return;
+       r0 = r;
+   }
+
+   if (variant == VARIANT_CHRONOPOULOS_GEAR) {
+       solveChronopoulosGear(r0, p, use_initial_guess);
        return;
    }
 
    computePreconDiag();
    // s = M⁻¹ r
-   applyPreconditioner(rhs, s);
+   applyPreconditioner(r0, s);
 
    // ρ = <r,s>
-   double rho = dot(rhs,s,num_cells);
+   double rho = sum_chunks(num_fluid, [&](index_t b, index_t e) {
+       return dot(r0 + b, s + b, e - b);
+   });
 
-   for(unsigned step = 0; step < max_steps; step++){
+   for(step = 0; step < max_steps; step++){
        applyA(s, z);
-       const double dots = dot(z,s,num_cells);
+       const double dots = sum_chunks(num_fluid, [&](index_t b, index_t e) {
+           return dot(z + b, s + b, e - b);
+       });
        const double alpha = rho / dots;
 
        double max_abs_val;
-       if (step == 0) {
+       if (step == 0 && not use_initial_guess) {
            // on the first step initialize p
            // p <- α s
-           axy(num_cells, alpha, s, p);
-
            // r <- (-α z + rhs)
-           max_abs_val = axpyzmax(num_cells, -alpha, z, rhs, r);
+           max_abs_val = max_chunks(num_fluid, [&](index_t b, index_t e) {
+               axy(e - b, alpha, s + b, p + b);
+               return axpyzmax(e - b, -alpha, z + b, rhs + b, r + b);
+           });
        }
        else {
            // p <- α s
-           axpy(num_cells, alpha, s, p);
-
            // r <- (-α z + r)
-           max_abs_val = axpymax(num_cells, -alpha, z, r);
+           max_abs_val = max_chunks(num_fluid, [&](index_t b, index_t e) {
+               axpy(e - b, alpha, s + b, p + b);
+               return axpymax(e - b, -alpha, z + b, r + b);
+           });
        }
 
        // std::cout << "Max abs val: " << max_abs_val << std::endl;
        if (max_abs_val < thresh) {
            // std::cout << "Number of steps: " << step + 1 << std::endl;
+           step++;
            return;
        }
        else if (step + 1 == max_steps) {
@@ -918,12 +1685,265 @@ void ICConjugateGradientSolver::solve(const double* rhs, double* p) {
 
        // z = M⁻¹ r
        applyPreconditioner(r, z);
-       const double rho_new = dot(z, r, num_cells);
+       const double rho_new = sum_chunks(num_fluid, [&](index_t b, index_t e) {
+           return dot(z + b, r + b, e - b);
+       });
        const double beta = rho_new / rho;
        rho = rho_new;
        //Bug potential: aliasing
-       axpyz(num_cells, beta, s, z, s);
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+           axpyz(e - b, beta, s + b, z + b, s + b);
+       });
+   }
+}
+
+// The components solved directly are small and touch air, so their matrices
+// are symmetric positive definite. Each one is factorized densely, L L^T = A,
+// in every solve: for components of a few cells this costs about as much as
+// assembling the matrix.
+void ICConjugateGradientSolver::solveDirect(const double* rhs, double* p) const {
+   const int num_components = direct_begin.size() - 1;
+   #pragma omp parallel num_threads(num_threads) if(num_threads > 1 && num_components > 1)
+   {
+       std::vector<double> L;
+       #pragma omp for schedule(dynamic, 16)
+       for (int comp = 0; comp < num_components; comp++) {
+           const index_t begin = direct_begin[comp];
+           const unsigned n = direct_begin[comp + 1] - begin;
+
+           // lower triangle of A, all fluid neighbours belong to the component
+           L.assign(n*n, 0);
+           for (unsigned a = 0; a < n; a++) {
+               const index_t cellidx = fluid_cells[begin + a];
+               L[a*n + a] = grid.A_diag_val[cellidx];
+               for_each_fluid_neighbour(cellidx, [&](index_t nb_cellidx) {
+                   const unsigned b = compact_index[nb_cellidx] - begin;
+                   if (b < a) L[a*n + b] = -1;
+               });
+           }
+
+           // Cholesky factorization row by row
+           for (unsigned a = 0; a < n; a++) {
+               for (unsigned b = 0; b <= a; b++) {
+                   double sum = L[a*n + b];
+                   for (unsigned k = 0; k < b; k++) sum -= L[a*n + k] * L[b*n + k];
+                   L[a*n + b] = a == b ? std::sqrt(sum) : sum / L[b*n + b];
+               }
+           }
+
+           // L y = rhs, L^T p = y
+           double* x = p + begin;
+           for (unsigned a = 0; a < n; a++) {
+               double sum = rhs[begin + a];
+               for (unsigned k = 0; k < a; k++) sum -= L[a*n + k] * x[k];
+               x[a] = sum / L[a*n + a];
+           }
+           for (int a = n - 1; a >= 0; a--) {
+               double sum = x[a];
+               for (unsigned k = a + 1; k < n; k++) sum -= L[k*n + a] * x[k];
+               x[a] = sum / L[a*n + a];
+           }
+       }
+   }
+}
+
+// Chronopoulos-Gear CG: with the auxiliary vector z = M⁻¹ r and w = A z, the
+// product t = A s of the search direction follows the same recurrence as s,
+// t <- w + β t, and the step length follows from ρ = <r,z> and δ = <w,z>:
+//   α = ρ / (δ - β ρ / α_old)
+// so an iteration consists of one pass updating s, t, p and r, the
+// preconditioner, and one pass computing w = A z together with ρ and δ.
+// The standard iteration additionally reads z and s for <As,s>, r and z for
+// <r,z>, and s and z for the update of s.
+void ICConjugateGradientSolver::solveChronopoulosGear(const double* r0, double* p, const bool use_initial_guess) {
+   computePreconDiag();
+   // z = M⁻¹ r
+   applyPreconditioner(r0, z);
+
+   // w = A z, ρ = <r,z>, δ = <w,z>
+   auto dots = applyADots(z, r0, w);
+   double rho = dots.first;
+   double alpha = rho / dots.second;
+   double beta = 0;
+
+   for (step = 0; step < max_steps; step++) {
+       double max_abs_val;
+       if (step == 0) {
+           max_abs_val = max_chunks(num_fluid, [&](index_t b, index_t e) {
+               return cg_update_first(e - b, alpha, z + b, w + b, use_initial_guess,
+                                      s + b, t + b, p + b, r0 + b, r + b);
+           });
+       }
+       else {
+           max_abs_val = max_chunks(num_fluid, [&](index_t b, index_t e) {
+               return cg_update(e - b, alpha, beta, z + b, w + b, s + b, t + b, p + b, r + b);
+           });
+       }
+
+       if (max_abs_val < thresh) {
+           step++;
+           return;
+       }
+       else if (step + 1 == max_steps) {
+           std::cout << "WARNING: Failed to find a solution in " << step + 1 << " steps (|r|=" << max_abs_val <<")!" << std::endl;
+       }
+
+       // z = M⁻¹ r
+       applyPreconditioner(r, z);
+       // w = A z, ρ = <r,z>, δ = <w,z>
+       dots = applyADots(z, r, w);
+       const double rho_new = dots.first;
+       beta = rho_new / rho;
+       alpha = rho_new / (dots.second - beta * rho_new / alpha);
+       rho = rho_new;
+   }
+}
+
+// Mixed precision CG with reliable updates: the iterations run on single
+// precision vectors for the normalized residual r_f = r / |r|, the correction
+// since the last update is accumulated in x_f. Whenever the residual of the
+// iterations dropped by inner_reduction, the correction is added to the
+// solution s and the residual r = rhs - A s is recomputed, both in double
+// precision (the residual with compensated sums). The iteration then
+// continues with the new, renormalized residual and the old search
+// direction, so that the Krylov space is not lost as in a restarted
+// refinement, unless the update reduced the residual by less than
+// stagnation_reduction: the single precision search direction is then no
+// longer useful and the iteration restarts from the residual.
+void ICConjugateGradientSolver::solveMixed(const double* rhs, double* p, const bool use_initial_guess) {
+   if (use_initial_guess) {
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+           std::copy(p + b, p + e, s + b);
+       });
+       applyA(s, z);
+       initial_residual = max_chunks(num_fluid, [&](index_t b, index_t e) {
+           return axpyzmax(e - b, -1, z + b, rhs + b, r + b);
+       });
+   } else {
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+           std::fill(s + b, s + e, 0);
+           std::copy(rhs + b, rhs + e, r + b);
+       });
+   }
+
+   double max_residual = initial_residual;
+   if (max_residual < thresh) {
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+           std::copy(s + b, s + e, p + b);
+       });
+       return;
+   }
+
+   computePreconDiag();
+   if (preconditioner != PRECONDITIONER_MULTIGRID && preconditioner != PRECONDITIONER_NONE) {
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+           for (index_t c = b; c < e; c++) precon_diag_f[c] = precon_diag[c];
+       });
+   }
+
+   // normalized residual in single precision
+   for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+       for (index_t c = b; c < e; c++) r_f[c] = r[c] / max_residual;
+   });
+
+   // s = M⁻¹ r
+   applyPreconditioner(r_f, s_f);
+
+   // ρ = <r,s>
+   double rho = sum_chunks(num_fluid, [&](index_t b, index_t e) {
+       return dot(r_f + b, s_f + b, e - b);
+   });
+
+   bool first = true;
+   for (step = 0; step < max_steps; step++) {
+       applyA(s_f, z_f);
+       const double dots = sum_chunks(num_fluid, [&](index_t b, index_t e) {
+           return dot(z_f + b, s_f + b, e - b);
+       });
+       const float alpha = rho / dots;
+
+       // x <- x + α s
+       // r <- r - α z
+       const double max_abs_val = max_chunks(num_fluid, [&](index_t b, index_t e) {
+           if (first) axy(e - b, alpha, s_f + b, x_f + b);
+           else axpy(e - b, alpha, s_f + b, x_f + b);
+           return axpymax(e - b, -alpha, z_f + b, r_f + b);
+       });
+       first = false;
+
+       if (max_abs_val < inner_reduction || step + 1 == max_steps) {
+           // reliable update:
+           // s <- s + |r| x
+           // r <- rhs - A s
+           for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+               for (index_t c = b; c < e; c++) s[c] += max_residual * x_f[c];
+           });
+           const double previous_residual = max_residual;
+           max_residual = max_chunks(num_fluid, [&](index_t b, index_t e) {
+               return residualCellsCompensated(b, e, rhs, s, r);
+           });
+           first = true;
+
+           if (max_residual < thresh) {
+               step++;
+               break;
+           }
+           else if (step + 1 == max_steps) {
+               std::cout << "WARNING: Failed to find a solution in " << step + 1 << " steps (|r|=" << max_residual <<")!" << std::endl;
+           }
+
+           if (max_residual > stagnation_reduction * previous_residual) {
+               // restart from the renormalized residual: s = M⁻¹ r, ρ = <r,s>
+               for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+                   for (index_t c = b; c < e; c++) r_f[c] = r[c] / max_residual;
+               });
+               applyPreconditioner(r_f, s_f);
+               rho = sum_chunks(num_fluid, [&](index_t b, index_t e) {
+                   return dot(r_f + b, s_f + b, e - b);
+               });
+               continue;
+           }
+
+           // renormalize the residual, the search direction and ρ
+           const float rescale = previous_residual / max_residual;
+           for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+               for (index_t c = b; c < e; c++) r_f[c] = r[c] / max_residual;
+               axy(e - b, rescale, s_f + b, s_f + b);
+           });
+           rho *= (double) rescale * rescale;
+       }
+
+       // z = M⁻¹ r
+       applyPreconditioner(r_f, z_f);
+       const double rho_new = sum_chunks(num_fluid, [&](index_t b, index_t e) {
+           return dot(z_f + b, r_f + b, e - b);
+       });
+       const float beta = rho_new / rho;
+       rho = rho_new;
+       for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+           axpyz(e - b, beta, s_f + b, z_f + b, s_f + b);
+       });
+   }
+
+   for_each_chunk(num_fluid, [&](index_t b, index_t e) {
+       std::copy(s + b, s + e, p + b);
+   });
+}
+
+void ICConjugateGradientSolver::solve(const double* rhs, double* p) {
+   if (compact_rhs == nullptr) {
+       compact_rhs = new (std::align_val_t(32)) double [num_cells + 1];
+       compact_p = new (std::align_val_t(32)) double [num_cells + 1];
    }
+   update_fluid_cells();
+   for_each_chunk(num_fluid + num_direct, [&](index_t begin, index_t end) {
+       for (index_t c = begin; c < end; c++) compact_rhs[c] = rhs[fluid_cells[c]];
+   });
+   solve_compact(compact_rhs, compact_p);
+   std::fill(p, p + num_cells, 0);
+   for_each_chunk(num_fluid + num_direct, [&](index_t begin, index_t end) {
+       for (index_t c = begin; c < end; c++) p[fluid_cells[c]] = compact_p[c];
+   });
 }
 
 SparseMat::SparseMat(unsigned a, unsigned b): v(a), r(b){
@@ -940,10 +1960,36 @@ SparseMat::~SparseMat(){
 
 ICConjugateGradientSolver::~ICConjugateGradientSolver() {
    delete [] q;
+   delete [] r;
    delete [] z;
    delete [] s;
    delete [] precon_diag;
    delete [] A_diag;
+   delete [] w;
+   delete [] t;
+   delete [] q_f;
+   delete [] r_f;
+   delete [] z_f;
+   delete [] s_f;
+   delete [] precon_diag_f;
+   delete [] A_diag_f;
+   delete [] x_f;
+   delete [] fluid_cells;
+   delete [] compact_index;
+   delete [] nb_code;
+   delete [] nb_ym;
+   delete [] nb_yp;
+   delete [] nb_zm;
+   delete [] nb_zp;
+   delete [] multigrid_r;
+   delete [] multigrid_z;
+   delete [] chebyshev_d;
+   delete [] chebyshev_y;
+   delete [] chebyshev_d_f;
+   delete [] chebyshev_y_f;
+   delete [] compact_rhs;
+   delete [] compact_p;
+   delete multigrid;
 
 }
 
@@ -1,17 +1,149 @@
 #include "FLIP.h"
 #include "tsc_x86.hpp"
+#include "parallel.h"
 //#define WRITE_REFERENCE 340
 
 
 FLIP::FLIP(Particles& particles, Mac3d* MACGrid, const SimConfig& cfg)
 	: cfg_(cfg), particles_(particles), num_particles_(particles.get_num_particles()),
 	  fluid_density_(cfg.getDensity()), gravity_mag_(cfg.getGravity()), alpha_(cfg.getAlpha()),
-	  MACGrid_(MACGrid), cg_solver(100, *MACGrid_) {
+	  MACGrid_(MACGrid), num_threads_(parallel::resolve_num_threads(cfg.getNumThreads())),
+	  cg_solver(100, *MACGrid_, cfg.getNumThreads()) {
 	
     unsigned nx = MACGrid_->get_num_cells_x();
     unsigned ny = MACGrid_->get_num_cells_y();
     unsigned nz = MACGrid_->get_num_cells_z();
-    d_ = new (std::align_val_t(32)) double [nx*ny*nz];
+    const index_t num_cells = MACGrid_->get_num_cells();
+    d_ = new (std::align_val_t(32)) double [num_cells];
+    // one additional entry for the padding of the initial guess
+    p_ = new (std::align_val_t(32)) double [num_cells + 1];
+
+	// Select the preconditioner of the pressure solver
+	const std::string preconditioner = cfg.getPreconditioner();
+	if (preconditioner == "none") {
+		cg_solver.set_preconditioner(ICConjugateGradientSolver::PRECONDITIONER_NONE);
+	} else if (preconditioner == "jacobi") {
+		cg_solver.set_preconditioner(ICConjugateGradientSolver::PRECONDITIONER_JACOBI);
+	} else if (preconditioner == "mic0") {
+		cg_solver.set_preconditioner(ICConjugateGradientSolver::PRECONDITIONER_MIC0);
+	} else if (preconditioner == "chebyshev") {
+		cg_solver.set_preconditioner(ICConjugateGradientSolver::PRECONDITIONER_CHEBYSHEV);
+	} else if (preconditioner == "multigrid") {
+		cg_solver.set_preconditioner(ICConjugateGradientSolver::PRECONDITIONER_MULTIGRID);
+	} else if (preconditioner != "ic0") {
+		std::cout << "*** Warning: unknown preconditioner '" << preconditioner
+		          << "'. Using incomplete Cholesky." << std::endl;
+	}
+	cg_solver.set_mic_parameters(cfg.getMICTau(), cfg.getMICSafety());
+
+	// Solve small fluid components, e.g. droplets, directly
+	const int direct_solve_size = cfg.getPressureDirectSolveSize();
+	if (direct_solve_size > int(ICConjugateGradientSolver::max_direct_solve_size)) {
+		std::cout << "*** Warning: pressure direct solve size " << direct_solve_size << " is larger than "
+		          << ICConjugateGradientSolver::max_direct_solve_size << ". Using "
+		          << ICConjugateGradientSolver::max_direct_solve_size << "." << std::endl;
+	}
+	cg_solver.set_direct_solve_size(std::max(0, direct_solve_size));
+
+	// Select the initial guess of the pressure solve
+	const std::string guess = cfg.getPressureInitialGuess();
+	if (guess == "previous") {
+		pressure_guess_ = PRESSURE_GUESS_PREVIOUS;
+	} else if (guess == "extrapolate") {
+		pressure_guess_ = PRESSURE_GUESS_EXTRAPOLATE;
+	} else {
+		pressure_guess_ = PRESSURE_GUESS_ZERO;
+		if (guess != "zero") {
+			std::cout << "*** Warning: unknown pressure initial guess '" << guess
+			          << "'. Using zero." << std::endl;
+		}
+	}
+	pressure_old_ = nullptr;
+	fluid_age_ = nullptr;
+	if (pressure_guess_ != PRESSURE_GUESS_ZERO) {
+		fluid_age_ = new unsigned char [num_cells];
+		std::fill(fluid_age_, fluid_age_ + num_cells, 0);
+	}
+	if (pressure_guess_ == PRESSURE_GUESS_EXTRAPOLATE) {
+		pressure_old_ = new (std::align_val_t(32)) double [num_cells];
+	}
+
+	// Select the precision of the pressure solver
+	const std::string precision = cfg.getPressureSolverPrecision();
+	if (precision == "mixed") {
+		cg_solver.set_precision(ICConjugateGradientSolver::PRECISION_MIXED);
+	} else if (precision != "double") {
+		std::cout << "*** Warning: unknown pressure solver precision '" << precision
+		          << "'. Using double precision." << std::endl;
+	}
+
+	// Select the formulation of the CG iteration
+	const std::string variant = cfg.getPressureSolverVariant();
+	if (variant == "chronopoulos-gear") {
+		cg_solver.set_variant(ICConjugateGradientSolver::VARIANT_CHRONOPOULOS_GEAR);
+	} else if (variant != "standard") {
+		std::cout << "*** Warning: unknown pressure solver variant '" << variant
+		          << "'. Using the standard iteration." << std::endl;
+	}
+
+	// Select the ordering of the preconditioner sweeps
+	const std::string sweep = cfg.getPreconditionerSweep();
+	if (sweep == "wavefront") {
+		cg_solver.set_sweep(ICConjugateGradientSolver::SWEEP_WAVEFRONT);
+	} else if (sweep != "lexicographic") {
+		std::cout << "*** Warning: unknown preconditioner sweep '" << sweep
+		          << "'. Using lexicographic sweep." << std::endl;
+	}
+
+	// Select the kernel of the particle-to-grid transfer
+	const std::string p2g_kernel = cfg.getParticleToGridKernel();
+	if (p2g_kernel == "trilinear") {
+		p2g_kernel_ = P2G_KERNEL_TRILINEAR;
+	} else if (p2g_kernel == "quadratic") {
+		p2g_kernel_ = P2G_KERNEL_QUADRATIC;
+	} else {
+		p2g_kernel_ = P2G_KERNEL_SPH;
+		if (p2g_kernel != "sph") {
+			std::cout << "*** Warning: unknown particle-to-grid kernel '" << p2g_kernel
+			          << "'. Using the SPH kernel." << std::endl;
+		}
+	}
+
+	// Select the method of the particle-to-grid transfer
+	const std::string p2g_method = cfg.getParticleToGridMethod();
+	if (p2g_method == "gather") {
+		p2g_method_ = P2G_METHOD_GATHER;
+	} else {
+		p2g_method_ = P2G_METHOD_SCATTER;
+		if (p2g_method != "scatter") {
+			std::cout << "*** Warning: unknown particle-to-grid method '" << p2g_method
+			          << "'. Using scatter." << std::endl;
+		}
+	}
+
+	// Select the periodic sorting of the particles
+	particle_sort_interval_ = std::max(0, cfg.getParticleSortInterval());
+	const std::string sort_order = cfg.getParticleSortOrder();
+	if (sort_order == "cell") {
+		particle_sort_order_ = Particles::SORT_CELL;
+	} else {
+		particle_sort_order_ = Particles::SORT_MORTON;
+		if (sort_order != "morton") {
+			std::cout << "*** Warning: unknown particle sort order '" << sort_order
+			          << "'. Using Morton order." << std::endl;
+		}
+	}
+
+	// Select the width of the velocity extrapolation (at most 254 layers, 255
+	// flags the faces without a velocity)
+	extrapolation_layers_ = std::min(std::max(0, cfg.getExtrapolationLayers()), 254);
+	last_num_substeps_ = 1;
+	ghost_fields_current_ = false;
+	u_max_ = v_max_ = w_max_ = 0.;
+	extrapolation_layer_.resize(std::max({MACGrid_->get_num_faces(Mac3d::GRID_U), MACGrid_->get_num_faces(Mac3d::GRID_V),
+	                                      MACGrid_->get_num_faces(Mac3d::GRID_W)}));
+	extrapolation_row_layer_.resize(std::max({ny*nz, (ny+1)*nz, ny*(nz+1)}));
+	extrapolation_new_faces_.resize(num_threads_);
 
 #ifdef WRITE_REFERENCE
 	ncWriter_ = new NcWriter( "./ref.nc", 
@@ -48,6 +180,9 @@ FLIP::FLIP(Particles& particles, Mac3d* MACGrid, const SimConfig& cfg)
 
 FLIP::~FLIP(){
     delete [] d_;
+    delete [] p_;
+    delete [] pressure_old_;
+    delete [] fluid_age_;
 
 #ifdef WRITE_REFERENCE
 	delete ncWriter_;
@@ -58,6 +193,7 @@ FLIP::~FLIP(){
 /*** PERFORM ONE STEP ***/
 void FLIP::step_FLIP(double dt, unsigned long step) {
 	/** One FLIP step:
+	 * 0. Every particle_sort_interval_ steps, sort the particles by cell
 	 * 1. Compute velocity field (particle-to-grid transfer)
 	 *    - Particle-to-grid transfer
 	 *    - Classify cells (fluid/air)
@@ -77,6 +213,13 @@ void FLIP::step_FLIP(double dt, unsigned long step) {
 	if (step == WRITE_REFERENCE) ncWriter_->writeAll(0, particles_, MACGrid_);
 #endif
 
+	// 0.
+	if (particle_sort_interval_ > 0 and step % particle_sort_interval_ == 0) {
+		tsctimer.start_timing("sort_particles");
+		particles_.sort_by_cell(particle_sort_order_);
+		tsctimer.stop_timing("sort_particles", true, "");
+	}
+
 	// 1.
 	tsctimer.start_timing("particle_to_grid");
     particle_to_grid();
@@ -130,15 +273,14 @@ void FLIP::step_FLIP(double dt, unsigned long step) {
 	if (step == WRITE_REFERENCE) ncWriter_->writeAll(5, particles_, MACGrid_);
 #endif
 
-	// 6.
+	// 6. (from the maximal velocities found by grid_to_particle)
 	tsctimer.start_timing("advance_particles");
-	double dt_new = compute_timestep(dt);
+	double dt_new = compute_timestep(dt, u_max_, v_max_, w_max_);
 	double num_substeps = std::ceil(dt/dt_new);
-	for( int s = 0; s < num_substeps ; ++s ){
-		
-		// 7.
-		advance_particles(dt/num_substeps);
-	}
+	last_num_substeps_ = num_substeps;
+
+	// 7. (all substeps in one pass over the particles)
+	advance_particles(dt/num_substeps, num_substeps);
 	tsctimer.stop_timing("advance_particles", true, "");
 
 #ifdef WRITE_REFERENCE
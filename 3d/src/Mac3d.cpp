@@ -17,42 +17,79 @@ Mac3d::Mac3d(const unsigned n, const unsigned m, const unsigned l,
 
 void Mac3d::initArrays() {
     const unsigned chunk_size = 32;
-	ppressure_ = new (std::align_val_t(chunk_size)) double[N_*M_*L_];
-	std::fill(ppressure_, ppressure_+N_*M_*L_, 0.);
+	const index_t num_cells = get_num_cells();
+	const index_t num_faces_u = get_num_faces(GRID_U);
+	const index_t num_faces_v = get_num_faces(GRID_V);
+	const index_t num_faces_w = get_num_faces(GRID_W);
+	const index_t num_ghost_u = index_t(N_+3)*(M_+2)*(L_+2);
+	const index_t num_ghost_v = index_t(N_+2)*(M_+3)*(L_+2);
+	const index_t num_ghost_w = index_t(N_+2)*(M_+2)*(L_+3);
+	ppressure_ = new (std::align_val_t(chunk_size)) double[num_cells];
+	std::fill(ppressure_, ppressure_+num_cells, 0.);
+
+	pu_ = new (std::align_val_t(chunk_size)) real_t[num_faces_u];
+	std::fill(pu_, pu_+num_faces_u, 0.);
+
+	pu_star_ = new (std::align_val_t(chunk_size)) real_t[num_faces_u];
+	std::fill(pu_star_, pu_star_+num_faces_u, 0.);
+
+	pv_ = new (std::align_val_t(chunk_size)) real_t[num_faces_v];
+	std::fill(pv_, pv_+num_faces_v, 0.);
+
+	pv_star_ = new (std::align_val_t(chunk_size)) real_t[num_faces_v];
+	std::fill(pv_star_, pv_star_+num_faces_v, 0.);
+	
+	pw_ = new (std::align_val_t(chunk_size)) real_t[num_faces_w];
+	std::fill(pw_, pw_+num_faces_w, 0.);
+
+	pw_star_ = new (std::align_val_t(chunk_size)) real_t[num_faces_w];
+	std::fill(pw_star_, pw_star_+num_faces_w, 0.);
 
-	pu_ = new (std::align_val_t(chunk_size)) double[(N_+1)*M_*L_];
-	std::fill(pu_, pu_+(N_+1)*M_*L_, 0.);
+	psolid_ = new (std::align_val_t(chunk_size))bool[num_cells];
+	std::fill(psolid_, psolid_+num_cells, 0.);
 
-	pu_star_ = new (std::align_val_t(chunk_size)) double[(N_+1)*M_*L_];
-	std::fill(pu_star_, pu_star_+(N_+1)*M_*L_, 0.);
+	pfluid_ = new (std::align_val_t(chunk_size))bool[num_cells];
+	std::fill(pfluid_, pfluid_+num_cells, 0.);
 
-	pv_ = new (std::align_val_t(chunk_size))double[N_*(M_+1)*L_];
-	std::fill(pv_, pv_+N_*(M_+1)*L_, 0.);
+	pweights_u_ = new (std::align_val_t(chunk_size)) real_t[num_faces_u];
+	std::fill(pweights_u_, pweights_u_+num_faces_u, 0.);
 
-	pv_star_ = new (std::align_val_t(chunk_size))double[N_*(M_+1)*L_];
-	std::fill(pv_star_, pv_star_+N_*(M_+1)*L_, 0.);
+	pweights_v_ = new (std::align_val_t(chunk_size)) real_t[num_faces_v];
+	std::fill(pweights_v_, pweights_v_+num_faces_v, 0.);
 	
-	pw_ = new (std::align_val_t(chunk_size))double[N_*M_*(L_+1)];
-	std::fill(pw_, pw_+N_*M_*(L_+1), 0.);
+	pweights_w_ = new (std::align_val_t(chunk_size)) real_t[num_faces_w];
+	std::fill(pweights_w_, pweights_w_+num_faces_w, 0.);
 
-	pw_star_ = new (std::align_val_t(chunk_size))double[N_*M_*(L_+1)];
-	std::fill(pw_star_, pw_star_+N_*M_*(L_+1), 0.);
+	pvisited_u_ = new (std::align_val_t(chunk_size)) std::uint64_t[num_faces_u/64 + 1];
+	std::fill(pvisited_u_, pvisited_u_+num_faces_u/64 + 1, 0);
 
-	psolid_ = new (std::align_val_t(chunk_size))bool[N_*M_*L_];
-	std::fill(psolid_, psolid_+N_*M_*L_, 0.);
+	pvisited_v_ = new (std::align_val_t(chunk_size)) std::uint64_t[num_faces_v/64 + 1];
+	std::fill(pvisited_v_, pvisited_v_+num_faces_v/64 + 1, 0);
 
-	pfluid_ = new (std::align_val_t(chunk_size))bool[N_*M_*L_];
-	std::fill(pfluid_, pfluid_+N_*M_*L_, 0.);
+	pvisited_w_ = new (std::align_val_t(chunk_size)) std::uint64_t[num_faces_w/64 + 1];
+	std::fill(pvisited_w_, pvisited_w_+num_faces_w/64 + 1, 0);
 
-	pweights_u_ = new (std::align_val_t(chunk_size))double[(N_+1)*M_*L_];
-	std::fill(pweights_u_, pweights_u_+(N_+1)*M_*L_, 0.);
+	p2g_generation_ = 0;
+	prow_generation_ = new (std::align_val_t(chunk_size)) unsigned[(M_+1)*(L_+1)];
+	std::fill(prow_generation_, prow_generation_+(M_+1)*(L_+1), 0);
 
-	pweights_v_ = new (std::align_val_t(chunk_size))double[N_*(M_+1)*L_];
-	std::fill(pweights_v_, pweights_v_+N_*(M_+1)*L_, 0.);
-	
-	pweights_w_ = new(std::align_val_t(chunk_size)) double[N_*M_*(L_+1)];
-	std::fill(pweights_w_, pweights_w_+N_*M_*(L_+1), 0.);
+	pu_ghost_ = new (std::align_val_t(chunk_size)) real_t[num_ghost_u];
+	std::fill(pu_ghost_, pu_ghost_+num_ghost_u, 0.);
+
+	pv_ghost_ = new (std::align_val_t(chunk_size)) real_t[num_ghost_v];
+	std::fill(pv_ghost_, pv_ghost_+num_ghost_v, 0.);
+
+	pw_ghost_ = new (std::align_val_t(chunk_size)) real_t[num_ghost_w];
+	std::fill(pw_ghost_, pw_ghost_+num_ghost_w, 0.);
 
+	pu_blend_ghost_ = new (std::align_val_t(chunk_size)) real_t[num_ghost_u];
+	std::fill(pu_blend_ghost_, pu_blend_ghost_+num_ghost_u, 0.);
+
+	pv_blend_ghost_ = new (std::align_val_t(chunk_size)) real_t[num_ghost_v];
+	std::fill(pv_blend_ghost_, pv_blend_ghost_+num_ghost_v, 0.);
+
+	pw_blend_ghost_ = new (std::align_val_t(chunk_size)) real_t[num_ghost_w];
+	std::fill(pw_blend_ghost_, pw_blend_ghost_+num_ghost_w, 0.);
 }
 
 void Mac3d::initAdiag() {
@@ -237,8 +274,8 @@ unsigned Mac3d::get_num_cells_z() const {
 	return L_;
 }
 
-unsigned Mac3d::get_num_cells() const {
-	return M_*N_*L_;
+index_t Mac3d::get_num_cells() const {
+	return index_t(M_)*N_*L_;
 }
 
 double Mac3d::get_cell_sizex() const {
@@ -256,7 +293,7 @@ double Mac3d::get_cell_sizez() const {
 //2. Velocities --------------------------------------------------------
 double Mac3d::get_u(const unsigned i, const unsigned j, const unsigned k){
 	if (i < (N_+1) && j < M_ && k < L_)
-		return *(pu_ + (N_+1)*j + i + (N_+1)*M_*k);
+		return *(pu_ + (N_+1)*j + i + index_t(N_+1)*M_*k);
 	else{ 
 		std::cout << "Calling get_u: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 0;
@@ -268,7 +305,7 @@ double Mac3d::get_v(const unsigned i, const unsigned j, const unsigned k){
 	if (i < N_ && j < (M_+1) && k < L_) {
 		//if (i == 0 && j == 1 && k == 0)
 		//	std::cout << "-> " << N_ * j + i + N_ * (M_ + 1) * k << std::endl;
-		return *(pv_ + N_ * j + i + N_ * (M_ + 1) * k);
+		return *(pv_ + N_ * j + i + index_t(N_) * (M_ + 1) * k);
 	} else {
 		std::cout << "Calling get_v: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 0;
@@ -277,7 +314,7 @@ double Mac3d::get_v(const unsigned i, const unsigned j, const unsigned k){
 
 double Mac3d::get_w(const unsigned i, const unsigned j, const unsigned k){
 	if (i < N_ && j < M_ && k < (L_+1))
-		return *(pw_ + N_*j + i + N_*M_*k);
+		return *(pw_ + N_*j + i + index_t(N_)*M_*k);
 	else{ 
 		std::cout << "Calling get_w: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 0;
@@ -286,7 +323,7 @@ double Mac3d::get_w(const unsigned i, const unsigned j, const unsigned k){
 
 double Mac3d::get_u_star(const unsigned i, const unsigned j, const unsigned k) {
 	if (i < (N_+1) && j < M_ && k < L_)
-		return *(pu_star_ + (N_+1)*j + i + (N_+1)*M_*k);
+		return *(pu_star_ + (N_+1)*j + i + index_t(N_+1)*M_*k);
 	else{ 
 		std::cout << "Calling get_u_star: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 0;
@@ -295,7 +332,7 @@ double Mac3d::get_u_star(const unsigned i, const unsigned j, const unsigned k) {
 
 double Mac3d::get_v_star(const unsigned i, const unsigned j, const unsigned k) {
 	if (i < N_ && j < (M_+1) && k < L_)
-		return *(pv_star_ + N_*j + i + N_*(M_+1)*k);
+		return *(pv_star_ + N_*j + i + index_t(N_)*(M_+1)*k);
 	else{ 
 		std::cout << "Calling get_v_star: Index out (" << i << ", " << j << ", " << k << ") of bounds!" << std::endl;
 		return 0;
@@ -304,7 +341,7 @@ double Mac3d::get_v_star(const unsigned i, const unsigned j, const unsigned k) {
 
 double Mac3d::get_w_star(const unsigned i, const unsigned j, const unsigned k) {
 	if (i < N_ && j < M_ && k < (L_+1))
-		return *(pw_star_ + N_*j + i + N_*M_*k);
+		return *(pw_star_ + N_*j + i + index_t(N_)*M_*k);
 	else{ 
 		std::cout << "Calling get_w_star: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 0;
@@ -314,7 +351,7 @@ double Mac3d::get_w_star(const unsigned i, const unsigned j, const unsigned k) {
 //3. Pressures ---------------------------------------------------------
 double Mac3d::get_pressure(const unsigned i, const unsigned j, const unsigned k){
 	if (i < N_ && j < M_ && k < L_)
-		return *(ppressure_ + N_*j + i + N_*M_*k);
+		return *(ppressure_ + N_*j + i + index_t(N_)*M_*k);
 	else{ 
 		std::cout << "Calling get_pressure: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 0;
@@ -324,7 +361,7 @@ double Mac3d::get_pressure(const unsigned i, const unsigned j, const unsigned k)
 //4. Physical properties -----------------------------------------------
 bool Mac3d::is_solid(const unsigned i, const unsigned j, const unsigned k){
 	if (i < N_ && j < M_ && k < L_)
-		return *(psolid_ + N_*j + i + N_*M_*k);
+		return *(psolid_ + N_*j + i + index_t(N_)*M_*k);
 	else{ 
 		std::cout << "Calling is_solid: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 1;
@@ -333,7 +370,7 @@ bool Mac3d::is_solid(const unsigned i, const unsigned j, const unsigned k){
 
 bool Mac3d::is_fluid(const unsigned i, const unsigned j, const unsigned k) const{
 	if (i < N_ && j < M_ && k < L_)
-		return *(pfluid_ + N_*j + i + N_*M_*k);
+		return *(pfluid_ + N_*j + i + index_t(N_)*M_*k);
 	else{ 
 		std::cout << "Calling is_fluid: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 		return 0;
@@ -390,62 +427,62 @@ Eigen::Vector3d Mac3d::index_from_coord(const double x, const double y, const do
 //1. Velocities --------------------------------------------------------
 void Mac3d::set_u(const unsigned i, const unsigned j, const unsigned k, double value){
 	if (i < (N_+1) && j < M_ && k < L_)
-		*(pu_ + (N_+1)*j + i + (N_+1)*M_*k) = value;
+		*(pu_ + (N_+1)*j + i + index_t(N_+1)*M_*k) = value;
 	else
 		std::cout << "Calling set_u: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
 
 void Mac3d::set_v(const unsigned i, const unsigned j, const unsigned k, double value){
 	if (i < N_ && j < (M_+1) && k < L_)
-		*(pv_ + N_*j + i + N_*(M_+1)*k) = value;
+		*(pv_ + N_*j + i + index_t(N_)*(M_+1)*k) = value;
 	else
 		std::cout << "Calling set_v: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
 
 void Mac3d::set_w(const unsigned i, const unsigned j, const unsigned k, double value){
 	if (i < N_ && j < M_ && k < (L_+1))
-		*(pw_ + N_*j + i + N_*M_*k) = value;
+		*(pw_ + N_*j + i + index_t(N_)*M_*k) = value;
 	else
 		std::cout << "Calling set_w: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
 
 void Mac3d::set_u_star(const unsigned i, const unsigned j, const unsigned k, double value){
 	if (i < (N_+1) && j < M_ && k < L_)
-		*(pu_star_ + (N_+1)*j + i + (N_+1)*M_*k) = value;
+		*(pu_star_ + (N_+1)*j + i + index_t(N_+1)*M_*k) = value;
 	else
 		std::cout << "Calling set_u_star: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
 
 void Mac3d::set_v_star(const unsigned i, const unsigned j, const unsigned k, double value){
 	if (i < N_ && j < (M_+1) && k < L_)
-		*(pv_star_ + N_*j + i + N_*(M_+1)*k) = value;
+		*(pv_star_ + N_*j + i + index_t(N_)*(M_+1)*k) = value;
 	else
 		std::cout << "Calling set_v_star: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
 
 void Mac3d::set_w_star(const unsigned i, const unsigned j, const unsigned k, double value){
 	if (i < N_ && j < M_ && k < (L_+1))
-		*(pw_star_ + N_*j + i + N_*M_*k) = value;
+		*(pw_star_ + N_*j + i + index_t(N_)*M_*k) = value;
 	else
 		std::cout << "Calling set_w_star: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
 
 void Mac3d::set_uvw_star() {
-	std::copy(pu_, pu_ + (N_+1)*M_*L_, pu_star_);
-	std::copy(pv_, pv_ + N_*(M_+1)*L_, pv_star_);
-	std::copy(pw_, pw_ + N_*M_*(L_+1), pw_star_);
+	std::copy(pu_, pu_ + get_num_faces(GRID_U), pu_star_);
+	std::copy(pv_, pv_ + get_num_faces(GRID_V), pv_star_);
+	std::copy(pw_, pw_ + get_num_faces(GRID_W), pw_star_);
 }
 
 void Mac3d::set_velocities_to_zero(){
-	std::fill(pu_, pu_ + (N_+1)*M_*L_, 0);
-	std::fill(pv_, pv_ + N_*(M_+1)*L_, 0);
-	std::fill(pw_, pw_ + N_*M_*(L_+1), 0);
+	std::fill(pu_, pu_ + get_num_faces(GRID_U), 0);
+	std::fill(pv_, pv_ + get_num_faces(GRID_V), 0);
+	std::fill(pw_, pw_ + get_num_faces(GRID_W), 0);
 }
 
 //2. Pressures ---------------------------------------------------------
 void Mac3d::set_pressure(const unsigned i, const unsigned j, const unsigned k, double value){
 	if (i < N_ && j < M_ && k < L_)
-		*(ppressure_ + N_*j + i + N_*M_*k) = value;
+		*(ppressure_ + N_*j + i + index_t(N_)*M_*k) = value;
 	else
 		std::cout << "Calling set_pressure: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
@@ -457,14 +494,14 @@ void Mac3d::set_pressure(const Eigen::VectorXd& p) {
 //3. Physical properties -----------------------------------------------
 void Mac3d::set_solid(const unsigned i, const unsigned j, const unsigned k){
 	if (i < N_ && j < M_ && k < L_)
-		*(psolid_ + N_*j + i + N_*M_*k) = true;
+		*(psolid_ + N_*j + i + index_t(N_)*M_*k) = true;
 	else
 		std::cout << "Calling set_solid: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
 
 void Mac3d::set_fluid(const unsigned i, const unsigned j, const unsigned k){
 	if (i < N_ && j < M_ && k < L_)
-		*(pfluid_ + N_*j + i + N_*M_*k) = true;
+		*(pfluid_ + N_*j + i + index_t(N_)*M_*k) = true;
 	else
 		std::cout << "Calling set_fluid: Index (" << i << ", " << j << ", " << k << ") out of bounds!" << std::endl;
 }
@@ -473,9 +510,52 @@ void Mac3d::reset_fluid() {
 	std::fill(pfluid_, pfluid_ + get_num_cells(), false);
 }
 
+void Mac3d::begin_accumulation() {
+	std::fill(pvisited_u_, pvisited_u_ + get_num_faces(GRID_U)/64 + 1, 0);
+	std::fill(pvisited_v_, pvisited_v_ + get_num_faces(GRID_V)/64 + 1, 0);
+	std::fill(pvisited_w_, pvisited_w_ + get_num_faces(GRID_W)/64 + 1, 0);
+
+	// On wrap-around, generation 0 could be mistaken for a touched row
+	if (++p2g_generation_ == 0) {
+		std::fill(prow_generation_, prow_generation_ + (M_+1)*(L_+1), 0);
+		p2g_generation_ = 1;
+	}
+}
+
+void Mac3d::fill_ghost_field(const real_t* g, const real_t* g_star, const double coeff, real_t* g_ghost,
+                             const cellIdx_t n, const cellIdx_t m, const cellIdx_t l, const int num_threads) {
+	#pragma omp parallel for schedule(static) num_threads(num_threads) if(num_threads > 1)
+	for (cellIdx_t k = -1; k <= l; ++k) {
+		for (cellIdx_t j = -1; j <= m; ++j) {
+			// the ghost rows repeat the nearest row of g
+			const globalCellIdx_t row = n * globalCellIdx_t(std::min(std::max(j, 0), m-1) + m * std::min(std::max(k, 0), l-1));
+			real_t* row_ghost = g_ghost + (n+2) * globalCellIdx_t((j+1) + (m+2) * (k+1));
+			if (g_star == nullptr) {
+				std::copy(g + row, g + row + n, row_ghost + 1);
+			} else {
+				for (cellIdx_t i = 0; i < n; ++i) row_ghost[i+1] = g[row + i] - coeff * g_star[row + i];
+			}
+			row_ghost[0] = row_ghost[1];
+			row_ghost[n+1] = row_ghost[n];
+		}
+	}
+}
+
+void Mac3d::update_ghost_fields(const int num_threads) {
+	fill_ghost_field(pu_, nullptr, 0., pu_ghost_, N_+1, M_, L_, num_threads);
+	fill_ghost_field(pv_, nullptr, 0., pv_ghost_, N_, M_+1, L_, num_threads);
+	fill_ghost_field(pw_, nullptr, 0., pw_ghost_, N_, M_, L_+1, num_threads);
+}
+
+void Mac3d::update_blend_ghost_fields(const double coeff, const int num_threads) {
+	fill_ghost_field(pu_, pu_star_, coeff, pu_blend_ghost_, N_+1, M_, L_, num_threads);
+	fill_ghost_field(pv_, pv_star_, coeff, pv_blend_ghost_, N_, M_+1, L_, num_threads);
+	fill_ghost_field(pw_, pw_star_, coeff, pw_blend_ghost_, N_, M_, L_+1, num_threads);
+}
+
 void Mac3d::set_weights_to_zero(){
-	std::fill(pweights_u_, pweights_u_ + (N_+1)*M_*L_, 0);
-	std::fill(pweights_v_, pweights_v_ + N_*(M_+1)*L_, 0);
-	std::fill(pweights_w_, pweights_w_ + N_*M_*(L_+1), 0);
+	std::fill(pweights_u_, pweights_u_ + get_num_faces(GRID_U), 0);
+	std::fill(pweights_v_, pweights_v_ + get_num_faces(GRID_V), 0);
+	std::fill(pweights_w_, pweights_w_ + get_num_faces(GRID_W), 0);
 }
 
@@ -29,10 +29,10 @@ MeshExporter::MeshExporter(Mac3d* Grid, Particles& particles)
 	
 	//Grid properties
 	//Initialization of the list points_
-	const int s_sup = (N+2)*(M+2)*(L+2);
+	const Mac3d::globalCellIdx_t s_sup = Mac3d::globalCellIdx_t(N+2)*(M+2)*(L+2);
 	points_d = new double[3*s_sup];
 	//x_avrg_num_array is a matrix of N*M*L 3-vectors. it is in row-major format
-	x_avrg_num_array = new double[3*N*M*L];
+	x_avrg_num_array = new double[3*Mac3d::globalCellIdx_t(N)*M*L];
 	plevel_set_array = new double[s_sup];
 	const double p_level_init = 0.5*dx;
 
@@ -45,7 +45,7 @@ MeshExporter::MeshExporter(Mac3d* Grid, Particles& particles)
 		for(int k = 0; k < L+2; ++k){
 			for(int j = 0; j < M+2; ++j){
 				for(int i = 0; i < N+2; ++i){
-					int index = i + j*s_sm + k*s_sm*s_bg;
+					Mac3d::globalCellIdx_t index = i + s_sm*Mac3d::globalCellIdx_t(j + k*s_bg);
 					points_d[index] = (i-1) * dx;
 					points_d[index+s_sup] = (j-1) * dy;
 					points_d[index+2*s_sup] = (k-1) * dz;
@@ -55,7 +55,7 @@ MeshExporter::MeshExporter(Mac3d* Grid, Particles& particles)
 		}
 	}
 	
-	den = new double[N*M*L];
+	den = new double[Mac3d::globalCellIdx_t(N)*M*L];
 
 	// Create directory if it doesn't exist
 	mkdir(folder_.c_str(), ACCESSPERMS);
@@ -71,7 +71,7 @@ void MeshExporter::level_set_easy(){
 	for(int i = 0;i < N; ++i){
 		for(int j = 0; j < M; ++j){
 			for(int k = 0; k < L; ++k){
-				int index = i + j*N + k*N*M;
+				Mac3d::globalCellIdx_t index = i + N*Mac3d::globalCellIdx_t(j + k*M);
 				if(pMacGrid_->is_fluid(i,j,k))
 					plevel_set_array[index] = -1;
 				else
@@ -85,12 +85,12 @@ void MeshExporter::level_set(){
 	tsc::TSCTimer& tsctimer = tsc::TSCTimer::get_timer("timings.json");
 	//Grid properties
 	//Initialization of plevel_set_aArray, x_avrg_num and den
-	std::fill(x_avrg_num_array, x_avrg_num_array+3*N*M*L, 0);
-	std::fill(den, den+N*M*L, 0);
+	std::fill(x_avrg_num_array, x_avrg_num_array+3*Mac3d::globalCellIdx_t(N)*M*L, 0);
+	std::fill(den, den+Mac3d::globalCellIdx_t(N)*M*L, 0);
 
 	//Compute the values of x_avrg_num and den
 	tsctimer.start_timing("first_part");
-	for(unsigned it_particle = 0; it_particle < num_particles_; ++it_particle){
+	for(Particles::particleIdx_t it_particle = 0; it_particle < num_particles_; ++it_particle){
 		//const Particle& particle = *(particles_ + it_particle);
 		double particle_x = particles_.x[it_particle];
 		double particle_y = particles_.y[it_particle];
@@ -117,7 +117,7 @@ void MeshExporter::level_set(){
 		for(int k = std::max(0, init_cell_z - 2); k < k_max; ++k){
 			for(int j = std::max(0, init_cell_y - 2); j < j_max; ++j){
 				for(int i = std::max(0, init_cell_x - 2); i < i_max; ++i){
-					const int index = i + j*N + k*N*M;
+					const Mac3d::globalCellIdx_t index = i + N*Mac3d::globalCellIdx_t(j + k*M);
 					const double dist_x = i*dx - particle_x;
 					const double dist_y = j*dy - particle_y;
 					const double dist_z = k*dz - particle_z;
@@ -141,8 +141,8 @@ void MeshExporter::level_set(){
 	for(int k = 0; k < L; ++k){
 		for(int j = 0; j < M; ++j){
 			for(int i = 0; i < N; ++i){
-				int index = (i+1) + (j+1)*(N+2) + (k+1)*(N+2)*(M+2);
-					int index2 = i + j*N + k*N*M;
+				Mac3d::globalCellIdx_t index = (i+1) + (N+2)*Mac3d::globalCellIdx_t((j+1) + (k+1)*(M+2));
+					Mac3d::globalCellIdx_t index2 = i + N*Mac3d::globalCellIdx_t(j + k*M);
 					const double denominator_inv = 1.0/ *(den+index2);
 					const double x_avrg_x = x_avrg_num_array[index2*3  ] * denominator_inv;
 					const double x_avrg_y = x_avrg_num_array[index2*3+1] * denominator_inv;
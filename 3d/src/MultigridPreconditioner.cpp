@@ -0,0 +1,299 @@
+#include "MultigridPreconditioner.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+
+MultigridPreconditioner::MultigridPreconditioner(const Mac3d& grid, int num_threads)
+	: grid(grid), num_threads(parallel::resolve_num_threads(num_threads)) {
+
+	const unsigned chunk_size = 32;
+	unsigned nx = grid.get_num_cells_x();
+	unsigned ny = grid.get_num_cells_y();
+	unsigned nz = grid.get_num_cells_z();
+
+	// Create levels until the grid is too small to be coarsened further
+	while (true) {
+		const index_t n = index_t(nx)*ny*nz;
+		Level level;
+		level.nx = nx;
+		level.ny = ny;
+		level.nz = nz;
+		level.type = new (std::align_val_t(chunk_size)) unsigned char[n];
+		level.diag = new (std::align_val_t(chunk_size)) double[n];
+		level.diag_inv = new (std::align_val_t(chunk_size)) double[n];
+		level.r = new (std::align_val_t(chunk_size)) double[n];
+		if (levels.empty()) {
+			level.x = nullptr;
+			level.b = nullptr;
+			level.rhs = nullptr;
+		} else {
+			level.x = new (std::align_val_t(chunk_size)) double[n];
+			level.rhs = new (std::align_val_t(chunk_size)) double[n];
+			level.b = level.rhs;
+		}
+		levels.push_back(level);
+
+		if (std::min({nx, ny, nz}) < min_coarsening_size) break;
+		nx = (nx + 1) / 2;
+		ny = (ny + 1) / 2;
+		nz = (nz + 1) / 2;
+	}
+}
+
+MultigridPreconditioner::~MultigridPreconditioner() {
+	for (unsigned l = 0; l < levels.size(); ++l) {
+		delete[] levels[l].type;
+		delete[] levels[l].diag;
+		delete[] levels[l].diag_inv;
+		delete[] levels[l].r;
+		if (l > 0) {
+			delete[] levels[l].x;
+			delete[] levels[l].rhs;
+		}
+	}
+}
+
+void MultigridPreconditioner::update() {
+
+	// Finest level: cell types from the grid, diagonal of the pressure matrix
+	Level& fine = levels[0];
+	const index_t n = index_t(fine.nx) * fine.ny * fine.nz;
+	#pragma omp parallel for schedule(static) num_threads(num_threads) if(num_threads > 1)
+	for (index_t c = 0; c < n; ++c) {
+		if (grid.pfluid_[c]) fine.type[c] = CELL_FLUID;
+		else if (grid.psolid_[c]) fine.type[c] = CELL_SOLID;
+		else fine.type[c] = CELL_AIR;
+
+		fine.diag[c] = grid.A_diag_val[c];
+		fine.diag_inv[c] = (fine.type[c] == CELL_FLUID && fine.diag[c] > 0) ? 1. / fine.diag[c] : 0.;
+	}
+
+	// Coarse levels: merge 2x2x2 blocks of the next finer level
+	for (unsigned l = 1; l < levels.size(); ++l) {
+		const Level& f = levels[l-1];
+		Level& c = levels[l];
+
+		#pragma omp parallel for collapse(2) schedule(static) num_threads(num_threads) if(num_threads > 1)
+		for (unsigned k = 0; k < c.nz; ++k) {
+			for (unsigned j = 0; j < c.ny; ++j) {
+				for (unsigned i = 0; i < c.nx; ++i) {
+					bool has_air = false;
+					bool has_fluid = false;
+					for (unsigned fk = 2*k; fk < std::min(2*k+2, f.nz); ++fk) {
+						for (unsigned fj = 2*j; fj < std::min(2*j+2, f.ny); ++fj) {
+							for (unsigned fi = 2*i; fi < std::min(2*i+2, f.nx); ++fi) {
+								const unsigned char t = f.type[fi + f.nx*index_t(fj + f.ny*fk)];
+								has_air |= (t == CELL_AIR);
+								has_fluid |= (t == CELL_FLUID);
+							}
+						}
+					}
+					const index_t cellidx = i + c.nx*index_t(j + c.ny*k);
+					c.type[cellidx] = has_air ? CELL_AIR : (has_fluid ? CELL_FLUID : CELL_SOLID);
+				}
+			}
+		}
+
+		// Diagonal: number of non-solid neighbours inside the domain, as in Mac3d::initAdiag
+		#pragma omp parallel for collapse(2) schedule(static) num_threads(num_threads) if(num_threads > 1)
+		for (unsigned k = 0; k < c.nz; ++k) {
+			for (unsigned j = 0; j < c.ny; ++j) {
+				for (unsigned i = 0; i < c.nx; ++i) {
+					const index_t cellidx = i + c.nx*index_t(j + c.ny*k);
+					const unsigned sy = c.nx;
+					const index_t sz = index_t(c.nx)*c.ny;
+					int count = 0;
+					if (i > 0      && c.type[cellidx-1]  != CELL_SOLID) count++;
+					if (i+1 < c.nx && c.type[cellidx+1]  != CELL_SOLID) count++;
+					if (j > 0      && c.type[cellidx-sy] != CELL_SOLID) count++;
+					if (j+1 < c.ny && c.type[cellidx+sy] != CELL_SOLID) count++;
+					if (k > 0      && c.type[cellidx-sz] != CELL_SOLID) count++;
+					if (k+1 < c.nz && c.type[cellidx+sz] != CELL_SOLID) count++;
+					c.diag[cellidx] = count;
+					c.diag_inv[cellidx] = (c.type[cellidx] == CELL_FLUID && count > 0) ? 1. / count : 0.;
+				}
+			}
+		}
+	}
+}
+
+void MultigridPreconditioner::apply(const double* r, double* z) {
+	levels[0].b = r;
+	levels[0].x = z;
+	vcycle(0);
+}
+
+void MultigridPreconditioner::vcycle(const unsigned l) {
+	Level& level = levels[l];
+	const index_t n = index_t(level.nx) * level.ny * level.nz;
+
+	// zero initial guess
+	#pragma omp parallel for schedule(static) num_threads(num_threads) if(num_threads > 1)
+	for (index_t c = 0; c < n; ++c) level.x[c] = 0;
+
+	// Coarsest level: solve approximately by symmetric smoothing
+	if (l + 1 == levels.size()) {
+		for (unsigned s = 0; s < num_bottom_sweeps; ++s) {
+			smooth(level, 0);
+			smooth(level, 1);
+		}
+		for (unsigned s = 0; s < num_bottom_sweeps; ++s) {
+			smooth(level, 1);
+			smooth(level, 0);
+		}
+		return;
+	}
+
+	// Pre-smoothing: red then black
+	for (unsigned s = 0; s < num_smoothing_sweeps; ++s) {
+		smooth(level, 0);
+		smooth(level, 1);
+	}
+
+	// Coarse grid correction
+	computeResidual(level);
+	restrictResidual(level, levels[l+1]);
+	vcycle(l+1);
+	prolongateCorrection(levels[l+1], level);
+
+	// Post-smoothing: black then red
+	for (unsigned s = 0; s < num_smoothing_sweeps; ++s) {
+		smooth(level, 1);
+		smooth(level, 0);
+	}
+}
+
+// Gauss-Seidel sweep over all fluid cells with (i+j+k) % 2 == colour
+void MultigridPreconditioner::smooth(Level& level, const unsigned colour) const {
+	const unsigned nx = level.nx, ny = level.ny, nz = level.nz;
+	const unsigned sy = nx;
+	const index_t sz = index_t(nx)*ny;
+	const unsigned char* const type = level.type;
+	const double* const b = level.b;
+	double* const x = level.x;
+
+	#pragma omp parallel for collapse(2) schedule(static) num_threads(num_threads) if(num_threads > 1)
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny; ++j) {
+			for (unsigned i = (j + k + colour) & 1; i < nx; i += 2) {
+				const index_t cellidx = i + sy*j + sz*k;
+				if (type[cellidx] != CELL_FLUID) continue;
+
+				double t = b[cellidx];
+				if (i > 0    && type[cellidx-1]  == CELL_FLUID) t += x[cellidx-1];
+				if (i+1 < nx && type[cellidx+1]  == CELL_FLUID) t += x[cellidx+1];
+				if (j > 0    && type[cellidx-sy] == CELL_FLUID) t += x[cellidx-sy];
+				if (j+1 < ny && type[cellidx+sy] == CELL_FLUID) t += x[cellidx+sy];
+				if (k > 0    && type[cellidx-sz] == CELL_FLUID) t += x[cellidx-sz];
+				if (k+1 < nz && type[cellidx+sz] == CELL_FLUID) t += x[cellidx+sz];
+				x[cellidx] = t * level.diag_inv[cellidx];
+			}
+		}
+	}
+}
+
+// r <- b - A x
+void MultigridPreconditioner::computeResidual(Level& level) const {
+	const unsigned nx = level.nx, ny = level.ny, nz = level.nz;
+	const unsigned sy = nx;
+	const index_t sz = index_t(nx)*ny;
+	const unsigned char* const type = level.type;
+	const double* const x = level.x;
+
+	#pragma omp parallel for collapse(2) schedule(static) num_threads(num_threads) if(num_threads > 1)
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny; ++j) {
+			for (unsigned i = 0; i < nx; ++i) {
+				const index_t cellidx = i + sy*j + sz*k;
+				if (type[cellidx] != CELL_FLUID) {
+					level.r[cellidx] = 0;
+					continue;
+				}
+
+				double t = level.b[cellidx] - level.diag[cellidx] * x[cellidx];
+				if (i > 0    && type[cellidx-1]  == CELL_FLUID) t += x[cellidx-1];
+				if (i+1 < nx && type[cellidx+1]  == CELL_FLUID) t += x[cellidx+1];
+				if (j > 0    && type[cellidx-sy] == CELL_FLUID) t += x[cellidx-sy];
+				if (j+1 < ny && type[cellidx+sy] == CELL_FLUID) t += x[cellidx+sy];
+				if (k > 0    && type[cellidx-sz] == CELL_FLUID) t += x[cellidx-sz];
+				if (k+1 < nz && type[cellidx+sz] == CELL_FLUID) t += x[cellidx+sz];
+				level.r[cellidx] = t;
+			}
+		}
+	}
+}
+
+// 1D weights of trilinear interpolation between cell centers of two levels:
+// fine cell 2I+a receives weight w[a+1] of coarse cell I, a = -1, 0, 1, 2
+static const double transfer_weights[4] = {0.25, 0.75, 0.75, 0.25};
+
+// Restriction is the transpose of the prolongation, scaled by 1/2.
+// The coarse operator is the 7-point stencil on cells of twice the size and is
+// not divided by the squared cell size, so it corresponds to 4 times the fine
+// operator. The transpose of the prolongation sums the residual of 8 fine cells,
+// half of that gives 4 times their average.
+void MultigridPreconditioner::restrictResidual(const Level& fine, Level& coarse) const {
+	#pragma omp parallel for collapse(2) schedule(static) num_threads(num_threads) if(num_threads > 1)
+	for (unsigned k = 0; k < coarse.nz; ++k) {
+		for (unsigned j = 0; j < coarse.ny; ++j) {
+			for (unsigned i = 0; i < coarse.nx; ++i) {
+				const index_t cellidx = i + coarse.nx*index_t(j + coarse.ny*k);
+				if (coarse.type[cellidx] != CELL_FLUID) {
+					coarse.rhs[cellidx] = 0;
+					continue;
+				}
+
+				double sum = 0;
+				for (int c = -1; c <= 2; ++c) {
+					const int fk = 2*k + c;
+					if (fk < 0 || fk >= (int) fine.nz) continue;
+					for (int b = -1; b <= 2; ++b) {
+						const int fj = 2*j + b;
+						if (fj < 0 || fj >= (int) fine.ny) continue;
+						const double w_jk = transfer_weights[b+1] * transfer_weights[c+1];
+						const double* const r_row = fine.r + fine.nx*index_t(fj + fine.ny*fk);
+						for (int a = -1; a <= 2; ++a) {
+							const int fi = 2*i + a;
+							if (fi < 0 || fi >= (int) fine.nx) continue;
+							sum += w_jk * transfer_weights[a+1] * r_row[fi];
+						}
+					}
+				}
+				coarse.rhs[cellidx] = 0.5 * sum;
+			}
+		}
+	}
+}
+
+// x_fine <- x_fine + P x_coarse (trilinear interpolation)
+void MultigridPreconditioner::prolongateCorrection(const Level& coarse, Level& fine) const {
+	#pragma omp parallel for collapse(2) schedule(static) num_threads(num_threads) if(num_threads > 1)
+	for (unsigned k = 0; k < fine.nz; ++k) {
+		for (unsigned j = 0; j < fine.ny; ++j) {
+			for (unsigned i = 0; i < fine.nx; ++i) {
+				const index_t cellidx = i + fine.nx*index_t(j + fine.ny*k);
+				if (fine.type[cellidx] != CELL_FLUID) continue;
+
+				// parent cell and its neighbour closest to the fine cell center
+				const int ci[2] = {(int) i/2, (int) i/2 + ((i & 1) ? 1 : -1)};
+				const int cj[2] = {(int) j/2, (int) j/2 + ((j & 1) ? 1 : -1)};
+				const int ck[2] = {(int) k/2, (int) k/2 + ((k & 1) ? 1 : -1)};
+				const double w[2] = {0.75, 0.25};
+
+				double sum = 0;
+				for (int c = 0; c < 2; ++c) {
+					if (ck[c] < 0 || ck[c] >= (int) coarse.nz) continue;
+					for (int b = 0; b < 2; ++b) {
+						if (cj[b] < 0 || cj[b] >= (int) coarse.ny) continue;
+						for (int a = 0; a < 2; ++a) {
+							if (ci[a] < 0 || ci[a] >= (int) coarse.nx) continue;
+							sum += w[a] * w[b] * w[c] * coarse.x[ci[a] + coarse.nx*index_t(cj[b] + coarse.ny*ck[c])];
+						}
+					}
+				}
+				fine.x[cellidx] += sum;
+			}
+		}
+	}
+}
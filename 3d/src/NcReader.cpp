@@ -12,8 +12,8 @@ NcReader::NcReader( const std::string& filePath, const std::string& cfgPath ):
 	timestep      = readScalar<unsigned>("timestep");
 
 	MACGrid   = new Mac3d(_n, _m, _l, _dx, _dy, _dz);
-	particles = new Particles(num_particles, *MACGrid);
-	referenceParticles = new Particles(num_particles, *MACGrid);
+	particles = new Particles(num_particles, *MACGrid, cfg.getNumThreads());
+	referenceParticles = new Particles(num_particles, *MACGrid, cfg.getNumThreads());
 
 	unsigned cacheBlockSize = 64;
 	uMAC  = (double*) aligned_alloc(cacheBlockSize, (_n+1) * _m * _l * sizeof(double));
@@ -48,12 +48,14 @@ NcReader::~NcReader(){
 
 void NcReader::toFlipStructures(){
 
-	std::copy(referenceParticles->x, referenceParticles->x + num_particles, particles->x);
-	std::copy(referenceParticles->y, referenceParticles->y + num_particles, particles->y);
-	std::copy(referenceParticles->z, referenceParticles->z + num_particles, particles->z);
-	std::copy(referenceParticles->u, referenceParticles->u + num_particles, particles->u);
-	std::copy(referenceParticles->v, referenceParticles->v + num_particles, particles->v);
-	std::copy(referenceParticles->w, referenceParticles->w + num_particles, particles->w);
+	for(unsigned i = 0; i < num_particles; ++i){
+		particles->x[i] = referenceParticles->x[i];
+		particles->y[i] = referenceParticles->y[i];
+		particles->z[i] = referenceParticles->z[i];
+		particles->u[i] = referenceParticles->u[i];
+		particles->v[i] = referenceParticles->v[i];
+		particles->w[i] = referenceParticles->w[i];
+	}
 
 	for(int i = 0; i < _n+1; ++i){
 		for(int j = 0; j < _m+1; ++j){
@@ -123,104 +125,61 @@ void NcReader::outputMessage( const bool flag, const std::string& varName, const
 }
 
 
-void NcReader::validate(){
+std::vector<NcReader::VarError> NcReader::computeErrors(){
 
-	double tol = 1e-11;
-	double maxErrX     = 0.;
-	double maxErrY     = 0.;
-	double maxErrZ     = 0.;
-	double maxErrU     = 0.;
-	double maxErrV     = 0.;
-	double maxErrW     = 0.;
-	double maxErrUMAC  = 0.;
-	double maxErrVMAC  = 0.;
-	double maxErrWMAC  = 0.;
-	double maxErrUStar = 0.;
-	double maxErrVStar = 0.;
-	double maxErrWStar = 0.;
-	double maxErrPMAC  = 0.;
-
-	bool fFlag = true;
-	bool sFlag = true;
+	std::vector<VarError> errors;
 
-	for(unsigned i = 0; i < num_particles; ++i){
-		maxErrX = std::max(maxErrX, std::abs(rErr(referenceParticles->x[i], particles->x[i])));
-		maxErrY = std::max(maxErrY, std::abs(rErr(referenceParticles->y[i], particles->y[i])));
-		maxErrZ = std::max(maxErrZ, std::abs(rErr(referenceParticles->z[i], particles->z[i])));
-		maxErrU = std::max(maxErrU, std::abs(rErr(referenceParticles->u[i], particles->u[i])));
-		maxErrV = std::max(maxErrV, std::abs(rErr(referenceParticles->v[i], particles->v[i])));
-		maxErrW = std::max(maxErrW, std::abs(rErr(referenceParticles->w[i], particles->w[i])));
-	}
+	// Accumulate the errors of the values get(i) against the reference ref[i]
+	auto compare = [&](const std::string& varName, const unsigned size, const auto& ref, auto get){
+		VarError err = {varName, 0., 0.};
+		double maxDiff = 0.;
+		double maxRef  = 0.;
+		for(unsigned i = 0; i < size; ++i){
+			const double value = get(i);
+			err.maxRelErr = std::max(err.maxRelErr, std::abs(rErr(ref[i], value)));
+			maxDiff = std::max(maxDiff, std::abs(value - ref[i]));
+			maxRef  = std::max(maxRef, std::abs(double(ref[i])));
+		}
+		err.maxNormErr = (maxRef > 0.) ? maxDiff / maxRef : maxDiff;
+		errors.push_back(err);
+	};
+
+	compare("x", num_particles, referenceParticles->x, [&](unsigned i){ return particles->x[i]; });
+	compare("y", num_particles, referenceParticles->y, [&](unsigned i){ return particles->y[i]; });
+	compare("z", num_particles, referenceParticles->z, [&](unsigned i){ return particles->z[i]; });
+	compare("u", num_particles, referenceParticles->u, [&](unsigned i){ return particles->u[i]; });
+	compare("v", num_particles, referenceParticles->v, [&](unsigned i){ return particles->v[i]; });
+	compare("w", num_particles, referenceParticles->w, [&](unsigned i){ return particles->w[i]; });
+
+	// The faces of the reference arrays are ordered as in Mac3d
+	compare("uMAC",  (_n+1)*_m*_l, uMAC,  [&](unsigned i){ return MACGrid->pu_[i]; });
+	compare("vMAC",  _n*(_m+1)*_l, vMAC,  [&](unsigned i){ return MACGrid->pv_[i]; });
+	compare("wMAC",  _n*_m*(_l+1), wMAC,  [&](unsigned i){ return MACGrid->pw_[i]; });
+	compare("uStar", (_n+1)*_m*_l, uStar, [&](unsigned i){ return MACGrid->pu_star_[i]; });
+	compare("vStar", _n*(_m+1)*_l, vStar, [&](unsigned i){ return MACGrid->pv_star_[i]; });
+	compare("wStar", _n*_m*(_l+1), wStar, [&](unsigned i){ return MACGrid->pw_star_[i]; });
+	compare("pMAC",  _n*_m*_l,     pMAC,  [&](unsigned i){ return MACGrid->ppressure_[i]; });
+
+	// The flags are either equal (0) or not (1)
+	compare("fluid_cells", _n*_m*_l, fluid_cells, [&](unsigned i){ return double(MACGrid->pfluid_[i]); });
+	compare("solid_cells", _n*_m*_l, solid_cells, [&](unsigned i){ return double(MACGrid->psolid_[i]); });
+
+	return errors;
+}
 
-	for(int i = 0; i < _n+1; ++i){
-		for(int j = 0; j < _m+1; ++j){
-			for(int k = 0; k < _l+1; ++k){
 
-				if( j < _m && k < _l ){
-					maxErrUMAC  = std::max(maxErrUMAC,  std::abs(rErr(uMAC [i + (_n+1) * j + (_n+1) *  _m    * k], MACGrid->get_u(i, j, k))));
-					maxErrUStar = std::max(maxErrUStar, std::abs(rErr(uStar[i + (_n+1) * j + (_n+1) *  _m    * k], MACGrid->get_u_star(i, j, k))));
-				}
-				if( i < _n && k < _l ){
-					maxErrVMAC  = std::max(maxErrVMAC,  std::abs(rErr(vMAC [i +  _n    * j +  _n    * (_m+1) * k], MACGrid->get_v(i, j, k))));
-					maxErrVStar = std::max(maxErrVStar, std::abs(rErr(vStar[i +  _n    * j +  _n    * (_m+1) * k], MACGrid->get_v_star(i, j, k))));
-				}
-				if( i < _n && j < _m ){
-					maxErrWMAC  = std::max(maxErrWMAC,  std::abs(rErr(wMAC [i +  _n    * j +  _n    *  _m    * k], MACGrid->get_w(i, j, k))));
-					maxErrWStar = std::max(maxErrWStar, std::abs(rErr(wStar[i +  _n    * j +  _n    *  _m    * k], MACGrid->get_w_star(i, j, k))));
-				}
-				
-				if( i < _n && j < _m && k < _l ) {
-					maxErrPMAC  = std::max(maxErrPMAC,  std::abs(rErr(pMAC [i +  _n    * j +  _n    *  _m    * k], MACGrid->get_pressure(i, j, k))));
-					fFlag = fFlag && (fluid_cells[i + _n*j + _n*_m*k] == MACGrid->is_fluid(i, j, k));
-					sFlag = sFlag && (solid_cells[i + _n*j + _n*_m*k] == MACGrid->is_solid(i, j, k));
-				}
-			}
-		}
+void NcReader::validate(){
+
+	double tol = 1e-11;
+	bool valid = true;
+
+	for(const VarError& err : computeErrors()){
+		const bool flag = err.maxRelErr < tol;
+		outputMessage(flag, err.varName, err.maxRelErr, tol);
+		valid = valid && flag;
 	}
 
-	bool xFlag     = maxErrX < tol;
-	bool yFlag     = maxErrY < tol;
-	bool zFlag     = maxErrZ < tol;
-	bool uFlag     = maxErrU < tol;
-	bool vFlag     = maxErrV < tol;
-	bool wFlag     = maxErrW < tol;
-	bool uMACFlag  = maxErrUMAC < tol;
-	bool vMACFlag  = maxErrVMAC < tol;
-	bool wMACFlag  = maxErrWMAC < tol;
-	bool uStarFlag = maxErrUStar < tol;
-	bool vStarFlag = maxErrVStar < tol;
-	bool wStarFlag = maxErrWStar < tol;
-	bool pMACFlag  = maxErrPMAC < tol;
-
-	outputMessage(xFlag,     "x",     maxErrX,     tol);
-	outputMessage(yFlag,     "y",     maxErrY,     tol);
-	outputMessage(zFlag,     "z",     maxErrZ,     tol);
-	outputMessage(uFlag,     "u",     maxErrU,     tol);
-	outputMessage(vFlag,     "v",     maxErrV,     tol);
-	outputMessage(wFlag,     "w",     maxErrW,     tol);
-	outputMessage(uMACFlag,  "uMAC",  maxErrUMAC,  tol);
-	outputMessage(vMACFlag,  "vMAC",  maxErrVMAC,  tol);
-	outputMessage(wMACFlag,  "wMAC",  maxErrWMAC,  tol);
-	outputMessage(uStarFlag, "uStar", maxErrUStar, tol);
-	outputMessage(vStarFlag, "vStar", maxErrVStar, tol);
-	outputMessage(wStarFlag, "wStar", maxErrWStar, tol);
-	outputMessage(pMACFlag,  "pMAC",  maxErrPMAC,  tol);
-
-	assert(xFlag);
-	assert(yFlag);
-	assert(zFlag);
-	assert(uFlag);
-	assert(vFlag);
-	assert(wFlag);
-	assert(uMACFlag);
-	assert(vMACFlag);
-	assert(wMACFlag);
-	assert(uStarFlag);
-	assert(vStarFlag);
-	assert(wStarFlag);
-	assert(pMACFlag);
-	assert(fFlag);
-	assert(sFlag);
+	assert(valid);
 }
 
 
@@ -69,12 +69,12 @@ void NcWriter::writeAll( const unsigned breakPt,
 						 const Mac3d* const MACGrid )
 {
 
-	write(breakPt, "x", particles.x);
-	write(breakPt, "y", particles.y);
-	write(breakPt, "z", particles.z);
-	write(breakPt, "u", particles.u);
-	write(breakPt, "v", particles.v);
-	write(breakPt, "w", particles.w);
+	write(breakPt, "x", particles.x, particles.get_num_particles());
+	write(breakPt, "y", particles.y, particles.get_num_particles());
+	write(breakPt, "z", particles.z, particles.get_num_particles());
+	write(breakPt, "u", particles.u, particles.get_num_particles());
+	write(breakPt, "v", particles.v, particles.get_num_particles());
+	write(breakPt, "w", particles.w, particles.get_num_particles());
 	write(breakPt, "uMAC", MACGrid->pu_);
 	write(breakPt, "vMAC", MACGrid->pv_);
 	write(breakPt, "wMAC", MACGrid->pw_);
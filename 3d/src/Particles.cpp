@@ -1,33 +1,128 @@
 #include "Particles.h"
 
 #include <cstdlib>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
 
-Particles::Particles(Particles::particleIdx_t nParticles, const Mac3d &macGrid)
+Particles::Particles(Particles::particleIdx_t nParticles, const Mac3d &macGrid, int numThreads)
 		: rcell_size_x_(1.0 / macGrid.get_cell_sizex()), rcell_size_y_(1.0 / macGrid.get_cell_sizey()),
-		  rcell_size_z_(1.0 / macGrid.get_cell_sizez()), num_particles_(nParticles) {
-
-	x =  (double *) calloc(nParticles, sizeof(double));
-	y =  (double *) calloc(nParticles, sizeof(double));
-	z =  (double *) calloc(nParticles, sizeof(double));
-	u =  (double *) calloc(nParticles, sizeof(double));
-	v =  (double *) calloc(nParticles, sizeof(double));
-	w =  (double *) calloc(nParticles, sizeof(double));
-
-    /*
-    x =  new (std::align_val_t(32)) double [nParticles];
-    y =  new (std::align_val_t(32)) double [nParticles];
-    z =  new (std::align_val_t(32)) double [nParticles];
-    u =  new (std::align_val_t(32)) double [nParticles];
-    v =  new (std::align_val_t(32)) double [nParticles];
-    w =  new (std::align_val_t(32)) double [nParticles];
-    */
+		  rcell_size_z_(1.0 / macGrid.get_cell_sizez()), num_particles_(nParticles),
+		  num_padded_((nParticles + block_size - 1) / block_size * block_size),
+		  num_threads_(parallel::resolve_num_threads(numThreads)),
+		  num_cells_x_(macGrid.get_num_cells_x()), num_cells_y_(macGrid.get_num_cells_y()),
+		  num_cells_z_(macGrid.get_num_cells_z()) {
+
+	Component* const components[num_components] = {&x, &y, &z, &u, &v, &w};
+#ifdef WATERSIM_PARTICLES_AOSOA
+	storage_ = allocate_array(num_components);
+	for (unsigned c = 0; c < num_components; ++c) components[c]->base_ = storage_ + c * block_size;
+#else
+	for (unsigned c = 0; c < num_components; ++c) components[c]->base_ = allocate_array();
+#endif
 }
 
 Particles::~Particles() {
-	free(x);
-	free(y);
-	free(z);
-	free(u);
-	free(v);
-	free(w);
+#ifdef WATERSIM_PARTICLES_AOSOA
+	free(storage_);
+#else
+	for (Component* c : {&x, &y, &z, &u, &v, &w}) free(c->base_);
+#endif
+	free(scratch_);
+}
+
+
+real_t* Particles::allocate_array(const unsigned components) const {
+	// aligned_alloc needs a multiple of the alignment
+	const size_t cache_line = 64;
+	const size_t size = (components * num_padded_ * sizeof(real_t) + cache_line - 1) / cache_line * cache_line;
+	real_t* array = (real_t *) std::aligned_alloc(cache_line, std::max(size, cache_line));
+
+	// The ranges are whole blocks, i.e. contiguous in both layouts
+	#pragma omp parallel num_threads(num_threads_) if(num_threads_ > 1)
+	{
+		particleIdx_t begin, end;
+		get_thread_range(omp_get_thread_num(), omp_get_num_threads(), begin, end);
+		std::fill(array + size_t(components) * begin, array + size_t(components) * end, 0.);
+	}
+	return array;
+}
+
+
+/**
+ * Interleave the lower 21 bits of v with two zero bits each
+ */
+static inline uint64_t spread_bits(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffff;
+	v = (v | v << 16) & 0x1f0000ff0000ff;
+	v = (v | v << 8)  & 0x100f00f00f00f00f;
+	v = (v | v << 4)  & 0x10c30c30c30c30c3;
+	v = (v | v << 2)  & 0x1249249249249249;
+	return v;
+}
+
+
+void Particles::compute_cell_rank(SORT_ORDER order) {
+	const index_t num_cells = index_t(num_cells_x_) * num_cells_y_ * num_cells_z_;
+	cell_rank_.resize(num_cells);
+	cell_rank_order_ = order;
+
+	if (order == SORT_CELL) {
+		for (index_t cellidx = 0; cellidx < num_cells; ++cellidx) cell_rank_[cellidx] = cellidx;
+		return;
+	}
+
+	// Sort the cells by their Morton code, the grid need not be a power of two
+	std::vector<std::pair<uint64_t, index_t>> codes(num_cells);
+	for (Mac3d::cellIdx_t k = 0; k < num_cells_z_; ++k) {
+		for (Mac3d::cellIdx_t j = 0; j < num_cells_y_; ++j) {
+			for (Mac3d::cellIdx_t i = 0; i < num_cells_x_; ++i) {
+				const index_t cellidx = i + num_cells_x_ * index_t(j + k*num_cells_y_);
+				codes[cellidx] = {spread_bits(i) | spread_bits(j) << 1 | spread_bits(k) << 2, cellidx};
+			}
+		}
+	}
+	std::sort(codes.begin(), codes.end());
+	for (index_t rank = 0; rank < num_cells; ++rank) cell_rank_[codes[rank].second] = rank;
+}
+
+
+void Particles::sort_by_cell(SORT_ORDER order) {
+	if (cell_rank_.empty() or cell_rank_order_ != order) compute_cell_rank(order);
+	const index_t num_cells = cell_rank_.size();
+
+	if (scratch_ == nullptr) {
+		scratch_ = allocate_array();
+		sorted_idx_.resize(num_particles_);
+		particle_rank_.resize(num_particles_);
+	}
+
+	// Count the particles per cell, clamping particles on the domain boundary
+	rank_count_.assign(num_cells + 1, 0);
+	for (particleIdx_t n = 0; n < num_particles_; ++n) {
+		Mac3d::cellIdx_t i, j, k;
+		get_cell_index(n, i, j, k);
+		i = std::min(std::max(i, 0), num_cells_x_ - 1);
+		j = std::min(std::max(j, 0), num_cells_y_ - 1);
+		k = std::min(std::max(k, 0), num_cells_z_ - 1);
+		const index_t rank = cell_rank_[i + num_cells_x_ * index_t(j + k*num_cells_y_)];
+		particle_rank_[n] = rank;
+		++rank_count_[rank + 1];
+	}
+	for (index_t rank = 0; rank < num_cells; ++rank) rank_count_[rank + 1] += rank_count_[rank];
+	for (particleIdx_t n = 0; n < num_particles_; ++n) {
+		sorted_idx_[n] = rank_count_[particle_rank_[n]]++;
+	}
+
+	// Permute the components one after the other into the scratch array,
+	// which replaces the component array (or is copied back into the blocks)
+	for (Component* c : {&x, &y, &z, &u, &v, &w}) {
+		for (particleIdx_t n = 0; n < num_particles_; ++n) scratch_[sorted_idx_[n]] = (*c)[n];
+#ifdef WATERSIM_PARTICLES_AOSOA
+		for (particleIdx_t n = 0; n < num_particles_; ++n) (*c)[n] = scratch_[n];
+#else
+		std::swap(c->base_, scratch_);
+#endif
+	}
 }
\ No newline at end of file
@@ -68,6 +68,40 @@ void SimConfig::setDefaults(bool hard) {
 		setFluidRegion(22, 22, 22, 90, 110, 90);
 	if (!m_config.contains("randomSeed"))
 		setRandomSeed(-1);
+	if (!m_config.contains("numThreads"))
+		setNumThreads(1);
+	if (!m_config.contains("preconditionerSweep"))
+		setPreconditionerSweep("lexicographic");
+	if (!m_config.contains("preconditioner"))
+		setPreconditioner("ic0");
+	if (!m_config.contains("pressureInitialGuess"))
+		setPressureInitialGuess("zero");
+	if (!m_config.contains("logPressureSolve"))
+		setLogPressureSolve(false);
+	if (!m_config.contains("pressureSolverPrecision"))
+#ifdef WATERSIM_SINGLE_PRECISION
+		setPressureSolverPrecision("mixed");
+#else
+		setPressureSolverPrecision("double");
+#endif
+	if (!m_config.contains("pressureSolverVariant"))
+		setPressureSolverVariant("standard");
+	if (!m_config.contains("micTau"))
+		setMICTau(0.97);
+	if (!m_config.contains("micSafety"))
+		setMICSafety(0.25);
+	if (!m_config.contains("pressureDirectSolveSize"))
+		setPressureDirectSolveSize(0);
+	if (!m_config.contains("particleSortInterval"))
+		setParticleSortInterval(0);
+	if (!m_config.contains("particleSortOrder"))
+		setParticleSortOrder("morton");
+	if (!m_config.contains("particleToGridKernel"))
+		setParticleToGridKernel("sph");
+	if (!m_config.contains("particleToGridMethod"))
+		setParticleToGridMethod("scatter");
+	if (!m_config.contains("extrapolationLayers"))
+		setExtrapolationLayers(1);
 }
 
 void SimConfig::setExportMeshes(bool v) {
@@ -213,4 +247,124 @@ void SimConfig::setRandomSeed(int seed) {
 
 int SimConfig::getRandomSeed() {
 	return m_config["randomSeed"];
-}
\ No newline at end of file
+}
+
+void SimConfig::setNumThreads(int numThreads) {
+	m_config["numThreads"] = numThreads;
+}
+
+int SimConfig::getNumThreads() const {
+	return m_config["numThreads"];
+}
+
+void SimConfig::setPreconditionerSweep(const std::string& sweep) {
+	m_config["preconditionerSweep"] = sweep;
+}
+
+std::string SimConfig::getPreconditionerSweep() const {
+	return m_config["preconditionerSweep"];
+}
+
+void SimConfig::setPreconditioner(const std::string& preconditioner) {
+	m_config["preconditioner"] = preconditioner;
+}
+
+std::string SimConfig::getPreconditioner() const {
+	return m_config["preconditioner"];
+}
+
+void SimConfig::setPressureInitialGuess(const std::string& guess) {
+	m_config["pressureInitialGuess"] = guess;
+}
+
+std::string SimConfig::getPressureInitialGuess() const {
+	return m_config["pressureInitialGuess"];
+}
+
+void SimConfig::setLogPressureSolve(bool log) {
+	m_config["logPressureSolve"] = log;
+}
+
+bool SimConfig::getLogPressureSolve() const {
+	return m_config["logPressureSolve"];
+}
+
+void SimConfig::setPressureSolverPrecision(const std::string& precision) {
+	m_config["pressureSolverPrecision"] = precision;
+}
+
+std::string SimConfig::getPressureSolverPrecision() const {
+	return m_config["pressureSolverPrecision"];
+}
+
+void SimConfig::setPressureSolverVariant(const std::string& variant) {
+	m_config["pressureSolverVariant"] = variant;
+}
+
+std::string SimConfig::getPressureSolverVariant() const {
+	return m_config["pressureSolverVariant"];
+}
+
+void SimConfig::setMICTau(double tau) {
+	m_config["micTau"] = tau;
+}
+
+double SimConfig::getMICTau() const {
+	return m_config["micTau"];
+}
+
+void SimConfig::setMICSafety(double safety) {
+	m_config["micSafety"] = safety;
+}
+
+double SimConfig::getMICSafety() const {
+	return m_config["micSafety"];
+}
+
+void SimConfig::setPressureDirectSolveSize(int size) {
+	m_config["pressureDirectSolveSize"] = size;
+}
+
+int SimConfig::getPressureDirectSolveSize() const {
+	return m_config["pressureDirectSolveSize"];
+}
+
+void SimConfig::setParticleSortInterval(int interval) {
+	m_config["particleSortInterval"] = interval;
+}
+
+int SimConfig::getParticleSortInterval() const {
+	return m_config["particleSortInterval"];
+}
+
+void SimConfig::setParticleSortOrder(const std::string& order) {
+	m_config["particleSortOrder"] = order;
+}
+
+std::string SimConfig::getParticleSortOrder() const {
+	return m_config["particleSortOrder"];
+}
+
+void SimConfig::setParticleToGridKernel(const std::string& kernel) {
+	m_config["particleToGridKernel"] = kernel;
+}
+
+std::string SimConfig::getParticleToGridKernel() const {
+	return m_config["particleToGridKernel"];
+}
+
+void SimConfig::setParticleToGridMethod(const std::string& method) {
+	m_config["particleToGridMethod"] = method;
+}
+
+std::string SimConfig::getParticleToGridMethod() const {
+	return m_config["particleToGridMethod"];
+}
+
+void SimConfig::setExtrapolationLayers(int layers) {
+	m_config["extrapolationLayers"] = layers;
+}
+
+int SimConfig::getExtrapolationLayers() const {
+	return m_config["extrapolationLayers"];
+}
@@ -114,20 +114,21 @@ void WaterSim::initParticles() {
     const unsigned particles_per_cell = 8;
 
     m_num_particles = 0;
-    unsigned idx = 0;
+    index_t idx = 0;
 
     // Constant complexity for .push_back
     std::list<double> particles_x;
 	std::list<double> particles_y;
 	std::list<double> particles_z;
 
-	// Random offsets to particle positions
-	unsigned int n = 3 * particles_per_cell * nx * ny * nz;
-	Eigen::VectorXd rnd = Eigen::VectorXd::Zero(n);
+	// Random offsets to particle positions: the particles of the cell at idx
+	// read rnd(idx) to rnd(idx + 3*particles_per_cell - 1)
+	const Eigen::Index num_rnd = Eigen::Index(particles_per_cell) * p_mac_grid->get_num_cells() + 2 * particles_per_cell;
+	Eigen::VectorXd rnd = Eigen::VectorXd::Zero(num_rnd);
     if (m_cfg.getJitterParticles()) {
     	int seed = m_cfg.getRandomSeed();
     	std::srand((unsigned int) ((seed >= 0) ? seed : std::time(nullptr)));
-	    rnd = Eigen::VectorXd::Random(n);
+	    rnd = Eigen::VectorXd::Random(num_rnd);
     }
 
     // Get fluid region
@@ -182,10 +183,13 @@ void WaterSim::initParticles() {
         }
     }
 
-	flip_particles = new Particles(m_num_particles, *p_mac_grid);
-	std::move(particles_x.begin(), particles_x.end(), flip_particles->x);
-	std::move(particles_y.begin(), particles_y.end(), flip_particles->y);
-	std::move(particles_z.begin(), particles_z.end(), flip_particles->z);
+	flip_particles = new Particles(m_num_particles, *p_mac_grid, m_cfg.getNumThreads());
+	Particles::particleIdx_t n = 0;
+	for (auto x = particles_x.begin(), y = particles_y.begin(), z = particles_z.begin(); x != particles_x.end(); ++x, ++y, ++z, ++n) {
+		flip_particles->x[n] = *x;
+		flip_particles->y[n] = *y;
+		flip_particles->z[n] = *z;
+	}
 }
 
 void WaterSim::initMacGrid() {
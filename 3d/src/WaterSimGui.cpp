@@ -44,9 +44,9 @@ void WaterSimGui::updateParams(const SimConfig &cfg) {
 
 void WaterSimGui::updateRenderGeometry() {
 	// Copy particle positions from FLIP's data structure
-	unsigned num_particles = m_watersim.getNumParticles();
-	unsigned disp_particles = num_particles;
-	unsigned particle_step = 1;
+	Particles::particleIdx_t num_particles = m_watersim.getNumParticles();
+	Particles::particleIdx_t disp_particles = num_particles;
+	Particles::particleIdx_t particle_step = 1;
 
 	// If there are too many particles to display, only
 	// display a subset, using stride particle_set
@@ -56,7 +56,7 @@ void WaterSimGui::updateRenderGeometry() {
 	}
 
 	m_particles.resize(disp_particles, 3);
-	for (unsigned i = 0, j = 0; j < disp_particles && i < num_particles; j++, i += particle_step) {
+	for (Particles::particleIdx_t i = 0, j = 0; j < disp_particles && i < num_particles; j++, i += particle_step) {
 		m_particles(j, 0) = m_watersim.flip_particles->x[i];
 		m_particles(j, 1) = m_watersim.flip_particles->y[i];
 		m_particles(j, 2) = m_watersim.flip_particles->z[i];
@@ -8,28 +8,36 @@
 /** COMPUTE ADVECTION TIMESTEP BASED ON CFL CONDITIONS */
 double FLIP::compute_timestep( const double dt ){
 
-	// Particle velocity
-	double u_particle;
-	double v_particle;
-	double w_particle;
-
 	// Maximum particle velocity
 	double u_max = 0.;
 	double v_max = 0.;
 	double w_max = 0.;
 
-	// Get the maximal particle velocity components
-	for( Particles::particleIdx_t n = 0; n < num_particles_; ++n ){
+	// Get the maximal particle velocity components (max is exact, so the
+	// reduction does not depend on the number of threads)
+	#pragma omp parallel num_threads(num_threads_) if(num_threads_ > 1) reduction(max: u_max, v_max, w_max)
+	{
+		Particles::particleIdx_t begin, end;
+		particles_.get_thread_range(omp_get_thread_num(), omp_get_num_threads(), begin, end);
+
+		for( Particles::particleIdx_t n = begin; n < end; ++n ){
+
+			const double u_particle = particles_.u[n];
+			const double v_particle = particles_.v[n];
+			const double w_particle = particles_.w[n];
 
-		u_particle = particles_.u[n];
-		v_particle = particles_.v[n];
-		w_particle = particles_.w[n];
-		
-		if( std::abs(u_particle) > u_max ) u_max = std::abs(u_particle);
-		if( std::abs(v_particle) > v_max ) v_max = std::abs(u_particle);
-		if( std::abs(w_particle) > w_max ) w_max = std::abs(w_particle);
+			if( std::abs(u_particle) > u_max ) u_max = std::abs(u_particle);
+			if( std::abs(v_particle) > v_max ) v_max = std::abs(v_particle);
+			if( std::abs(w_particle) > w_max ) w_max = std::abs(w_particle);
+		}
 	}
 
+	return compute_timestep(dt, u_max, v_max, w_max);
+}
+
+double FLIP::compute_timestep( const double dt, const double u_max,
+							   const double v_max, const double w_max ) const {
+
 	// Check if the fastest particles travel a distance larger than the
 	// length of an edge of a cell
 
@@ -57,11 +65,7 @@ double FLIP::compute_timestep( const double dt ){
 
 
 /** PARTICLE ADVECTION */
-void FLIP::advance_particles(const double dt) {
-
-	// Grid dimensions
-	const Mac3d::cellIdx_t nx = MACGrid_->N_;
-	const Mac3d::cellIdx_t ny = MACGrid_->M_;
+void FLIP::advance_particles(const double dt, const int num_substeps) {
 
 	// Half timestep
 	const double dt_half = 0.5 * dt;
@@ -78,88 +82,117 @@ void FLIP::advance_particles(const double dt) {
 	const double y_last_center = MACGrid_->sizey_ - MACGrid_->cell_sizey_;
 	const double z_last_center = MACGrid_->sizez_ - MACGrid_->cell_sizez_;
 
-	// Position and velocity of the current particle
-	double x_particle;
-	double y_particle;
-	double z_particle;
-
-	// Particle coordinates after half timestep (computed with Euler)
-	double x_half;
-	double y_half;
-	double z_half;
-
-	// Coordinates of the future location of the particle
-	double x_next;
-	double y_next;
-	double z_next;
-
-	// Cell indices of the particle (before and after advection)
-	Mac3d::cellIdx_t curr_cell_idx_x;
-	Mac3d::cellIdx_t curr_cell_idx_y;
-	Mac3d::cellIdx_t curr_cell_idx_z;
-	Mac3d::cellIdx_t next_cell_idx_x;
-	Mac3d::cellIdx_t next_cell_idx_y;
-	Mac3d::cellIdx_t next_cell_idx_z;
-
-	// Iterate over all particles
-	for( Particles::particleIdx_t n = 0; n < num_particles_; ++n ){
-
-		// Get current position and velocity of the particle
-		x_particle = particles_.x[n];
-		y_particle = particles_.y[n];
-		z_particle = particles_.z[n];
-
-		// Euler estimate
-		x_half = x_particle + dt_half*particles_.u[n];
-		y_half = y_particle + dt_half*particles_.v[n];
-		z_half = z_particle + dt_half*particles_.w[n];
-
-		// Check if the particle is out of the grid after the euler step
-		if( x_half <= x_lower_bound or x_half >= x_upper_bound or 
-			y_half <= y_lower_bound or y_half >= y_upper_bound or 
-			z_half <= z_lower_bound or z_half >= z_upper_bound )
-		{
-			continue;
-		}
-
-		// RK2
-		x_next = x_particle + dt*MACGrid_->grid_interpolate<Mac3d::GRID_U>(x_half, y_half, z_half);
-		y_next = y_particle + dt*MACGrid_->grid_interpolate<Mac3d::GRID_V>(x_half, y_half, z_half);
-		z_next = z_particle + dt*MACGrid_->grid_interpolate<Mac3d::GRID_W>(x_half, y_half, z_half);
-
-		// Check if the particle exits the grid
-		if(x_next <= x_lower_bound) x_next = 0.;
-		if(y_next <= y_lower_bound) y_next = 0.;
-		if(z_next <= z_lower_bound) z_next = 0.;
-		if(x_next >= x_upper_bound) x_next = x_last_center; 
-		if(y_next >= y_upper_bound) y_next = y_last_center;
-		if(z_next >= z_upper_bound) z_next = z_last_center;
-
-		// Check if the particle enters in a solid
-
-		// Get the indices of the grid-cells containing the particle at
-		// the current time and in the future
-		//particles_.get_cell_index(n, curr_cell_idx_x, curr_cell_idx_y, curr_cell_idx_z);
-		//MACGrid_->index_from_coord(x_next, y_next, z_next, next_cell_idx_x, next_cell_idx_y, next_cell_idx_z);
-
-		//// Shift a particle if it would exit the system
-		//// (should not happen)
-		//if( MACGrid_->psolid_[next_cell_idx_x + nx*next_cell_idx_y + nx*ny*next_cell_idx_z] ) {
-
-		//	if     ( curr_cell_idx_x > next_cell_idx_x ) x_next = (curr_cell_idx_x - 0.25) * MACGrid_->cell_sizex_;
-		//	else if( curr_cell_idx_x < next_cell_idx_x ) x_next = (curr_cell_idx_x + 0.25) * MACGrid_->cell_sizex_;
-
-		//	if     ( curr_cell_idx_y > next_cell_idx_y ) y_next = (curr_cell_idx_y - 0.25) * MACGrid_->cell_sizey_;
-		//	else if( curr_cell_idx_y < next_cell_idx_y ) y_next = (curr_cell_idx_y + 0.25) * MACGrid_->cell_sizey_;
-
-		//	if     ( curr_cell_idx_z > next_cell_idx_z ) z_next = (curr_cell_idx_z - 0.25) * MACGrid_->cell_sizez_;
-		//	else if( curr_cell_idx_z < next_cell_idx_z ) z_next = (curr_cell_idx_z + 0.25) * MACGrid_->cell_sizez_;
-		//}
+	// Copy the velocities into the ghost fields read by the batch
+	// interpolation, unless grid_to_particle did already
+	if( not ghost_fields_current_ ){
+		MACGrid_->update_ghost_fields(num_threads_);
+		ghost_fields_current_ = true;
+	}
 
-		// Update the position of the current particle
-		particles_.x[n] = x_next;
-		particles_.y[n] = y_next;
-		particles_.z[n] = z_next;
+	namespace vec = simd::vec;
+	const vec::type dt_half_vec = vec::set1(dt_half);
+	const vec::type dt_vec = vec::set1(dt);
+
+	const vec::type x_lower_vec = vec::set1(x_lower_bound);
+	const vec::type y_lower_vec = vec::set1(y_lower_bound);
+	const vec::type z_lower_vec = vec::set1(z_lower_bound);
+	const vec::type x_upper_vec = vec::set1(x_upper_bound);
+	const vec::type y_upper_vec = vec::set1(y_upper_bound);
+	const vec::type z_upper_vec = vec::set1(z_upper_bound);
+	const vec::type x_last_vec = vec::set1(x_last_center);
+	const vec::type y_last_vec = vec::set1(y_last_center);
+	const vec::type z_last_vec = vec::set1(z_last_center);
+	const vec::type zero_vec = vec::zero();
+
+	const Particles::particleIdx_t num_particles = particles_.get_num_particles();
+
+	// Every thread advances the same contiguous range of particles it first
+	// touched (see Particles::get_thread_range)
+	#pragma omp parallel num_threads(num_threads_) if(num_threads_ > 1)
+	{
+		Particles::particleIdx_t begin, end;
+		particles_.get_thread_range(omp_get_thread_num(), omp_get_num_threads(), begin, end);
+
+		// Particle coordinates after half timestep (computed with Euler), and
+		// interpolated velocities there, of the current batch
+		vec::type x_half;
+		vec::type y_half;
+		vec::type z_half;
+		vec::type interp_u;
+		vec::type interp_v;
+		vec::type interp_w;
+		Mac3d::BatchStencil stencil;
+
+		// Coordinates of the future location of the particles
+		vec::type x_next;
+		vec::type y_next;
+		vec::type z_next;
+
+		// Particles which are still in the grid after the euler step
+		vec::type inside;
+
+		// Iterate over the particles of the thread, in full batches of
+		// vec::width (4 doubles, or 8 floats in single precision)
+		for( Particles::particleIdx_t n = begin; n < end; n += vec::width ){
+
+			// Lanes of real particles, the padding particles are not moved
+			const vec::type valid = vec::first_lanes((long long) num_particles - (long long) n);
+
+			// Get current position and velocity of the particles, which stay in
+			// registers for all substeps
+			vec::type x_batch = vec::load_aligned(particles_.x.batch(n));
+			vec::type y_batch = vec::load_aligned(particles_.y.batch(n));
+			vec::type z_batch = vec::load_aligned(particles_.z.batch(n));
+			const vec::type u_batch = vec::load_aligned(particles_.u.batch(n));
+			const vec::type v_batch = vec::load_aligned(particles_.v.batch(n));
+			const vec::type w_batch = vec::load_aligned(particles_.w.batch(n));
+
+			for( int s = 0; s < num_substeps; ++s ){
+
+				// Euler estimate
+				x_half = vec::fmadd(dt_half_vec, u_batch, x_batch);
+				y_half = vec::fmadd(dt_half_vec, v_batch, y_batch);
+				z_half = vec::fmadd(dt_half_vec, w_batch, z_batch);
+
+				// RK2 (the particles out of the grid after the euler step are
+				// interpolated on the boundary, but not moved below), the
+				// three components share the stencil of the positions
+				stencil = MACGrid_->compute_stencil_batch(x_half, y_half, z_half);
+				interp_u = MACGrid_->grid_interpolate_batch<Mac3d::GRID_U>(stencil);
+				interp_v = MACGrid_->grid_interpolate_batch<Mac3d::GRID_V>(stencil);
+				interp_w = MACGrid_->grid_interpolate_batch<Mac3d::GRID_W>(stencil);
+
+				x_next = vec::fmadd(dt_vec, interp_u, x_batch);
+				y_next = vec::fmadd(dt_vec, interp_v, y_batch);
+				z_next = vec::fmadd(dt_vec, interp_w, z_batch);
+
+				// Check if the particles are out of the grid after the euler step
+				// (the padding particles count as out of the grid)
+				inside = vec::bit_and(vec::bit_and(vec::cmp<_CMP_GT_OQ>(x_half, x_lower_vec),
+				                                   vec::cmp<_CMP_LT_OQ>(x_half, x_upper_vec)),
+				                      vec::bit_and(vec::cmp<_CMP_GT_OQ>(y_half, y_lower_vec),
+				                                   vec::cmp<_CMP_LT_OQ>(y_half, y_upper_vec)));
+				inside = vec::bit_and(vec::bit_and(inside, valid),
+				                      vec::bit_and(vec::cmp<_CMP_GT_OQ>(z_half, z_lower_vec),
+				                                   vec::cmp<_CMP_LT_OQ>(z_half, z_upper_vec)));
+
+				// Check if the particles exit the grid
+				x_next = vec::blend(x_next, zero_vec, vec::cmp<_CMP_LE_OQ>(x_next, x_lower_vec));
+				y_next = vec::blend(y_next, zero_vec, vec::cmp<_CMP_LE_OQ>(y_next, y_lower_vec));
+				z_next = vec::blend(z_next, zero_vec, vec::cmp<_CMP_LE_OQ>(z_next, z_lower_vec));
+				x_next = vec::blend(x_next, x_last_vec, vec::cmp<_CMP_GE_OQ>(x_next, x_upper_vec));
+				y_next = vec::blend(y_next, y_last_vec, vec::cmp<_CMP_GE_OQ>(y_next, y_upper_vec));
+				z_next = vec::blend(z_next, z_last_vec, vec::cmp<_CMP_GE_OQ>(z_next, z_upper_vec));
+
+				// Update the position of the particles which stayed in the grid
+				x_batch = vec::blend(x_batch, x_next, inside);
+				y_batch = vec::blend(y_batch, y_next, inside);
+				z_batch = vec::blend(z_batch, z_next, inside);
+			}
+
+			vec::store_aligned(particles_.x.batch(n), x_batch);
+			vec::store_aligned(particles_.y.batch(n), y_batch);
+			vec::store_aligned(particles_.z.batch(n), z_batch);
+		}
 	}
 }
-
@@ -13,6 +13,9 @@ void FLIP::apply_boundary_conditions() {
 	const Mac3d::cellIdx_t ny = MACGrid_->M_;
 	const Mac3d::cellIdx_t nz = MACGrid_->L_;
 
+	// The ghost fields no longer hold the current velocities
+	ghost_fields_current_ = false;
+
 	// Enforce boundary conditions for outer (system) boundaries
 	for(Mac3d::cellIdx_t k = 0; k < nz; ++k){
 		for(Mac3d::cellIdx_t j = 0; j < ny; ++j){
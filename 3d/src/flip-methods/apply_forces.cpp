@@ -13,10 +13,13 @@ void FLIP::apply_forces(const double dt) {
 	// Only worry about gravity for now
 
 	// Get total number of faces on the y-axis
-	const Mac3d::globalCellIdx_t n_vfaces = MACGrid_->N_ * MACGrid_->L_ * (MACGrid_->M_+1);
+	const Mac3d::globalCellIdx_t n_vfaces = MACGrid_->get_num_faces(Mac3d::GRID_V);
 
 	const double dv = -dt * gravity_mag_;
 
+	// The ghost fields no longer hold the current velocities
+	ghost_fields_current_ = false;
+
 	// Iterate over cells & update: dv = dt*g
 	for(Mac3d::globalCellIdx_t idx = 0; idx < n_vfaces; ++idx){
 
@@ -61,6 +64,9 @@ void FLIP::explode( const double dt,
 	const double dv_center = y_center * dvel_rinv;
 	const double dw_center = z_center * dvel_rinv;
 
+	// The ghost fields no longer hold the current velocities
+	ghost_fields_current_ = false;
+
 	// Iterate over all grid-velocities. If they are within the
 	// radius r from the center, update the velocties with the given
 	// force value (the force always points outwards)
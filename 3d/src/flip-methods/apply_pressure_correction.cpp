@@ -5,6 +5,7 @@
 #include "FLIP.h"
 #include "ConjugateGradient.hpp"
 #include "tsc_x86.hpp"
+#include <iostream>
 
 
 /*** PRESSURE SOLVING ***/
@@ -12,12 +13,48 @@ void FLIP::apply_pressure_correction(const double dt) {
 
     // Compute & apply pressure gradients to field
 
+    // Number the fluid cells: the system only has unknowns for them
+    cg_solver.update_fluid_cells();
+
     // Compute rhs d
     compute_pressure_rhs(dt);
 
+	// Start from the pressure of the previous steps
+	const bool warm_start = pressure_guess_ != PRESSURE_GUESS_ZERO;
+	if (warm_start) compute_pressure_guess();
+
     // Solve for p: Ap = d (MICCG(0))
-	// work directly on grid pressure array
-	cg_solver.solve(d_, MACGrid_->ppressure_);
+	// The number of CG iterations is stored as tag of the timing
+	tsc::TSCTimer& tsctimer = tsc::TSCTimer::get_timer("timings.json");
+	tsctimer.start_timing("pressure_solve");
+	cg_solver.solve_compact(d_, p_, warm_start);
+	tsctimer.stop_timing("pressure_solve", true, std::to_string(cg_solver.get_num_iterations()));
+
+	if (warm_start) {
+		if (cfg_.getLogPressureSolve()) {
+			// CG reduces the residual by roughly the same factor in every iteration,
+			// so starting from zero needs about log(|d|/tol) / log(|r0|/tol) times
+			// as many iterations as starting from the initial guess with residual r0
+			const unsigned iterations = cg_solver.get_num_iterations();
+			const double tol = cg_solver.get_tolerance();
+			const double rhs_norm = cg_solver.get_rhs_norm();
+			const double initial_residual = cg_solver.get_initial_residual();
+			std::cout << "Pressure solve: " << iterations << " iterations";
+			if (rhs_norm > tol) {
+				std::cout << ", initial residual " << initial_residual / rhs_norm << " of the zero guess";
+				if (initial_residual > tol) {
+					const double zero_guess_iterations = iterations * std::log(rhs_norm / tol) / std::log(initial_residual / tol);
+					std::cout << ", about " << std::lround(zero_guess_iterations - iterations) << " iterations saved";
+				}
+			}
+			std::cout << std::endl;
+		}
+
+		update_pressure_history();
+	}
+
+	// Write the pressure of the fluid cells to the grid, all other cells have zero pressure
+	cg_solver.scatter_solution(p_, MACGrid_->ppressure_);
 
     // Apply pressure gradients to velocity field
     //     -> see SIGGRAPH §4
@@ -29,6 +66,8 @@ void FLIP::compute_pressure_rhs(const double dt) {
     // Compute right-hand side of the pressure equations and store in d_
     // See eq. (4.19) and (4.24) in SIGGRAPH notes
     // Note: u_{solid} = 0
+    // Only fluid cells have an equation: d_[c] belongs to the c-th fluid cell
+    // in the numbering of the pressure solver
 
     // Get total number of cells on each axis
     unsigned nx = MACGrid_->get_num_cells_x();
@@ -38,77 +77,134 @@ void FLIP::compute_pressure_rhs(const double dt) {
     // Alias for MAC Grid
     auto& g = MACGrid_;
 
-    // Set d_ to zero
-	std::fill(d_, d_+nx*ny*nz, 0);
+    const index_t num_fluid = cg_solver.get_num_fluid_cells();
+    const index_t* const fluid_cells = cg_solver.get_fluid_cells();
 
-    // Index of the current grid-cell [0, nx*ny*nz[ (in the matrix)
-    unsigned cellidx = 0;
+    // Iterate over all fluid cells
+    for (index_t c = 0; c < num_fluid; ++c) {
+        // Index of the grid-cell [0, nx*ny*nz[
+        const index_t cellidx = fluid_cells[c];
+        const unsigned i = cellidx % nx;
+        const unsigned j = (cellidx / nx) % ny;
+        const unsigned k = cellidx / (nx*ny);
 
-    // Iterate over all grid-cells
-    for (unsigned k = 0; k < nz; ++k) {
-        for (unsigned j = 0; j < ny; ++j) {
-            for (unsigned i = 0; i < nx; ++i, ++cellidx) {
+        // Apply the formulas of the SIGGRAPH notes
+        double d_ij = -(g->get_u(i+1,j,k) - g->get_u(i,j,k));
+        d_ij -= g->get_v(i,j+1,k) - g->get_v(i,j,k);
+        d_ij -= g->get_w(i,j,k+1) - g->get_w(i,j,k);
 
-                if (g->is_fluid(i,j,k)) {
+        // Note: u_{solid} = 0
 
-                    // Apply the formulas of the SIGGRAPH notes
-                    double d_ij = -(g->get_u(i+1,j,k) - g->get_u(i,j,k));
-                    d_ij -= g->get_v(i,j+1,k) - g->get_v(i,j,k);
-                    d_ij -= g->get_w(i,j,k+1) - g->get_w(i,j,k);
+        // Check each adjacent cell. If solid, alter term as in (4.24)
+        // Consider cells outside of the boundary as solid
 
-                    // Note: u_{solid} = 0
+        // (i+1, j, k)
+        if ((i < (nx-1) && g->is_solid(i+1,j,k)) || i == nx-1) {
+            d_ij += g->get_u(i+1,j,k);
+        }
+
+        // (i-1, j, k)
+        if ((i > 0 && g->is_solid(i-1,j,k)) || i == 0) {
+            d_ij += g->get_u(i,j,k);
+        }
 
-                    // Check each adjacent cell. If solid, alter term as in (4.24)
-                    // Consider cells outside of the boundary as solid
+        // (i, j+1, k)
+        if ((j < (ny-1) && g->is_solid(i,j+1,k)) || j == ny-1) {
+            d_ij += g->get_v(i,j+1,k);
+        }
 
-                    // (i+1, j, k)
-                    if ((i < (nx-1) && g->is_solid(i+1,j,k)) || i == nx-1) {
-                        d_ij += g->get_u(i+1,j,k);
-                    }
+        // (i, j-1, k)
+        if ((j > 0 && g->is_solid(i,j-1,k)) || j == 0) {
+            d_ij += g->get_v(i,j,k);
+        }
 
-                    // (i-1, j, k)
-                    if ((i > 0 && g->is_solid(i-1,j,k)) || i == 0) {
-                        d_ij += g->get_u(i,j,k);
-                    }
+        // (i, j, k+1)
+        if ((k < (nz-1) && g->is_solid(i,j,k+1)) || k == nz-1) {
+            d_ij += g->get_w(i,j,k+1);
+        }
 
-                    // (i, j+1, k)
-                    if ((j < (ny-1) && g->is_solid(i,j+1,k)) || j == ny-1) {
-                        d_ij += g->get_v(i,j+1,k);
-                    }
+        // (i, j, k-1)
+        if ((k > 0 && g->is_solid(i,j,k-1)) || k == 0) {
+            d_ij += g->get_w(i,j,k);
+        }
 
-                    // (i, j-1, k)
-                    if ((j > 0 && g->is_solid(i,j-1,k)) || j == 0) {
-                        d_ij += g->get_v(i,j,k);
-                    }
+        d_[c] = fluid_density_ * g->get_cell_sizex() * d_ij / dt;
+    }
+}
 
-                    // (i, j, k+1)
-                    if ((k < (nz-1) && g->is_solid(i,j,k+1)) || k == nz-1) {
-                        d_ij += g->get_w(i,j,k+1);
-                    }
 
-                    // (i, j, k-1)
-                    if ((k > 0 && g->is_solid(i,j,k-1)) || k == 0) {
-                        d_ij += g->get_w(i,j,k);
-                    }
+void FLIP::compute_pressure_guess() {
 
-                    d_[cellidx] = fluid_density_ * g->get_cell_sizex() * d_ij / dt;
+    // Initial guess of the pressure solve in p_, from the pressure of the
+    // previous steps. Extrapolation needs both previous pressures, otherwise
+    // the previous pressure is used.
+    // Cells which just became fluid cells have no previous pressure (the grid
+    // pressure is zero there). They are mostly gaps between the particles
+    // inside the fluid, not free-surface cells, so they start from the mean
+    // previous pressure of their neighbours which were fluid cells.
 
-                } else { // if is_fluid(i,j,k)
+    unsigned nx = MACGrid_->get_num_cells_x();
+    unsigned ny = MACGrid_->get_num_cells_y();
+    unsigned nz = MACGrid_->get_num_cells_z();
 
-                    // Set the entry to zero if the current cell is a
-                    // fluid-cell
-                    d_[cellidx] = 0;
+    const index_t num_fluid = cg_solver.get_num_fluid_cells();
+    const index_t* const fluid_cells = cg_solver.get_fluid_cells();
+    const double* const pressure = MACGrid_->ppressure_;
+
+    for (index_t c = 0; c < num_fluid; ++c) {
+        const index_t cellidx = fluid_cells[c];
+        if (pressure_guess_ == PRESSURE_GUESS_EXTRAPOLATE && fluid_age_[cellidx] == 2) {
+            p_[c] = 2*pressure[cellidx] - pressure_old_[cellidx];
+        } else if (fluid_age_[cellidx] > 0) {
+            p_[c] = pressure[cellidx];
+        } else {
+            const unsigned i = cellidx % nx;
+            const unsigned j = (cellidx / nx) % ny;
+            const unsigned k = cellidx / (nx*ny);
+            double sum = 0;
+            unsigned count = 0;
+            auto add_neighbour = [&](bool in_range, index_t nb_cellidx) {
+                if (in_range && fluid_age_[nb_cellidx] > 0) {
+                    sum += pressure[nb_cellidx];
+                    count++;
                 }
-            }
+            };
+            add_neighbour(i > 0, cellidx - 1);
+            add_neighbour(i+1 < nx, cellidx + 1);
+            add_neighbour(j > 0, cellidx - nx);
+            add_neighbour(j+1 < ny, cellidx + nx);
+            add_neighbour(k > 0, cellidx - nx*ny);
+            add_neighbour(k+1 < nz, cellidx + nx*ny);
+            p_[c] = count > 0 ? sum / count : 0;
         }
     }
 }
 
 
+void FLIP::update_pressure_history() {
+
+    // Must be called after the solve and before the new pressure is written
+    // to the grid, which still holds the pressure of the last solve
+
+    const index_t num_cells = MACGrid_->get_num_cells();
+
+    if (pressure_guess_ == PRESSURE_GUESS_EXTRAPOLATE) {
+        std::copy(MACGrid_->ppressure_, MACGrid_->ppressure_ + num_cells, pressure_old_);
+    }
+
+    for (index_t cellidx = 0; cellidx < num_cells; ++cellidx) {
+        fluid_age_[cellidx] = MACGrid_->pfluid_[cellidx] ? std::min(fluid_age_[cellidx] + 1, 2) : 0;
+    }
+}
+
+
 void FLIP::apply_pressure_gradients(const double dt) {
 
     // Apply pressure gradients to velocity field
 
+    // The ghost fields no longer hold the current velocities
+    ghost_fields_current_ = false;
+
     // Get total number of cells on each axis
     unsigned nx = MACGrid_->get_num_cells_x();
     unsigned ny = MACGrid_->get_num_cells_y();
@@ -120,43 +216,48 @@ void FLIP::apply_pressure_gradients(const double dt) {
     // Get the length of an edge
     double dx = g->get_cell_sizex();
 
-    // Iterate over all grid-cells
-    for (unsigned k = 0; k < nz; ++k) {
-        for (unsigned j = 0; j < ny; ++j) {
-            for (unsigned i = 0; i < nx; ++i) {
-
-                // Update grid-velocities with new velocities induced by
-                // pressures
-                if (i != 0) {
-                    // get_u(i,j,k) = u_{ (i-1/2, j, k) }
-                    // See SIGGRAPH eq. (4.6)
-                    double du = (g->get_pressure(i,j,k) - g->get_pressure(i-1,j,k));
-                    du *= (dt/(dx*fluid_density_));
-
-                    g->set_u(i,j,k, g->get_u(i,j,k) - du);
-                }
-
-                if (j != 0) {
-
-                    // get_v(i,j,k) = v_{ (i, j-1/2, k) }
-                    // See SIGGRAPH eq. (4.7)
-                    double dv = (g->get_pressure(i,j,k) - g->get_pressure(i,j-1,k));
-                    dv *= (dt/(dx*fluid_density_));
-
-                    g->set_v(i,j,k, g->get_v(i,j,k) - dv);
-                }
-
-                if (k != 0) {
-
-                    // get_w(i,j,k) = w_{ (i, j, k-1/2) }
-                    // See SIGGRAPH eq. (4.8)
+    const double scale = dt/(dx*fluid_density_);
+    const index_t num_fluid = cg_solver.get_num_fluid_cells();
+    const index_t* const fluid_cells = cg_solver.get_fluid_cells();
+
+    // The pressure is zero outside of the fluid, so only faces of fluid cells
+    // change. Each fluid cell updates its lower faces, and its upper faces if
+    // the cell on the other side is not a fluid cell (otherwise that cell
+    // updates the face as its lower face).
+    for (index_t c = 0; c < num_fluid; ++c) {
+        const index_t cellidx = fluid_cells[c];
+        const unsigned i = cellidx % nx;
+        const unsigned j = (cellidx / nx) % ny;
+        const unsigned k = cellidx / (nx*ny);
+
+        // Update grid-velocities with new velocities induced by
+        // pressures
+        // get_u(i,j,k) = u_{ (i-1/2, j, k) }, see SIGGRAPH eq. (4.6) - (4.8)
+        if (i != 0) {
+            const double du = (g->get_pressure(i,j,k) - g->get_pressure(i-1,j,k)) * scale;
+            g->set_u(i,j,k, g->get_u(i,j,k) - du);
+        }
+        if (i+1 < nx && not g->is_fluid(i+1,j,k)) {
+            const double du = (g->get_pressure(i+1,j,k) - g->get_pressure(i,j,k)) * scale;
+            g->set_u(i+1,j,k, g->get_u(i+1,j,k) - du);
+        }
 
-                    double dw = (g->get_pressure(i,j,k) - g->get_pressure(i,j,k-1));
-                    dw *= (dt/(dx*fluid_density_));
+        if (j != 0) {
+            const double dv = (g->get_pressure(i,j,k) - g->get_pressure(i,j-1,k)) * scale;
+            g->set_v(i,j,k, g->get_v(i,j,k) - dv);
+        }
+        if (j+1 < ny && not g->is_fluid(i,j+1,k)) {
+            const double dv = (g->get_pressure(i,j+1,k) - g->get_pressure(i,j,k)) * scale;
+            g->set_v(i,j+1,k, g->get_v(i,j+1,k) - dv);
+        }
 
-                    g->set_w(i,j,k, g->get_w(i,j,k) - dw);
-                }
-            }
+        if (k != 0) {
+            const double dw = (g->get_pressure(i,j,k) - g->get_pressure(i,j,k-1)) * scale;
+            g->set_w(i,j,k, g->get_w(i,j,k) - dw);
+        }
+        if (k+1 < nz && not g->is_fluid(i,j,k+1)) {
+            const double dw = (g->get_pressure(i,j,k+1) - g->get_pressure(i,j,k)) * scale;
+            g->set_w(i,j,k+1, g->get_w(i,j,k+1) - dw);
         }
     }
 }
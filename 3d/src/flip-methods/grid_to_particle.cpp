@@ -20,72 +20,114 @@ void FLIP::grid_to_particle(){
 	const Mac3d::cellIdx_t ny = MACGrid_->get_num_cells_y();
 	const Mac3d::cellIdx_t nz = MACGrid_->get_num_cells_z();
 
-	// Position and velocity of the current particle
-	double x_particle;
-	double y_particle;
-	double z_particle;
-	double u_particle;
-	double v_particle;
-	double w_particle;
-
-	double interp_u_star;
-	double interp_v_star;
-	double interp_w_star;
-
-	double interp_u_n1;
-	double interp_v_n1;
-	double interp_w_n1;
-
-	double u_update;
-	double v_update;
-	double w_update;
-
-	// Indices of the cell containing the current particle
-	Mac3d::cellIdx_t cell_idx_x;
-	Mac3d::cellIdx_t cell_idx_y;
-	Mac3d::cellIdx_t cell_idx_z;
-
-	// Iterate over all particles
-	for( Particles::particleIdx_t n = 0; n < num_particles_; ++n ){
-
-		// Store the initial positions and velocities of the particles
-		x_particle = particles_.x[n];
-		y_particle = particles_.y[n];
-		z_particle = particles_.z[n];
-		u_particle = particles_.u[n];
-		v_particle = particles_.v[n];
-		w_particle = particles_.w[n];
-
-		// Get updated velocities by interpolation
-		std::tie(interp_u_n1, interp_u_star) = MACGrid_->grid_interpolate<Mac3d::GRID_U, Mac3d::INTERPOLATE_BOTH>(x_particle, y_particle, z_particle);
-		std::tie(interp_v_n1, interp_v_star) = MACGrid_->grid_interpolate<Mac3d::GRID_V, Mac3d::INTERPOLATE_BOTH>(x_particle, y_particle, z_particle);
-		std::tie(interp_w_n1, interp_w_star) = MACGrid_->grid_interpolate<Mac3d::GRID_W, Mac3d::INTERPOLATE_BOTH>(x_particle, y_particle, z_particle);
-
-		// Get the index of the grid-cell containing the current
-		// particle
-		particles_.get_cell_index(n, cell_idx_x, cell_idx_y, cell_idx_z);
-
-		// Blend PIC and FLIP, use double the amount of PIC on boundary
-		if( cell_idx_x == 0 or cell_idx_x == nx-1 or 
-			cell_idx_y == 0 or cell_idx_y == ny-1 or 
-			cell_idx_z == 0 or cell_idx_z == nz-1 )
-		{
-
-			u_update = interp_u_n1 + (u_particle - interp_u_star) * coeff_boundary;
-			v_update = interp_v_n1 + (v_particle - interp_v_star) * coeff_boundary;
-			w_update = interp_w_n1 + (w_particle - interp_w_star) * coeff_boundary;
-
-		} else {
-
-			u_update = interp_u_n1 + (u_particle - interp_u_star) * coeff_internal;
-			v_update = interp_v_n1 + (v_particle - interp_v_star) * coeff_internal;
-			w_update = interp_w_n1 + (w_particle - interp_w_star) * coeff_internal;
-
+	// Copy the velocities into the ghost fields read by the batch
+	// interpolation, they stay valid for the advection
+	MACGrid_->update_ghost_fields(num_threads_);
+	ghost_fields_current_ = true;
+
+	// The update interp(u) + (u_p - interp(u*))*coeff_internal of the
+	// particles inside is interp(u - coeff_internal*u*) + coeff_internal*u_p,
+	// which needs one gather per component instead of two
+	MACGrid_->update_blend_ghost_fields(coeff_internal, num_threads_);
+
+	namespace vec = simd::vec;
+	const vec::type coeff_internal_vec = vec::set1(coeff_internal);
+
+	// Maximal absolute velocity components of the updated particles, for the
+	// CFL condition (max is exact, so the reduction does not depend on the
+	// number of threads)
+	double u_max = 0.;
+	double v_max = 0.;
+	double w_max = 0.;
+
+	// Every thread updates the same contiguous range of particles it first
+	// touched (see Particles::get_thread_range)
+	#pragma omp parallel num_threads(num_threads_) if(num_threads_ > 1) reduction(max: u_max, v_max, w_max)
+	{
+		Particles::particleIdx_t begin, end;
+		particles_.get_thread_range(omp_get_thread_num(), omp_get_num_threads(), begin, end);
+
+		vec::type u_max_vec = vec::zero();
+		vec::type v_max_vec = vec::zero();
+		vec::type w_max_vec = vec::zero();
+
+		const Particles::particleIdx_t num_particles = particles_.get_num_particles();
+		alignas(32) real_t interp[3][vec::width];
+
+		// Iterate over the particles of the thread, in full batches of
+		// vec::width (4 doubles, or 8 floats in single precision)
+		for( Particles::particleIdx_t n = begin; n < end; n += vec::width ){
+
+			// Lanes of real particles, the padding particles keep a zero velocity
+			const vec::type valid = vec::first_lanes((long long) num_particles - (long long) n);
+			const int valid_lanes = vec::movemask(valid);
+
+			const vec::type x_batch = vec::load_aligned(particles_.x.batch(n));
+			const vec::type y_batch = vec::load_aligned(particles_.y.batch(n));
+			const vec::type z_batch = vec::load_aligned(particles_.z.batch(n));
+
+			// Cells and weights of the particles, shared by the three
+			// components, and the boundary cells (whose indices are the same
+			// as in Particles::get_cell_index)
+			const Mac3d::BatchStencil stencil = MACGrid_->compute_stencil_batch(x_batch, y_batch, z_batch);
+			const int on_boundary = MACGrid_->stencil_on_boundary(stencil) & valid_lanes;
+
+			if( on_boundary != valid_lanes ){
+
+				// Get updated velocities by interpolation of the blended fields
+				vec::store_aligned(interp[0], vec::bit_and(valid, vec::fmadd(coeff_internal_vec, vec::load_aligned(particles_.u.batch(n)),
+				                   MACGrid_->grid_interpolate_batch<Mac3d::GRID_U, Mac3d::GHOST_BLEND>(stencil))));
+				vec::store_aligned(interp[1], vec::bit_and(valid, vec::fmadd(coeff_internal_vec, vec::load_aligned(particles_.v.batch(n)),
+				                   MACGrid_->grid_interpolate_batch<Mac3d::GRID_V, Mac3d::GHOST_BLEND>(stencil))));
+				vec::store_aligned(interp[2], vec::bit_and(valid, vec::fmadd(coeff_internal_vec, vec::load_aligned(particles_.w.batch(n)),
+				                   MACGrid_->grid_interpolate_batch<Mac3d::GRID_W, Mac3d::GHOST_BLEND>(stencil))));
+			}
+			else{
+				vec::store_aligned(interp[0], vec::zero());
+				vec::store_aligned(interp[1], vec::zero());
+				vec::store_aligned(interp[2], vec::zero());
+			}
+
+			for( unsigned b = 0; b < vec::width; ++b ){
+
+				if( not (on_boundary >> b & 1) ) continue;
+
+				// On the boundary, blend PIC and FLIP with double the amount of
+				// PIC, from both fields
+				const double x = particles_.x[n + b];
+				const double y = particles_.y[n + b];
+				const double z = particles_.z[n + b];
+
+				double interp_u_star, interp_v_star, interp_w_star;
+				double interp_u_n1, interp_v_n1, interp_w_n1;
+				std::tie(interp_u_n1, interp_u_star) = MACGrid_->grid_interpolate<Mac3d::GRID_U, Mac3d::INTERPOLATE_BOTH>(x, y, z);
+				std::tie(interp_v_n1, interp_v_star) = MACGrid_->grid_interpolate<Mac3d::GRID_V, Mac3d::INTERPOLATE_BOTH>(x, y, z);
+				std::tie(interp_w_n1, interp_w_star) = MACGrid_->grid_interpolate<Mac3d::GRID_W, Mac3d::INTERPOLATE_BOTH>(x, y, z);
+
+				interp[0][b] = interp_u_n1 + (particles_.u[n + b] - interp_u_star) * coeff_boundary;
+				interp[1][b] = interp_v_n1 + (particles_.v[n + b] - interp_v_star) * coeff_boundary;
+				interp[2][b] = interp_w_n1 + (particles_.w[n + b] - interp_w_star) * coeff_boundary;
+			}
+
+			// Finally, update the velocities of the particles
+			const vec::type u_batch = vec::load_aligned(interp[0]);
+			const vec::type v_batch = vec::load_aligned(interp[1]);
+			const vec::type w_batch = vec::load_aligned(interp[2]);
+			vec::store_aligned(particles_.u.batch(n), u_batch);
+			vec::store_aligned(particles_.v.batch(n), v_batch);
+			vec::store_aligned(particles_.w.batch(n), w_batch);
+
+			u_max_vec = vec::max(u_max_vec, vec::abs(u_batch));
+			v_max_vec = vec::max(v_max_vec, vec::abs(v_batch));
+			w_max_vec = vec::max(w_max_vec, vec::abs(w_batch));
 		}
 
-		// Finally, update the velocities of the particles
-		particles_.u[n] = u_update;
-		particles_.v[n] = v_update;
-		particles_.w[n] = w_update;
+		u_max = std::max(u_max, vec::max_lane(u_max_vec));
+		v_max = std::max(v_max, vec::max_lane(v_max_vec));
+		w_max = std::max(w_max, vec::max_lane(w_max_vec));
 	}
-}
\ No newline at end of file
+
+	u_max_ = u_max;
+	v_max_ = v_max;
+	w_max_ = w_max;
+}
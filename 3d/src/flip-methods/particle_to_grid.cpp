@@ -7,7 +7,10 @@
 #include <immintrin.h>
 
 
-void FLIP::particle_to_grid() {
+void FLIP::particle_to_grid_slab( const int k_begin,
+								  const int k_end,
+								  const Particles::particleIdx_t* const slab_particles,
+								  const Particles::particleIdx_t num_slab_particles ) {
 
 	// Grid dimensions
 	const Mac3d::cellIdx_t nx = MACGrid_->N_;
@@ -34,44 +37,6 @@ void FLIP::particle_to_grid() {
 	const int hy_scaled = std::ceil(h/cell_size_y);
 	const int hz_scaled = std::ceil(h/cell_size_z);
 
-	// Lists of flags for visited grid-velocities: 1 -> visited
-	bool* visited_u = (bool*) calloc(ny*nz*(nx+1), sizeof(bool));
-	bool* visited_v = (bool*) calloc(nx*nz*(ny+1), sizeof(bool));
-	bool* visited_w = (bool*) calloc(nx*ny*(nz+1), sizeof(bool));
-
-	// Set all grid velocities to zero and reset all fluid flags
-	MACGrid_->set_velocities_to_zero();
-	MACGrid_->set_weights_to_zero();
-	MACGrid_->reset_fluid();
-
-	// Counters of nearby visited faces (to average the neighboring velocities 
-	// during extrapolation)
-	short u_counter;
-	short v_counter;
-	short w_counter;
-
-	// Nearby faces velocities
-	double u_left;
-	double u_right;
-	double u_down;
-	double u_up;
-	double u_back;
-	double u_front;
-
-	double v_left;
-	double v_right;
-	double v_down;
-	double v_up;
-	double v_back;
-	double v_front;
-
-	double w_left;
-	double w_right;
-	double w_down;
-	double w_up;
-	double w_back;
-	double w_front;
-
 	// Position and velocity of the current particle
 	double x_particle;
 	double y_particle;
@@ -91,61 +56,39 @@ void FLIP::particle_to_grid() {
 	double y_diff;
 	double z_diff;
 
-	// Temporary variables to store weights and remove aliasing
-	double u_weight_1;
-	double u_weight_2;
-	double u_weight_3;
-	double u_weight_4;
-	double v_weight_1;
-	double v_weight_2;
-	double v_weight_3;
-	double v_weight_4;
-	double w_weight_1;
-	double w_weight_2;
-	double w_weight_3;
-	double w_weight_4;
+	// Weights of the current particle
+	double u_weight;
+	double v_weight;
+	double w_weight;
 
 	// Placeholders for the global indices of u, v and w
 	Mac3d::globalCellIdx_t u_idx;
 	Mac3d::globalCellIdx_t v_idx;
 	Mac3d::globalCellIdx_t w_idx;
 
-	Mac3d::globalCellIdx_t u_size  = ny*nz*(nx+1);
-	Mac3d::globalCellIdx_t v_size  = nx*nz*(ny+1);
-	Mac3d::globalCellIdx_t w_size  = nx*ny*(nz+1);
-	Mac3d::globalCellIdx_t uu_size = u_size - 7;
-	Mac3d::globalCellIdx_t vv_size = v_size - 7;
-	Mac3d::globalCellIdx_t ww_size = w_size - 7;
-	Mac3d::globalCellIdx_t u_gbi;
-	Mac3d::globalCellIdx_t v_gbi;
-	Mac3d::globalCellIdx_t w_gbi;
-
-	__m256d u_weight1;
-	__m256d u_weight2;
-	__m256d v_weight1;
-	__m256d v_weight2;
-	__m256d w_weight1;
-	__m256d w_weight2;
-	__m256d u1;
-	__m256d u2;
-	__m256d v1;
-	__m256d v2;
-	__m256d w1;
-	__m256d w2;
-	__m256d neq_zero1;
-	__m256d neq_zero2;
-	__m256d zeros = _mm256_setzero_pd();
-	__m256d ones  = _mm256_set1_pd(1.);
-
-	int neq_zero_int1;
-	int neq_zero_int2;
-
 	// Indices of the cell containing the current particle
 	int cell_idx_x;
 	int cell_idx_y;
 	int cell_idx_z;
 
-	for( Particles::particleIdx_t n = 0; n < num_particles_; ++n ){
+	// Constants of the vectorized interior path
+	const __m256i lanes_i            = _mm256_set_epi64x(3, 2, 1, 0);
+	const __m256d lanes_d            = _mm256_set_pd(3., 2., 1., 0.);
+	const __m256d cell_size_x_v      = _mm256_set1_pd(cell_size_x);
+	const __m256d cell_size_x_half_v = _mm256_set1_pd(cell_size_x_half);
+	const __m256d h2_v               = _mm256_set1_pd(h2);
+	const __m256d coeff_v            = _mm256_set1_pd(coeff);
+	const __m256d zeros              = _mm256_setzero_pd();
+
+	for( Particles::particleIdx_t p = 0; p < num_slab_particles; ++p ){
+		const Particles::particleIdx_t n = slab_particles ? slab_particles[p] : p;
+
+		// Get the indices corresponding to the cell containing the
+		// current particle
+		particles_.get_cell_index(n, cell_idx_x, cell_idx_y, cell_idx_z);
+
+		// Skip the particles which do not reach the slab
+		if( cell_idx_z + hz_scaled + 1 < k_begin or cell_idx_z - hz_scaled >= k_end ) continue;
 
 		// Get the position and velocity of the current particle
 		x_particle = particles_.x[n];
@@ -155,14 +98,15 @@ void FLIP::particle_to_grid() {
 		v_particle = particles_.v[n];
 		w_particle = particles_.w[n];
 
-		// Get the indices corresponding to the cell containing the
-		// current particle
-		particles_.get_cell_index(n, cell_idx_x, cell_idx_y, cell_idx_z);
+		const __m256d x_particle_v = _mm256_set1_pd(x_particle);
+		const __m256d u_particle_v = _mm256_set1_pd(u_particle);
+		const __m256d v_particle_v = _mm256_set1_pd(v_particle);
+		const __m256d w_particle_v = _mm256_set1_pd(w_particle);
 
 		// Set the cell of the current particle to a fluid-cell
-		if( !(MACGrid_->pfluid_[cell_idx_x + nx*cell_idx_y + nx*ny*cell_idx_z] or MACGrid_->psolid_[cell_idx_x + nx*cell_idx_y + nx*ny*cell_idx_z]) ){
+		if( cell_idx_z >= k_begin and cell_idx_z < k_end and !(MACGrid_->pfluid_[cell_idx_x + nx * Mac3d::globalCellIdx_t(cell_idx_y + ny*cell_idx_z)] or MACGrid_->psolid_[cell_idx_x + nx * Mac3d::globalCellIdx_t(cell_idx_y + ny*cell_idx_z)]) ){
 			
-			MACGrid_->pfluid_[cell_idx_x + nx*cell_idx_y + nx*ny*cell_idx_z] = true;
+			MACGrid_->pfluid_[cell_idx_x + nx * Mac3d::globalCellIdx_t(cell_idx_y + ny*cell_idx_z)] = true;
 		}
 
 		// For each particle iterate only over the grid-velocities in a
@@ -171,63 +115,92 @@ void FLIP::particle_to_grid() {
 			cell_idx_x <  nx - hx_scaled - 1 and cell_idx_y <  ny - hy_scaled - 1 and cell_idx_z <  nz - hz_scaled - 1 )
 		{
 
-			for( Mac3d::cellIdx_t k = cell_idx_z - hz_scaled; k <= cell_idx_z + hz_scaled + 1; ++k ){
-			for( Mac3d::cellIdx_t j = cell_idx_y - hy_scaled; j <= cell_idx_y + hy_scaled + 1; ++j ){
-			for( Mac3d::cellIdx_t i = cell_idx_x - hx_scaled; i <= cell_idx_x + hx_scaled + 1; ++i ){
-
-						rx = x_particle - i * cell_size_x;
-						ry = y_particle - j * cell_size_y;
-						rz = z_particle - k * cell_size_z;
-
-						x_diff = h2 - ry*ry - rz*rz - (rx + cell_size_x_half)*(rx + cell_size_x_half);
-						y_diff = h2 - rx*rx - rz*rz - (ry + cell_size_y_half)*(ry + cell_size_y_half);
-						z_diff = h2 - rx*rx - ry*ry - (rz + cell_size_z_half)*(rz + cell_size_z_half);
-						
-						// If the current particle is within the given threshold h, update
-						// the horizontal grid-velocity at grid_coord with the weighted
-						// particle-velocity
-
-						// Left Face
-						if( x_diff >= 0. ){
-
-							u_weight_1 = coeff * x_diff * x_diff * x_diff;
-
-							u_idx = i + (nx+1) * (j + ny*k);
-
-							MACGrid_->pu_[u_idx]         += u_weight_1 * u_particle;
-							MACGrid_->pweights_u_[u_idx] += u_weight_1;
-						}
-						
-						// Lower Face
-						if( y_diff >= 0. ){
-
-							v_weight_1 = coeff * y_diff * y_diff * y_diff;
+			// The faces of a row along x are processed 4 at a time with AVX2,
+			// the rest of the row (2 faces) with masked loads and stores. Faces
+			// beyond the threshold h get zero weight
+			const int i_begin = cell_idx_x - hx_scaled;
+			const int i_end   = cell_idx_x + hx_scaled + 1;
 
-							v_idx = i + nx * (j + (ny+1) * k);
-
-							MACGrid_->pv_[v_idx]         += v_weight_1 * v_particle;
-							MACGrid_->pweights_v_[v_idx] += v_weight_1;
-						}
-
-						// Farthest Face (the closest to the origin)
-						if( z_diff >= 0. ){
-
-							w_weight_1 = coeff * z_diff * z_diff * z_diff;
-
-							w_idx = i + nx * (j + ny*k);
+			for( Mac3d::cellIdx_t k = std::max(cell_idx_z - hz_scaled, k_begin); k <= std::min(cell_idx_z + hz_scaled + 1, k_end - 1); ++k ){
+			for( Mac3d::cellIdx_t j = cell_idx_y - hy_scaled; j <= cell_idx_y + hy_scaled + 1; ++j ){
 
-							MACGrid_->pw_[w_idx]         += w_weight_1 * w_particle;
-							MACGrid_->pweights_w_[w_idx] += w_weight_1;
-						}
-					}
+				ry = y_particle - j * cell_size_y;
+				rz = z_particle - k * cell_size_z;
+
+				// Skip the rows which are entirely beyond the threshold h
+				const double yz_diff  = h2 - ry*ry - rz*rz;
+				const double ry_h2    = (ry + cell_size_y_half)*(ry + cell_size_y_half);
+				const double rz_h2    = (rz + cell_size_z_half)*(rz + cell_size_z_half);
+				if( yz_diff < 0. and h2 - rz*rz - ry_h2 < 0. and h2 - ry*ry - rz_h2 < 0. ) continue;
+
+				MACGrid_->touch_row(j, k);
+
+				const __m256d ry2  = _mm256_set1_pd(ry*ry);
+				const __m256d rz2  = _mm256_set1_pd(rz*rz);
+				const __m256d ry_h = _mm256_set1_pd(ry_h2);
+				const __m256d rz_h = _mm256_set1_pd(rz_h2);
+				const __m256d x_yz = _mm256_set1_pd(yz_diff);
+
+				u_idx = (nx+1) * Mac3d::globalCellIdx_t(j + ny*k);
+				v_idx = nx * Mac3d::globalCellIdx_t(j + (ny+1) * k);
+				w_idx = nx * Mac3d::globalCellIdx_t(j + ny*k);
+
+				// Accumulate on the 4 faces starting at i, with the given loads and stores
+				auto accumulate_faces = [&]( const int i, const auto& load, const auto& store ){
+
+					const __m256d rx_v = _mm256_sub_pd(x_particle_v, _mm256_mul_pd(_mm256_add_pd(_mm256_set1_pd(i), lanes_d), cell_size_x_v));
+					const __m256d rx_h = _mm256_add_pd(rx_v, cell_size_x_half_v);
+					const __m256d rx2  = _mm256_mul_pd(rx_v, rx_v);
+
+					const __m256d x_diff_v = _mm256_sub_pd(x_yz, _mm256_mul_pd(rx_h, rx_h));
+					const __m256d y_diff_v = _mm256_sub_pd(_mm256_sub_pd(_mm256_sub_pd(h2_v, rx2), rz2), ry_h);
+					const __m256d z_diff_v = _mm256_sub_pd(_mm256_sub_pd(_mm256_sub_pd(h2_v, rx2), ry2), rz_h);
+
+					const __m256d u_weight_v = _mm256_and_pd(_mm256_cmp_pd(x_diff_v, zeros, _CMP_GE_OQ),
+						_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(coeff_v, x_diff_v), x_diff_v), x_diff_v));
+					const __m256d v_weight_v = _mm256_and_pd(_mm256_cmp_pd(y_diff_v, zeros, _CMP_GE_OQ),
+						_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(coeff_v, y_diff_v), y_diff_v), y_diff_v));
+					const __m256d w_weight_v = _mm256_and_pd(_mm256_cmp_pd(z_diff_v, zeros, _CMP_GE_OQ),
+						_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(coeff_v, z_diff_v), z_diff_v), z_diff_v));
+
+					// Left Face
+					real_t* const pu  = MACGrid_->pu_ + u_idx + i;
+					real_t* const pwu = MACGrid_->pweights_u_ + u_idx + i;
+					store(pu,  _mm256_fmadd_pd(u_weight_v, u_particle_v, load(pu)));
+					store(pwu, _mm256_add_pd(load(pwu), u_weight_v));
+
+					// Lower Face
+					real_t* const pv  = MACGrid_->pv_ + v_idx + i;
+					real_t* const pwv = MACGrid_->pweights_v_ + v_idx + i;
+					store(pv,  _mm256_fmadd_pd(v_weight_v, v_particle_v, load(pv)));
+					store(pwv, _mm256_add_pd(load(pwv), v_weight_v));
+
+					// Farthest Face (the closest to the origin)
+					real_t* const pw  = MACGrid_->pw_ + w_idx + i;
+					real_t* const pww = MACGrid_->pweights_w_ + w_idx + i;
+					store(pw,  _mm256_fmadd_pd(w_weight_v, w_particle_v, load(pw)));
+					store(pww, _mm256_add_pd(load(pww), w_weight_v));
+				};
+
+				int i = i_begin;
+				for( ; i + 3 <= i_end; i += 4 ){
+					accumulate_faces(i, [](const real_t* const p){ return simd::load(p); },
+					                    [](real_t* const p, const __m256d a){ simd::store(p, a); });
+				}
+				if( i <= i_end ){
+					const __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(i_end - i + 1), lanes_i);
+					accumulate_faces(i, [&](const real_t* const p){ return simd::maskload(p, mask); },
+					                    [&](real_t* const p, const __m256d a){ simd::maskstore(p, mask, a); });
 				}
 			}
+			}
 
 		}
 		else{
 
-			for( int k = cell_idx_z - hz_scaled; k <= cell_idx_z + hz_scaled + 1; ++k ){
+			for( int k = std::max(cell_idx_z - hz_scaled, k_begin); k <= std::min(cell_idx_z + hz_scaled + 1, k_end - 1); ++k ){
 			for( int j = cell_idx_y - hy_scaled; j <= cell_idx_y + hy_scaled + 1; ++j ){
+			MACGrid_->touch_row(j, k);
 			for( int i = cell_idx_x - hx_scaled; i <= cell_idx_x + hx_scaled + 1; ++i ){
 
 						if( i >= 0 and j >= 0 and k >= 0 ){
@@ -247,12 +220,12 @@ void FLIP::particle_to_grid() {
 
 								if( x_diff >= 0. ){
 
-									u_weight_1 = coeff * x_diff * x_diff * x_diff;
+									u_weight = coeff * x_diff * x_diff * x_diff;
 
-									u_idx = i + (nx+1) * (j + ny*k);
+									u_idx = i + (nx+1) * Mac3d::globalCellIdx_t(j + ny*k);
 
-									MACGrid_->pu_[u_idx]         += u_weight_1 * u_particle;
-									MACGrid_->pweights_u_[u_idx] += u_weight_1;
+									MACGrid_->pu_[u_idx]         += u_weight * u_particle;
+									MACGrid_->pweights_u_[u_idx] += u_weight;
 								}
 							}
 							
@@ -263,12 +236,12 @@ void FLIP::particle_to_grid() {
 
 								if( y_diff >= 0. ){
 
-									v_weight_1 = coeff * y_diff * y_diff * y_diff;
+									v_weight = coeff * y_diff * y_diff * y_diff;
 
-									v_idx = i + nx * (j + (ny+1)*k);
+									v_idx = i + nx * Mac3d::globalCellIdx_t(j + (ny+1)*k);
 
-									MACGrid_->pv_[v_idx]         += v_weight_1 * v_particle;
-									MACGrid_->pweights_v_[v_idx] += v_weight_1;
+									MACGrid_->pv_[v_idx]         += v_weight * v_particle;
+									MACGrid_->pweights_v_[v_idx] += v_weight;
 								}
 							}
 
@@ -279,12 +252,12 @@ void FLIP::particle_to_grid() {
 
 								if( z_diff >= 0. ){
 
-									w_weight_1 = coeff * z_diff * z_diff * z_diff;
+									w_weight = coeff * z_diff * z_diff * z_diff;
 
-									w_idx = i + nx * (j + ny*k);
+									w_idx = i + nx * Mac3d::globalCellIdx_t(j + ny*k);
 
-									MACGrid_->pw_[w_idx]         += w_weight_1 * w_particle;
-									MACGrid_->pweights_w_[w_idx] += w_weight_1;
+									MACGrid_->pw_[w_idx]         += w_weight * w_particle;
+									MACGrid_->pweights_w_[w_idx] += w_weight;
 								}
 							}
 						}
@@ -294,306 +267,740 @@ void FLIP::particle_to_grid() {
 
 		}
 	}
-	
-	for( u_gbi = 0; u_gbi < uu_size; u_gbi += 8 ){
-
-		u_weight1 = _mm256_load_pd(MACGrid_->pweights_u_+u_gbi);
-		u_weight2 = _mm256_load_pd(MACGrid_->pweights_u_+u_gbi+4);
-		u1        = _mm256_load_pd(MACGrid_->pu_+u_gbi);
-		u2        = _mm256_load_pd(MACGrid_->pu_+u_gbi+4);
-
-		neq_zero1     = _mm256_cmp_pd(u_weight1, zeros, _CMP_NEQ_OQ);
-		neq_zero2     = _mm256_cmp_pd(u_weight2, zeros, _CMP_NEQ_OQ);
-		neq_zero_int1 = _mm256_movemask_pd(neq_zero1);
-		neq_zero_int2 = _mm256_movemask_pd(neq_zero2);
-
-		u1 = _mm256_div_pd(u1, _mm256_blendv_pd(ones, u_weight1, neq_zero1));
-		u2 = _mm256_div_pd(u2, _mm256_blendv_pd(ones, u_weight2, neq_zero2));
-
-		visited_u[u_gbi  ] =  neq_zero_int1       & 0b1;
-		visited_u[u_gbi+1] = (neq_zero_int1 >> 1) & 0b1;
-		visited_u[u_gbi+2] = (neq_zero_int1 >> 2) & 0b1;
-		visited_u[u_gbi+3] = (neq_zero_int1 >> 3) & 0b1;
-		visited_u[u_gbi+4] = (neq_zero_int2     ) & 0b1;
-		visited_u[u_gbi+5] = (neq_zero_int2 >> 1) & 0b1;
-		visited_u[u_gbi+6] = (neq_zero_int2 >> 2) & 0b1;
-		visited_u[u_gbi+7] = (neq_zero_int2 >> 3) & 0b1;
-
-		_mm256_store_pd(MACGrid_->pu_+u_gbi  , u1);
-		_mm256_store_pd(MACGrid_->pu_+u_gbi+4, u2);
-	}
-	for( ; u_gbi < u_size; ++u_gbi ){
+}
 
-		u_weight_1 = MACGrid_->pweights_u_[u_gbi];
 
-		if( u_weight_1 != 0. ) { MACGrid_->pu_[u_gbi] /= u_weight_1; visited_u[u_gbi] = true; }
+/**
+ * Weights of the B-spline of the given width (2: linear, 3: quadratic) at
+ * position g in grid coordinates, for the grid points base, ..., base+width-1
+ */
+template <int width>
+static inline void bspline_weights( const double g, int& base, double* const weights ){
+
+	if( width == 2 ){
+		base = std::floor(g);
+		const double f = g - base;
+		weights[0] = 1. - f;
+		weights[1] = f;
 	}
+	else{
+		base = std::floor(g + 0.5) - 1;
+		const double f = g - base;
+		weights[0] = 0.5 * (1.5 - f) * (1.5 - f);
+		weights[1] = 0.75 - (f - 1.) * (f - 1.);
+		weights[2] = 0.5 * (f - 0.5) * (f - 0.5);
+	}
+}
 
-	for( v_gbi = 0; v_gbi < vv_size; v_gbi += 8 ){
 
-		v_weight1 = _mm256_load_pd(MACGrid_->pweights_v_+v_gbi);
-		v_weight2 = _mm256_load_pd(MACGrid_->pweights_v_+v_gbi+4);
-		v1        = _mm256_load_pd(MACGrid_->pv_+v_gbi);
-		v2        = _mm256_load_pd(MACGrid_->pv_+v_gbi+4);
+template <int width>
+void FLIP::particle_to_grid_slab_bspline( const int k_begin,
+										  const int k_end,
+										  const Particles::particleIdx_t* const slab_particles,
+										  const Particles::particleIdx_t num_slab_particles ) {
 
-		neq_zero1     = _mm256_cmp_pd(v_weight1, zeros, _CMP_NEQ_OQ);
-		neq_zero2     = _mm256_cmp_pd(v_weight2, zeros, _CMP_NEQ_OQ);
-		neq_zero_int1 = _mm256_movemask_pd(neq_zero1);
-		neq_zero_int2 = _mm256_movemask_pd(neq_zero2);
+	// Grid dimensions
+	const Mac3d::cellIdx_t nx = MACGrid_->N_;
+	const Mac3d::cellIdx_t ny = MACGrid_->M_;
+	const Mac3d::cellIdx_t nz = MACGrid_->L_;
 
-		v1 = _mm256_div_pd(v1, _mm256_blendv_pd(ones, v_weight1, neq_zero1));
-		v2 = _mm256_div_pd(v2, _mm256_blendv_pd(ones, v_weight2, neq_zero2));
+	// 1 / cell_size_xyz
+	const double rcell_size_x = 1. / MACGrid_->cell_sizex_;
+	const double rcell_size_y = 1. / MACGrid_->cell_sizey_;
+	const double rcell_size_z = 1. / MACGrid_->cell_sizez_;
 
-		visited_v[v_gbi  ] =  neq_zero_int1       & 0b1;
-		visited_v[v_gbi+1] = (neq_zero_int1 >> 1) & 0b1;
-		visited_v[v_gbi+2] = (neq_zero_int1 >> 2) & 0b1;
-		visited_v[v_gbi+3] = (neq_zero_int1 >> 3) & 0b1;
-		visited_v[v_gbi+4] =  neq_zero_int2       & 0b1;
-		visited_v[v_gbi+5] = (neq_zero_int2 >> 1) & 0b1;
-		visited_v[v_gbi+6] = (neq_zero_int2 >> 2) & 0b1;
-		visited_v[v_gbi+7] = (neq_zero_int2 >> 3) & 0b1;
+	// Per-axis weights and first grid index of the particle, at the cell
+	// centers (c) and at the faces normal to the axis (f), which lie half a
+	// cell below the centers
+	double wx_c[width], wy_c[width], wz_c[width];
+	double wx_f[width], wy_f[width], wz_f[width];
+	int ix_c, iy_c, iz_c;
+	int ix_f, iy_f, iz_f;
 
-		_mm256_store_pd(MACGrid_->pv_+v_gbi  , v1);
-		_mm256_store_pd(MACGrid_->pv_+v_gbi+4, v2);
-	}
-	for( ; v_gbi < v_size; ++v_gbi ){
+	// Indices of the cell containing the current particle
+	int cell_idx_x;
+	int cell_idx_y;
+	int cell_idx_z;
 
-		v_weight_1 = MACGrid_->pweights_v_[v_gbi];
+	for( Particles::particleIdx_t p = 0; p < num_slab_particles; ++p ){
+		const Particles::particleIdx_t n = slab_particles ? slab_particles[p] : p;
 
-		if( v_weight_1 != 0. ) { MACGrid_->pv_[v_gbi] /= v_weight_1; visited_v[v_gbi] = true; }
-	}
+		const double gx = particles_.x[n] * rcell_size_x;
+		const double gy = particles_.y[n] * rcell_size_y;
+		const double gz = particles_.z[n] * rcell_size_z;
 
-	for( w_gbi = 0; w_gbi < ww_size; w_gbi += 8 ){
+		bspline_weights<width>(gz      , iz_c, wz_c);
+		bspline_weights<width>(gz + 0.5, iz_f, wz_f);
 
-		w_weight1 = _mm256_load_pd(MACGrid_->pweights_w_+w_gbi);
-		w_weight2 = _mm256_load_pd(MACGrid_->pweights_w_+w_gbi+4);
-		w1        = _mm256_load_pd(MACGrid_->pw_+w_gbi);
-		w2        = _mm256_load_pd(MACGrid_->pw_+w_gbi+4);
+		// Skip the particles which do not reach the slab
+		if( std::max(iz_c, iz_f) + width - 1 < k_begin or std::min(iz_c, iz_f) >= k_end ) continue;
 
-		neq_zero1     = _mm256_cmp_pd(w_weight1, zeros, _CMP_NEQ_OQ);
-		neq_zero2     = _mm256_cmp_pd(w_weight2, zeros, _CMP_NEQ_OQ);
-		neq_zero_int1 = _mm256_movemask_pd(neq_zero1);
-		neq_zero_int2 = _mm256_movemask_pd(neq_zero2);
+		bspline_weights<width>(gx      , ix_c, wx_c);
+		bspline_weights<width>(gx + 0.5, ix_f, wx_f);
+		bspline_weights<width>(gy      , iy_c, wy_c);
+		bspline_weights<width>(gy + 0.5, iy_f, wy_f);
+
+		const double u_particle = particles_.u[n];
+		const double v_particle = particles_.v[n];
+		const double w_particle = particles_.w[n];
+
+		// Set the cell of the current particle to a fluid-cell
+		particles_.get_cell_index(n, cell_idx_x, cell_idx_y, cell_idx_z);
+		if( cell_idx_z >= k_begin and cell_idx_z < k_end and !(MACGrid_->pfluid_[cell_idx_x + nx * Mac3d::globalCellIdx_t(cell_idx_y + ny*cell_idx_z)] or MACGrid_->psolid_[cell_idx_x + nx * Mac3d::globalCellIdx_t(cell_idx_y + ny*cell_idx_z)]) ){
+
+			MACGrid_->pfluid_[cell_idx_x + nx * Mac3d::globalCellIdx_t(cell_idx_y + ny*cell_idx_z)] = true;
+		}
+
+		// Reset the rows of faces reached by the particle, if not done yet
+		for( int k = std::max(std::min(iz_c, iz_f), k_begin); k <= std::min(std::max(iz_c, iz_f) + width - 1, k_end - 1); ++k ){
+			for( int j = std::min(iy_c, iy_f); j <= std::max(iy_c, iy_f) + width - 1; ++j ) MACGrid_->touch_row(j, k);
+		}
 
-		w1 = _mm256_div_pd(w1, _mm256_blendv_pd(ones, w_weight1, neq_zero1));
-		w2 = _mm256_div_pd(w2, _mm256_blendv_pd(ones, w_weight2, neq_zero2));
+		// Faces outside of the grid are skipped, normalization accounts for the
+		// missing weights
+		for( int c = 0; c < width; ++c ){
+			const int k = iz_c + c;
+			if( k < std::max(k_begin, 0) or k >= std::min(k_end, nz) ) continue;
+			for( int b = 0; b < width; ++b ){
+
+				// Left Face
+				int j = iy_c + b;
+				if( j >= 0 and j < ny ){
+					for( int a = 0; a < width; ++a ){
+						const int i = ix_f + a;
+						if( i < 0 or i > nx ) continue;
+						const double u_weight = wx_f[a] * wy_c[b] * wz_c[c];
+						const Mac3d::globalCellIdx_t u_idx = i + (nx+1) * Mac3d::globalCellIdx_t(j + ny*k);
+						MACGrid_->pu_[u_idx]         += u_weight * u_particle;
+						MACGrid_->pweights_u_[u_idx] += u_weight;
+					}
+				}
 
-		visited_w[w_gbi  ] =  neq_zero_int1       & 0b1;
-		visited_w[w_gbi+1] = (neq_zero_int1 >> 1) & 0b1;
-		visited_w[w_gbi+2] = (neq_zero_int1 >> 2) & 0b1;
-		visited_w[w_gbi+3] = (neq_zero_int1 >> 3) & 0b1;
-		visited_w[w_gbi+4] =  neq_zero_int2       & 0b1; 
-		visited_w[w_gbi+5] = (neq_zero_int2 >> 1) & 0b1;
-		visited_w[w_gbi+6] = (neq_zero_int2 >> 2) & 0b1;
-		visited_w[w_gbi+7] = (neq_zero_int2 >> 3) & 0b1;
+				// Lower Face
+				j = iy_f + b;
+				if( j >= 0 and j <= ny ){
+					for( int a = 0; a < width; ++a ){
+						const int i = ix_c + a;
+						if( i < 0 or i >= nx ) continue;
+						const double v_weight = wx_c[a] * wy_f[b] * wz_c[c];
+						const Mac3d::globalCellIdx_t v_idx = i + nx * Mac3d::globalCellIdx_t(j + (ny+1)*k);
+						MACGrid_->pv_[v_idx]         += v_weight * v_particle;
+						MACGrid_->pweights_v_[v_idx] += v_weight;
+					}
+				}
+			}
+		}
 
-		_mm256_store_pd(MACGrid_->pw_+w_gbi  , w1);
-		_mm256_store_pd(MACGrid_->pw_+w_gbi+4, w2);
+		// Farthest Face (the closest to the origin)
+		for( int c = 0; c < width; ++c ){
+			const int k = iz_f + c;
+			if( k < std::max(k_begin, 0) or k >= std::min(k_end, nz + 1) ) continue;
+			for( int b = 0; b < width; ++b ){
+				const int j = iy_c + b;
+				if( j < 0 or j >= ny ) continue;
+				for( int a = 0; a < width; ++a ){
+					const int i = ix_c + a;
+					if( i < 0 or i >= nx ) continue;
+					const double w_weight = wx_c[a] * wy_c[b] * wz_f[c];
+					const Mac3d::globalCellIdx_t w_idx = i + nx * Mac3d::globalCellIdx_t(j + ny*k);
+					MACGrid_->pw_[w_idx]         += w_weight * w_particle;
+					MACGrid_->pweights_w_[w_idx] += w_weight;
+				}
+			}
+		}
 	}
-	for( ; w_gbi < w_size; ++w_gbi ){
+}
+
+
+/**
+ * Value of the B-spline of the given width (2: linear, 3: quadratic) at
+ * distance d (in cells) from its center
+ */
+template <int width>
+static inline double bspline_weight( const double d ){
+
+	// Written with std::max and a single selection, which compile without
+	// branches
+	const double a = std::abs(d);
+	if( width == 2 ) return std::max(1. - a, 0.);
+	const double outer = std::max(1.5 - a, 0.);
+	return (a < 0.5) ? 0.75 - a*a : 0.5 * outer * outer;
+}
 
-		w_weight_1 = MACGrid_->pweights_w_[w_gbi];
 
-		if( w_weight_1 != 0. ) { MACGrid_->pw_[w_gbi] /= w_weight_1; visited_w[w_gbi] = true; }
+void FLIP::build_cell_list() {
+
+	// Grid dimensions
+	const Mac3d::cellIdx_t nx = MACGrid_->N_;
+	const Mac3d::cellIdx_t ny = MACGrid_->M_;
+	const Mac3d::cellIdx_t nz = MACGrid_->L_;
+	const Mac3d::globalCellIdx_t num_cells = Mac3d::globalCellIdx_t(nx)*ny*nz;
+
+	cell_list_.cell_idx.resize(num_particles_);
+	cell_list_.x.resize(num_particles_);
+	cell_list_.y.resize(num_particles_);
+	cell_list_.z.resize(num_particles_);
+	cell_list_.u.resize(num_particles_);
+	cell_list_.v.resize(num_particles_);
+	cell_list_.w.resize(num_particles_);
+
+	// Count the particles per cell, clamping particles on the domain boundary
+	std::vector<Particles::particleIdx_t>& offsets = cell_list_.offsets;
+	offsets.assign(num_cells + 1, 0);
+	for( Particles::particleIdx_t n = 0; n < num_particles_; ++n ){
+		int cell_idx_x, cell_idx_y, cell_idx_z;
+		particles_.get_cell_index(n, cell_idx_x, cell_idx_y, cell_idx_z);
+		cell_idx_x = std::min(std::max(cell_idx_x, 0), nx - 1);
+		cell_idx_y = std::min(std::max(cell_idx_y, 0), ny - 1);
+		cell_idx_z = std::min(std::max(cell_idx_z, 0), nz - 1);
+		cell_list_.cell_idx[n] = cell_idx_x + nx * Mac3d::globalCellIdx_t(cell_idx_y + ny*cell_idx_z);
+		++offsets[cell_list_.cell_idx[n] + 1];
 	}
+	for( Mac3d::globalCellIdx_t c = 0; c < num_cells; ++c ) offsets[c + 1] += offsets[c];
 
-	// Normalize the accumulated velocities with the accumulated weights and 
-	// set the flags for the visited faces
-	// for( Mac3d::cellIdx_t k = 0; k < nz; ++k ){
-	// 	for( Mac3d::cellIdx_t j = 0; j < ny; ++j ){
-	// 		for( Mac3d::cellIdx_t i = 0; i < nx; ++i ){
-				
-	// 			u_idx = i + (nx+1) * (j +  ny    * k);
-	// 			v_idx = i +  nx    * (j + (ny+1) * k);
-	// 			w_idx = i +  nx    * (j +  ny    * k);
-
-	// 			u_weight = MACGrid_->pweights_u_[u_idx];
-	// 			v_weight = MACGrid_->pweights_v_[v_idx];
-	// 			w_weight = MACGrid_->pweights_w_[w_idx];
-				
-	// 			if( u_weight != 0. ){
-					
-	// 				MACGrid_->pu_[u_idx] /= u_weight;
-	// 				visited_u[u_idx] = true;
-	// 			}
-
-	// 			if( v_weight != 0. ){
-					
-	// 				MACGrid_->pv_[v_idx] /= v_weight;
-	// 				visited_v[v_idx] = true;
-	// 			}
-
-	// 			if( w_weight != 0. ){
-					
-	// 				MACGrid_->pw_[w_idx] /= w_weight;
-	// 				visited_w[w_idx] = true;
-	// 			}
-	// 		}	
-	// 	}
-	// }
-
-	// for( Mac3d::cellIdx_t k = 0; k < nz; ++k ){
-	// 	for( Mac3d::cellIdx_t j = 0; j < ny; ++j ){
-			
-	// 		u_idx = nx + (nx+1) * (j + ny*k);
+	// Copy the particles in the order of their cells (stable, so the particles
+	// of a cell keep their order), using the offsets as insertion positions
+	for( Particles::particleIdx_t n = 0; n < num_particles_; ++n ){
+		const Particles::particleIdx_t pos = offsets[cell_list_.cell_idx[n]]++;
+		cell_list_.x[pos] = particles_.x[n];
+		cell_list_.y[pos] = particles_.y[n];
+		cell_list_.z[pos] = particles_.z[n];
+		cell_list_.u[pos] = particles_.u[n];
+		cell_list_.v[pos] = particles_.v[n];
+		cell_list_.w[pos] = particles_.w[n];
+	}
 
-	// 		u_weight = MACGrid_->pweights_u_[u_idx];
+	// Restore the offsets to the first particle of each cell
+	for( Mac3d::globalCellIdx_t c = num_cells; c > 0; --c ) offsets[c] = offsets[c - 1];
+	offsets[0] = 0;
+}
 
-	// 		if ( u_weight != 0. ){
-				
-	// 			MACGrid_->pu_[u_idx] /= u_weight;
-	// 			visited_u[u_idx] = true;
-	// 		}
-	// 	}
-	// }
 
-	// for( Mac3d::cellIdx_t k = 0; k < nz; ++k ){
-	// 	for( Mac3d::cellIdx_t i = 0; i < nx; ++i ){
-			
-	// 		v_idx = i + nx * (ny * (k+1) + k);
+template <FLIP::P2G_KERNEL kernel>
+void FLIP::particle_to_grid_gather() {
 
-	// 		v_weight = MACGrid_->pweights_v_[v_idx];
+	build_cell_list();
 
-	// 		if ( v_weight != 0. ){
-				
-	// 			MACGrid_->pv_[v_idx] /= v_weight;
-	// 			visited_v[v_idx] = true;
-	// 		}
-	// 	}
-	// }
+	// Grid dimensions
+	const Mac3d::cellIdx_t nx = MACGrid_->N_;
+	const Mac3d::cellIdx_t ny = MACGrid_->M_;
+	const Mac3d::cellIdx_t nz = MACGrid_->L_;
 
-	// for( Mac3d::cellIdx_t j = 0; j < ny; ++j ){
-	// 	for( Mac3d::cellIdx_t i = 0; i < nx; ++i ){
-			
-	// 		w_idx = i + nx * (j + ny * nz);
-
-	// 		w_weight = MACGrid_->pweights_w_[w_idx];
-
-	// 		if ( w_weight != 0. ){
-				
-	// 			MACGrid_->pw_[w_idx] /= w_weight;
-	// 			visited_w[w_idx] = true;
-	// 		}
-	// 	}
-	// }
-
-	// Iterate over all horizontal grid-velocities and extrapolate into
-	// the air cells (not visited) the average velocities of the
-	// neighboring fluid/visited cells
-	for( Mac3d::cellIdx_t k = 0; k < nz; ++k ){
-		for( Mac3d::cellIdx_t j = 0; j < ny; ++j ){
-			for( Mac3d::cellIdx_t i = 0; i < nx; ++i ){
-				
-				u_idx = i + (nx+1) * (j +  ny    * k);
-				v_idx = i +  nx    * (j + (ny+1) * k);
-				w_idx = i +  nx    * (j +  ny    * k);
-
-				if( !visited_u[u_idx] ){
-
-					u_counter = 0;
-					
-					if( visited_u[u_idx-1        ] and i > 0    ) { u_left  = MACGrid_->pu_[u_idx-1        ]; ++u_counter; } else { u_left  = 0.; } // Left
-					if( visited_u[u_idx+1        ]              ) { u_right = MACGrid_->pu_[u_idx+1        ]; ++u_counter; } else { u_right = 0.; } // Right
-					if( visited_u[u_idx-(nx+1)   ] and j > 0    ) { u_down  = MACGrid_->pu_[u_idx-(nx+1)   ]; ++u_counter; } else { u_down  = 0.; } // Down
-					if( visited_u[u_idx+(nx+1)   ] and j < ny-1 ) { u_up    = MACGrid_->pu_[u_idx+(nx+1)   ]; ++u_counter; } else { u_up    = 0.; } // Up
-					if( visited_u[u_idx-(nx+1)*ny] and k > 0    ) { u_back  = MACGrid_->pu_[u_idx-(nx+1)*ny]; ++u_counter; } else { u_back  = 0.; } // Back
-					if( visited_u[u_idx+(nx+1)*ny] and k < nz-1 ) { u_front = MACGrid_->pu_[u_idx+(nx+1)*ny]; ++u_counter; } else { u_front = 0.; } // Front
-
-					if(u_counter != 0) MACGrid_->pu_[u_idx] = (u_left + u_right + u_down + u_up + u_back + u_front) / u_counter;
-				}
+	// Sizes of the edges of a cell (in meters)
+	const double cell_size_x = MACGrid_->cell_sizex_;
+	const double cell_size_y = MACGrid_->cell_sizey_;
+	const double cell_size_z = MACGrid_->cell_sizez_;
 
-				if( !visited_v[v_idx] ){
+	const double cell_size_x_half = 0.5 * cell_size_x;
+	const double cell_size_y_half = 0.5 * cell_size_y;
+	const double cell_size_z_half = 0.5 * cell_size_z;
 
-					v_counter = 0;
-					
-					if( visited_v[v_idx-1        ] and i > 0    ) { v_left  = MACGrid_->pv_[v_idx-1        ]; ++v_counter; } else { v_left  = 0.; } // Left
-					if( visited_v[v_idx+1        ] and i < nx-1 ) { v_right = MACGrid_->pv_[v_idx+1        ]; ++v_counter; } else { v_right = 0.; } // Right
-					if( visited_v[v_idx-nx       ] and j > 0    ) { v_down  = MACGrid_->pv_[v_idx-nx       ]; ++v_counter; } else { v_down  = 0.; } // Down
-					if( visited_v[v_idx+nx       ]              ) { v_up    = MACGrid_->pv_[v_idx+nx       ]; ++v_counter; } else { v_up    = 0.; } // Up
-					if( visited_v[v_idx-nx*(ny+1)] and k > 0    ) { v_back  = MACGrid_->pv_[v_idx-nx*(ny+1)]; ++v_counter; } else { v_back  = 0.; } // Back
-					if( visited_v[v_idx+nx*(ny+1)] and k < nz-1 ) { v_front = MACGrid_->pv_[v_idx+nx*(ny+1)]; ++v_counter; } else { v_front = 0.; } // Front
+	const double rcell_size_x = 1. / cell_size_x;
+	const double rcell_size_y = 1. / cell_size_y;
+	const double rcell_size_z = 1. / cell_size_z;
 
-					if(v_counter != 0) MACGrid_->pv_[v_idx] = (v_left + v_right + v_down + v_up + v_back + v_front) / v_counter;
-				}
+	// Threshold h and coefficient for weight computation of the SPH kernel
+	const double h     = 2. * cell_size_x;
+	const double h2    = h*h;
+	const double h4    = h2*h2;
+	const double coeff = 315./(64. * M_PI * h4*h4*h);
+
+	// The faces with indices i, j, k receive contributions from the particles
+	// in the cells i - reach - lower, ..., i + reach (and likewise along y and
+	// z); the faces of the SPH kernel and the quadratic B-spline reach one cell
+	// further down than those of the trilinear kernel
+	const int reach_x = (kernel == P2G_KERNEL_SPH) ? std::ceil(h/cell_size_x) : 1;
+	const int reach_y = (kernel == P2G_KERNEL_SPH) ? std::ceil(h/cell_size_y) : 1;
+	const int reach_z = (kernel == P2G_KERNEL_SPH) ? std::ceil(h/cell_size_z) : 1;
+	const int lower   = (kernel == P2G_KERNEL_TRILINEAR) ? 0 : 1;
+
+	const Particles::particleIdx_t* const offsets = cell_list_.offsets.data();
+	const real_t* const px = cell_list_.x.data();
+	const real_t* const py = cell_list_.y.data();
+	const real_t* const pz = cell_list_.z.data();
+	const real_t* const pu = cell_list_.u.data();
+	const real_t* const pv = cell_list_.v.data();
+	const real_t* const pw = cell_list_.w.data();
+
+	// Every face is written by one thread only, and sums its contributions in
+	// the order of the cell list: the result does not depend on the number of
+	// threads
+	#pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads_) if(num_threads_ > 1)
+	for( Mac3d::cellIdx_t k = 0; k <= nz; ++k ){
+		for( Mac3d::cellIdx_t j = 0; j <= ny; ++j ){
+
+			// All the faces of the row are written below
+			MACGrid_->prow_generation_[j + (ny+1)*k] = MACGrid_->p2g_generation_;
+
+			for( Mac3d::cellIdx_t i = 0; i <= nx; ++i ){
+
+				// Faces which exist at these indices
+				const bool has_u = j < ny and k < nz;
+				const bool has_v = i < nx and k < nz;
+				const bool has_w = i < nx and j < ny;
+				if( !(has_u or has_v or has_w) ) continue;
+
+				double u_sum = 0., v_sum = 0., w_sum = 0.;
+				double u_weight_sum = 0., v_weight_sum = 0., w_weight_sum = 0.;
+
+				// The cells of a row are contiguous in the cell list
+				const int ci_begin = std::max(i - reach_x - lower, 0);
+				const int ci_end   = std::min(i + reach_x, nx - 1);
+				for( int ck = std::max(k - reach_z - lower, 0); ck <= std::min(k + reach_z, nz - 1); ++ck ){
+				for( int cj = std::max(j - reach_y - lower, 0); cj <= std::min(j + reach_y, ny - 1); ++cj ){
+
+					const Mac3d::globalCellIdx_t row = nx * Mac3d::globalCellIdx_t(cj + ny*ck);
+					const Particles::particleIdx_t p_end = offsets[row + ci_end + 1];
+					for( Particles::particleIdx_t p = offsets[row + ci_begin]; p < p_end; ++p ){
+
+						double u_weight, v_weight, w_weight;
+						if constexpr( kernel == P2G_KERNEL_SPH ){
+
+							const double rx = px[p] - i * cell_size_x;
+							const double ry = py[p] - j * cell_size_y;
+							const double rz = pz[p] - k * cell_size_z;
+
+							const double x_diff = h2 - ry*ry - rz*rz - (rx + cell_size_x_half)*(rx + cell_size_x_half);
+							const double y_diff = h2 - rx*rx - rz*rz - (ry + cell_size_y_half)*(ry + cell_size_y_half);
+							const double z_diff = h2 - rx*rx - ry*ry - (rz + cell_size_z_half)*(rz + cell_size_z_half);
+
+							u_weight = (x_diff >= 0.) ? coeff * x_diff * x_diff * x_diff : 0.;
+							v_weight = (y_diff >= 0.) ? coeff * y_diff * y_diff * y_diff : 0.;
+							w_weight = (z_diff >= 0.) ? coeff * z_diff * z_diff * z_diff : 0.;
+						}
+						else{
+
+							constexpr int width = (kernel == P2G_KERNEL_TRILINEAR) ? 2 : 3;
+
+							// Distances to the cell center and to the faces, in cells
+							const double dx = px[p] * rcell_size_x - i;
+							const double dy = py[p] * rcell_size_y - j;
+							const double dz = pz[p] * rcell_size_z - k;
 
-				if( !visited_w[w_idx] ){
+							const double wx_c = bspline_weight<width>(dx);
+							const double wy_c = bspline_weight<width>(dy);
+							const double wz_c = bspline_weight<width>(dz);
 
-					w_counter = 0;
-					
-					if( visited_w[w_idx-1    ] and i > 0    ) { w_left  = MACGrid_->pw_[w_idx-1    ]; ++w_counter; } else { w_left  = 0.; } // Left
-					if( visited_w[w_idx+1    ] and i < nx-1 ) { w_right = MACGrid_->pw_[w_idx+1    ]; ++w_counter; } else { w_right = 0.; } // Right
-					if( visited_w[w_idx-nx   ] and j > 0    ) { w_down  = MACGrid_->pw_[w_idx-nx   ]; ++w_counter; } else { w_down  = 0.; } // Down
-					if( visited_w[w_idx+nx   ] and j < ny-1 ) { w_up    = MACGrid_->pw_[w_idx+nx   ]; ++w_counter; } else { w_up    = 0.; } // Up
-					if( visited_w[w_idx-nx*ny] and k > 0    ) { w_back  = MACGrid_->pw_[w_idx-nx*ny]; ++w_counter; } else { w_back  = 0.; } // Back
-					if( visited_w[w_idx+nx*ny]              ) { w_front = MACGrid_->pw_[w_idx+nx*ny]; ++w_counter; } else { w_front = 0.; } // Front
+							u_weight = bspline_weight<width>(dx + 0.5) * wy_c * wz_c;
+							v_weight = wx_c * bspline_weight<width>(dy + 0.5) * wz_c;
+							w_weight = wx_c * wy_c * bspline_weight<width>(dz + 0.5);
+						}
+
+						u_sum += u_weight * pu[p];
+						v_sum += v_weight * pv[p];
+						w_sum += w_weight * pw[p];
+						u_weight_sum += u_weight;
+						v_weight_sum += v_weight;
+						w_weight_sum += w_weight;
+					}
+				}
+				}
+
+				// Normalize the velocities and set the bits of the visited faces
+				// (atomically, as the words of the masks may span two layers)
+				if( has_u ){
+					const Mac3d::globalCellIdx_t u_idx = i + (nx+1) * Mac3d::globalCellIdx_t(j + ny*k);
+					MACGrid_->pweights_u_[u_idx] = u_weight_sum;
+					MACGrid_->pu_[u_idx] = (u_weight_sum != 0.) ? u_sum / u_weight_sum : 0.;
+					if( u_weight_sum != 0. ){
+						#pragma omp atomic
+						MACGrid_->pvisited_u_[u_idx >> 6] |= std::uint64_t(1) << (u_idx & 63);
+					}
+				}
+				if( has_v ){
+					const Mac3d::globalCellIdx_t v_idx = i + nx * Mac3d::globalCellIdx_t(j + (ny+1)*k);
+					MACGrid_->pweights_v_[v_idx] = v_weight_sum;
+					MACGrid_->pv_[v_idx] = (v_weight_sum != 0.) ? v_sum / v_weight_sum : 0.;
+					if( v_weight_sum != 0. ){
+						#pragma omp atomic
+						MACGrid_->pvisited_v_[v_idx >> 6] |= std::uint64_t(1) << (v_idx & 63);
+					}
+				}
+				if( has_w ){
+					const Mac3d::globalCellIdx_t w_idx = i + nx * Mac3d::globalCellIdx_t(j + ny*k);
+					MACGrid_->pweights_w_[w_idx] = w_weight_sum;
+					MACGrid_->pw_[w_idx] = (w_weight_sum != 0.) ? w_sum / w_weight_sum : 0.;
+					if( w_weight_sum != 0. ){
+						#pragma omp atomic
+						MACGrid_->pvisited_w_[w_idx >> 6] |= std::uint64_t(1) << (w_idx & 63);
+					}
+				}
 
-					if(w_counter != 0) MACGrid_->pw_[w_idx] = (w_left + w_right + w_down + w_up + w_back + w_front) / w_counter;
+				// Cells containing particles are fluid cells
+				if( i < nx and j < ny and k < nz ){
+					const Mac3d::globalCellIdx_t cellidx = i + nx * Mac3d::globalCellIdx_t(j + ny*k);
+					MACGrid_->pfluid_[cellidx] = offsets[cellidx + 1] > offsets[cellidx] and !MACGrid_->psolid_[cellidx];
 				}
 			}
 		}
 	}
+}
 
-	for( Mac3d::cellIdx_t k = 0; k < nz; ++k ){
-		for( Mac3d::cellIdx_t j = 0; j < ny; ++j ){
 
-			u_idx = nx + (nx+1) * (j + ny * k);
+void FLIP::particle_to_grid_scatter() {
 
-			if( !visited_u[u_idx] ){
+	// Grid dimensions
+	const Mac3d::cellIdx_t nz = MACGrid_->L_;
+
+	// Reach of the kernel expressed in number of cells along z (the SPH
+	// threshold h, or one cell for the B-splines)
+	const int hz_scaled = (p2g_kernel_ == P2G_KERNEL_SPH) ? std::ceil(2. * MACGrid_->cell_sizex_ / MACGrid_->cell_sizez_) : 1;
+
+	// Accumulate the particle velocities and weights on the faces. The rows of
+	// faces are reset to zero when a particle first reaches them (see
+	// Mac3d::touch_row), the rows which no particle reaches are never cleared.
+	// Every thread writes the faces (and fluid flags) of a slab of z-layers and
+	// visits the particles reaching its slab in order, so each face receives
+	// its contributions in the same order as with one thread: the result does
+	// not depend on the number of threads, and no two threads write the same
+	// face.
+	std::vector<int> slab_begin(num_threads_ + 1, nz + 1);
+	slab_begin[0] = 0;
+	std::vector<Particles::particleIdx_t> slab_offsets(num_threads_ + 1, 0);
+
+	if( num_threads_ > 1 ){
+
+		// Layers [lo, hi] reached by a particle in the cell layer cell_idx_z
+		auto reach = [&]( const int cell_idx_z, int& lo, int& hi ){
+			lo = std::max(cell_idx_z - hz_scaled, 0);
+			hi = std::min(cell_idx_z + hz_scaled + 1, nz);
+		};
+
+		particle_layer_.resize(num_particles_);
+		std::vector<signed_index_t> layer_count(Mac3d::globalCellIdx_t(num_threads_) * (nz + 2), 0);
+		std::vector<Particles::particleIdx_t> slab_count(Mac3d::globalCellIdx_t(num_threads_) * num_threads_, 0);
+		std::vector<int> layer_slab(nz + 1, 0);
+
+		// The particles are binned by slab in three passes over the range of
+		// particles of every thread (see Particles::get_thread_range): the
+		// layers of the particles and the number of particles reaching each
+		// layer, then the number of particles reaching each slab, then the
+		// particle indices, stored per slab in the order of the threads and of
+		// the particles in their range, i.e. in increasing order
+		#pragma omp parallel num_threads(num_threads_)
+		{
+			const int t = omp_get_thread_num();
+			Particles::particleIdx_t begin, end;
+			particles_.get_thread_range(t, omp_get_num_threads(), begin, end);
+			begin = std::min(begin, num_particles_);
+			end   = std::min(end, num_particles_);
+
+			// Count the particles reaching each layer as differences: +1 on
+			// the first layer reached, -1 after the last one
+			signed_index_t* const count = layer_count.data() + Mac3d::globalCellIdx_t(t) * (nz + 2);
+			for( Particles::particleIdx_t n = begin; n < end; ++n ){
+				int cell_idx_x, cell_idx_y, lo, hi;
+				particles_.get_cell_index(n, cell_idx_x, cell_idx_y, particle_layer_[n]);
+				reach(particle_layer_[n], lo, hi);
+				if( lo > hi ) continue;
+				++count[lo];
+				--count[hi + 1];
+			}
+			#pragma omp barrier
+
+			// Balance the slabs by the number of particles reaching each layer
+			#pragma omp single
+			{
+				std::vector<double> layer_work(nz + 1, 0.);
+				signed_index_t num_reaching = 0;
+				double total_work = 0.;
+				for( int k = 0; k <= nz; ++k ){
+					for( int c = 0; c < num_threads_; ++c ) num_reaching += layer_count[Mac3d::globalCellIdx_t(c) * (nz + 2) + k];
+					layer_work[k] = num_reaching;
+					total_work += layer_work[k];
+				}
+				double work = 0.;
+				int slab = 0;
+				for( int k = 0; k <= nz and slab + 1 < num_threads_; ++k ){
+					work += layer_work[k];
+					while( slab + 1 < num_threads_ and work >= total_work * (slab + 1) / num_threads_ ) slab_begin[++slab] = k + 1;
+				}
+				for( int s = 0; s < num_threads_; ++s ){
+					for( int k = slab_begin[s]; k < std::min(slab_begin[s + 1], nz + 1); ++k ) layer_slab[k] = s;
+				}
+			}
 
-				u_counter = 0;
-				
-				if( visited_u[u_idx-1        ]              ) { u_left  = MACGrid_->pu_[u_idx-1        ]; ++u_counter; } else { u_left  = 0.; } // Left
-				if( visited_u[u_idx-(nx+1)   ] and j > 0    ) { u_down  = MACGrid_->pu_[u_idx-(nx+1)   ]; ++u_counter; } else { u_down  = 0.; } // Down
-				if( visited_u[u_idx+(nx+1)   ] and j < ny-1 ) { u_up    = MACGrid_->pu_[u_idx+(nx+1)   ]; ++u_counter; } else { u_up    = 0.; } // Up
-				if( visited_u[u_idx-(nx+1)*ny] and k > 0    ) { u_back  = MACGrid_->pu_[u_idx-(nx+1)*ny]; ++u_counter; } else { u_back  = 0.; } // Back
-				if( visited_u[u_idx+(nx+1)*ny] and k < nz-1 ) { u_front = MACGrid_->pu_[u_idx+(nx+1)*ny]; ++u_counter; } else { u_front = 0.; } // Front
+			// Count the particles of the thread reaching each slab
+			Particles::particleIdx_t* const slab_pos = slab_count.data() + Mac3d::globalCellIdx_t(t) * num_threads_;
+			for( Particles::particleIdx_t n = begin; n < end; ++n ){
+				int lo, hi;
+				reach(particle_layer_[n], lo, hi);
+				if( lo > hi ) continue;
+				for( int s = layer_slab[lo]; s <= layer_slab[hi]; ++s ) ++slab_pos[s];
+			}
+			#pragma omp barrier
+
+			// Turn the counts into the first position of the particles of every
+			// thread in every slab
+			#pragma omp single
+			{
+				Particles::particleIdx_t pos = 0;
+				for( int s = 0; s < num_threads_; ++s ){
+					slab_offsets[s] = pos;
+					for( int c = 0; c < num_threads_; ++c ){
+						const Particles::particleIdx_t num = slab_count[Mac3d::globalCellIdx_t(c) * num_threads_ + s];
+						slab_count[Mac3d::globalCellIdx_t(c) * num_threads_ + s] = pos;
+						pos += num;
+					}
+				}
+				slab_offsets[num_threads_] = pos;
+				slab_particles_.resize(pos);
+			}
 
-				if(u_counter != 0) MACGrid_->pu_[u_idx] = (u_left + u_down + u_up + u_back + u_front) / u_counter;
+			for( Particles::particleIdx_t n = begin; n < end; ++n ){
+				int lo, hi;
+				reach(particle_layer_[n], lo, hi);
+				if( lo > hi ) continue;
+				for( int s = layer_slab[lo]; s <= layer_slab[hi]; ++s ) slab_particles_[slab_pos[s]++] = n;
 			}
 		}
 	}
 
-	for( Mac3d::cellIdx_t k = 0; k < nz; ++k ){
-		for( Mac3d::cellIdx_t i = 0; i < nx; ++i ){
+	#pragma omp parallel for schedule(static, 1) num_threads(num_threads_) if(num_threads_ > 1)
+	for( int t = 0; t < num_threads_; ++t ){
+
+		// Reset the fluid flags of the slab
+		const Mac3d::globalCellIdx_t layer_size = Mac3d::globalCellIdx_t(MACGrid_->N_) * MACGrid_->M_;
+		std::fill(MACGrid_->pfluid_ + layer_size * std::min(slab_begin[t], nz),
+				  MACGrid_->pfluid_ + layer_size * std::min(slab_begin[t + 1], nz), false);
+
+		// With one thread, the only slab visits all the particles
+		const Particles::particleIdx_t* const slab_particles = (num_threads_ > 1) ? slab_particles_.data() + slab_offsets[t] : nullptr;
+		const Particles::particleIdx_t num_slab_particles = (num_threads_ > 1) ? slab_offsets[t + 1] - slab_offsets[t] : num_particles_;
+
+		switch( p2g_kernel_ ){
+			case P2G_KERNEL_SPH:
+				particle_to_grid_slab(slab_begin[t], slab_begin[t + 1], slab_particles, num_slab_particles);
+				break;
+			case P2G_KERNEL_TRILINEAR:
+				particle_to_grid_slab_bspline<2>(slab_begin[t], slab_begin[t + 1], slab_particles, num_slab_particles);
+				break;
+			case P2G_KERNEL_QUADRATIC:
+				particle_to_grid_slab_bspline<3>(slab_begin[t], slab_begin[t + 1], slab_particles, num_slab_particles);
+				break;
+		}
+	}
+}
+
+
+/**
+ * Set the bits of the faces idx, ..., idx+3 given in bits (bit 0 for idx) in
+ * the visited mask
+ */
+static inline void set_visited_bits( std::uint64_t* const visited,
+									 const Mac3d::globalCellIdx_t idx,
+									 const int bits ){
+
+	const int shift = idx & 63;
+	visited[idx >> 6] |= std::uint64_t(bits) << shift;
+	if( shift > 60 ) visited[(idx >> 6) + 1] |= std::uint64_t(bits) >> (64 - shift);
+}
+
+
+/**
+ * Normalize the accumulated velocities of the n faces of a row starting at
+ * the face idx, and set the bits of the faces with a non-zero weight in the
+ * visited mask
+ */
+static inline void normalize_row( real_t* const vel,
+								  const real_t* const weights,
+								  std::uint64_t* const visited,
+								  const Mac3d::globalCellIdx_t idx,
+								  const int n ){
+
+	const __m256d zeros = _mm256_setzero_pd();
+	const __m256d ones  = _mm256_set1_pd(1.);
+
+	int i = 0;
+	for( ; i + 4 <= n; i += 4 ){
+
+		const __m256d weight   = simd::load(weights + idx + i);
+		const __m256d neq_zero = _mm256_cmp_pd(weight, zeros, _CMP_NEQ_OQ);
+
+		simd::store(vel + idx + i, _mm256_div_pd(simd::load(vel + idx + i), _mm256_blendv_pd(ones, weight, neq_zero)));
+		set_visited_bits(visited, idx + i, _mm256_movemask_pd(neq_zero));
+	}
+
+	// The rest of the row with masked loads and stores
+	if( i < n ){
+
+		const __m256i mask     = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n - i), _mm256_set_epi64x(3, 2, 1, 0));
+		const __m256d weight   = simd::maskload(weights + idx + i, mask);
+		const __m256d neq_zero = _mm256_cmp_pd(weight, zeros, _CMP_NEQ_OQ);
+
+		simd::maskstore(vel + idx + i, mask, _mm256_div_pd(simd::maskload(vel + idx + i, mask), _mm256_blendv_pd(ones, weight, neq_zero)));
+		set_visited_bits(visited, idx + i, _mm256_movemask_pd(neq_zero));
+	}
+}
+
 
-			v_idx = i + nx * (ny * (k+1) + k);
+void FLIP::normalize_accumulated_vels( Mac3d::cellIdx_t nx,
+									   Mac3d::cellIdx_t ny,
+									   Mac3d::cellIdx_t nz ) {
 
-			if( !visited_v[v_idx] ){
+	// Normalize the rows reached by particles, and set the velocities of the
+	// other rows (whose weights are stale) to zero
+	for( Mac3d::cellIdx_t k = 0; k <= nz; ++k ){
+		for( Mac3d::cellIdx_t j = 0; j <= ny; ++j ){
 
-				v_counter = 0;
-				
-				if( visited_v[v_idx-1        ] and i > 0    ) { v_left  = MACGrid_->pv_[v_idx-1        ]; ++v_counter; } else { v_left  = 0.; } // Left
-				if( visited_v[v_idx+1        ] and i < nx-1 ) { v_right = MACGrid_->pv_[v_idx+1        ]; ++v_counter; } else { v_right = 0.; } // Right
-				if( visited_v[v_idx-nx       ]              ) { v_down  = MACGrid_->pv_[v_idx-nx       ]; ++v_counter; } else { v_down  = 0.; } // Down
-				if( visited_v[v_idx-nx*(ny+1)] and k > 0    ) { v_back  = MACGrid_->pv_[v_idx-nx*(ny+1)]; ++v_counter; } else { v_back  = 0.; } // Back
-				if( visited_v[v_idx+nx*(ny+1)] and k < nz-1 ) { v_front = MACGrid_->pv_[v_idx+nx*(ny+1)]; ++v_counter; } else { v_front = 0.; } // Front
+			const bool touched = MACGrid_->is_row_touched(j, k);
 
-				if(v_counter != 0) MACGrid_->pv_[v_idx] = (v_left + v_right + v_down + v_back + v_front) / v_counter;
+			if( j < ny and k < nz ){
+				const Mac3d::globalCellIdx_t u_idx = (nx+1) * Mac3d::globalCellIdx_t(j + ny*k);
+				if( touched ) normalize_row(MACGrid_->pu_, MACGrid_->pweights_u_, MACGrid_->pvisited_u_, u_idx, nx+1);
+				else std::fill(MACGrid_->pu_ + u_idx, MACGrid_->pu_ + u_idx + nx+1, 0.);
+			}
+			if( k < nz ){
+				const Mac3d::globalCellIdx_t v_idx = nx * Mac3d::globalCellIdx_t(j + (ny+1)*k);
+				if( touched ) normalize_row(MACGrid_->pv_, MACGrid_->pweights_v_, MACGrid_->pvisited_v_, v_idx, nx);
+				else std::fill(MACGrid_->pv_ + v_idx, MACGrid_->pv_ + v_idx + nx, 0.);
+			}
+			if( j < ny ){
+				const Mac3d::globalCellIdx_t w_idx = nx * Mac3d::globalCellIdx_t(j + ny*k);
+				if( touched ) normalize_row(MACGrid_->pw_, MACGrid_->pweights_w_, MACGrid_->pvisited_w_, w_idx, nx);
+				else std::fill(MACGrid_->pw_ + w_idx, MACGrid_->pw_ + w_idx + nx, 0.);
 			}
 		}
 	}
+}
+
+
+void FLIP::extrapolate_vel( real_t* const vel,
+							const std::uint64_t* const visited_vel,
+							const Mac3d::cellIdx_t n,
+							const Mac3d::cellIdx_t m,
+							const Mac3d::cellIdx_t l,
+							const int num_layers ) {
+
+	// Layer of every face (UNKNOWN -> no velocity yet), and lowest layer of
+	// the faces of every row
+	const unsigned char UNKNOWN = 255;
+	unsigned char* const layer     = extrapolation_layer_.data();
+	unsigned char* const row_layer = extrapolation_row_layer_.data();
+
+	// The visited faces are layer 0
+	#pragma omp parallel for schedule(static) num_threads(num_threads_) if(num_threads_ > 1)
+	for( Mac3d::cellIdx_t k = 0; k < l; ++k ){
+		for( Mac3d::cellIdx_t j = 0; j < m; ++j ){
 
-	for( Mac3d::cellIdx_t j = 0; j < ny; ++j ){
-		for( Mac3d::cellIdx_t i = 0; i < nx; ++i ){
+			unsigned char row_min = UNKNOWN;
+			for( Mac3d::cellIdx_t i = 0; i < n; ++i ){
 
-			w_idx = i + nx * (j + ny * nz);
+				const Mac3d::globalCellIdx_t idx = i + n * Mac3d::globalCellIdx_t(j + m*k);
+				layer[idx] = Mac3d::is_visited(visited_vel, idx) ? 0 : UNKNOWN;
+				row_min = std::min(row_min, layer[idx]);
+			}
+			row_layer[j + m*k] = row_min;
+		}
+	}
 
-			if( !visited_w[w_idx] ){
+	// Every face of layer L gets the average velocity of its neighbors of a
+	// lower layer. The faces which get layer L are recorded by every thread and
+	// flagged once all the faces of the layer are computed, so the slabs of
+	// z-layers can be processed in parallel and every face only reads the
+	// layers of the previous passes: the result does not depend on the order
+	// of the faces
+	for( int L = 1; L <= num_layers; ++L ){
 
-				w_counter = 0;
-				
-				if( visited_w[w_idx-1    ] and i > 0    ) { w_left  = MACGrid_->pw_[w_idx-1    ]; ++w_counter; } else { w_left  = 0.; } // Left
-				if( visited_w[w_idx+1    ] and i < nx-1 ) { w_right = MACGrid_->pw_[w_idx+1    ]; ++w_counter; } else { w_right = 0.; } // Righ
-				if( visited_w[w_idx-nx   ] and j > 0    ) { w_down  = MACGrid_->pw_[w_idx-nx   ]; ++w_counter; } else { w_down  = 0.; } // Down
-				if( visited_w[w_idx+nx   ] and j < ny-1 ) { w_up    = MACGrid_->pw_[w_idx+nx   ]; ++w_counter; } else { w_up    = 0.; } // Up
-				if( visited_w[w_idx-nx*ny]              ) { w_back  = MACGrid_->pw_[w_idx-nx*ny]; ++w_counter; } else { w_back  = 0.; } // Back
+		Mac3d::globalCellIdx_t num_new = 0;
 
-				if(w_counter != 0) MACGrid_->pw_[w_idx] = (w_left + w_right + w_down + w_up + w_back) / w_counter;
+		#pragma omp parallel reduction(+:num_new) num_threads(num_threads_) if(num_threads_ > 1)
+		{
+			std::vector<Mac3d::globalCellIdx_t>& new_faces = extrapolation_new_faces_[omp_get_thread_num()];
+			new_faces.clear();
+
+			#pragma omp for schedule(static)
+			for( Mac3d::cellIdx_t k = 0; k < l; ++k ){
+				for( Mac3d::cellIdx_t j = 0; j < m; ++j ){
+
+					// Only the rows next to a row with faces of a lower layer are
+					// in the band of layer L
+					const Mac3d::cellIdx_t r = j + m*k;
+					if( not( row_layer[r] < L
+						  or ( j > 0   and row_layer[r-1] < L )
+						  or ( j < m-1 and row_layer[r+1] < L )
+						  or ( k > 0   and row_layer[r-m] < L )
+						  or ( k < l-1 and row_layer[r+m] < L ) ) ) continue;
+
+					for( Mac3d::cellIdx_t i = 0; i < n; ++i ){
+
+						const Mac3d::globalCellIdx_t idx = i + n * Mac3d::globalCellIdx_t(j + m*k);
+						if( layer[idx] != UNKNOWN ) continue;
+
+						double sum = 0.;
+						short counter = 0;
+
+						if( i > 0   and layer[idx-1  ] < L ) { sum += vel[idx-1  ]; ++counter; } // Left
+						if( i < n-1 and layer[idx+1  ] < L ) { sum += vel[idx+1  ]; ++counter; } // Right
+						if( j > 0   and layer[idx-n  ] < L ) { sum += vel[idx-n  ]; ++counter; } // Down
+						if( j < m-1 and layer[idx+n  ] < L ) { sum += vel[idx+n  ]; ++counter; } // Up
+						if( k > 0   and layer[idx-n*m] < L ) { sum += vel[idx-n*m]; ++counter; } // Back
+						if( k < l-1 and layer[idx+n*m] < L ) { sum += vel[idx+n*m]; ++counter; } // Front
+
+						// The velocity of a face without a layer is not read in
+						// this pass
+						if( counter != 0 ){
+							vel[idx] = sum / counter;
+							new_faces.push_back(idx);
+						}
+					}
+				}
+			}
+
+			// Flag the faces of the layer (after the implicit barrier of the
+			// loop). Every thread flags the faces and rows of its own z-layers
+			for( const Mac3d::globalCellIdx_t idx : new_faces ){
+				layer[idx] = L;
+				row_layer[idx / n] = std::min(row_layer[idx / n], (unsigned char) L);
 			}
+			num_new += new_faces.size();
+		}
+
+		// No face is left next to the extrapolated band
+		if( num_new == 0 ) break;
+	}
+}
+
+
+void FLIP::particle_to_grid() {
+
+	// Grid dimensions
+	const Mac3d::cellIdx_t nx = MACGrid_->N_;
+	const Mac3d::cellIdx_t ny = MACGrid_->M_;
+	const Mac3d::cellIdx_t nz = MACGrid_->L_;
+
+	MACGrid_->begin_accumulation();
+	ghost_fields_current_ = false;
+
+	// Compute the normalized velocities on the faces and the fluid flags. The
+	// accumulation is timed separately, tagged with the number of particles
+	tsc::TSCTimer& tsctimer = tsc::TSCTimer::get_timer("timings.json");
+	tsctimer.start_timing("particle_to_grid_accumulate");
+	if( p2g_method_ == P2G_METHOD_GATHER ){
+
+		switch( p2g_kernel_ ){
+			case P2G_KERNEL_SPH:
+				particle_to_grid_gather<P2G_KERNEL_SPH>();
+				break;
+			case P2G_KERNEL_TRILINEAR:
+				particle_to_grid_gather<P2G_KERNEL_TRILINEAR>();
+				break;
+			case P2G_KERNEL_QUADRATIC:
+				particle_to_grid_gather<P2G_KERNEL_QUADRATIC>();
+				break;
 		}
 	}
+	else{
 
-	free(visited_u);
-	free(visited_v);
-	free(visited_w);
-}
\ No newline at end of file
+		particle_to_grid_scatter();
+		normalize_accumulated_vels(nx, ny, nz);
+	}
+	tsctimer.stop_timing("particle_to_grid_accumulate", false, std::to_string(num_particles_));
+
+	// Extrapolate the velocities into the air cells, as many layers as the
+	// fastest particle can travel if extrapolation_layers_ is 0
+	const int num_layers = (extrapolation_layers_ > 0) ? extrapolation_layers_ : std::min(std::max(last_num_substeps_, 1), 254);
+	extrapolate_vel(MACGrid_->pu_, MACGrid_->pvisited_u_, nx+1, ny, nz, num_layers);
+	extrapolate_vel(MACGrid_->pv_, MACGrid_->pvisited_v_, nx, ny+1, nz, num_layers);
+	extrapolate_vel(MACGrid_->pw_, MACGrid_->pvisited_w_, nx, ny, nz+1, num_layers);
+}
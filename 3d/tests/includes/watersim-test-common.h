@@ -6,10 +6,43 @@
 #define WATERSIM_WATERSIM_TEST_COMMON_H
 
 #include <cassert>
+#include <cmath>
 #include <string>
 #include <limits>
+#include "precision.h"
 const double interpolation_tolerance = std::numeric_limits<double>::epsilon();
 
+// machine epsilon of the type the particle and grid values are stored in
+// (float in the single precision build), to scale the tolerances of values
+// which are rounded to it
+const double real_epsilon = std::numeric_limits<real_t>::epsilon();
+
+// Reproducible, scattered positions of the test particles: the fractions a,
+// b, c of the domain along x, y, z of particle n, in [margin, 1 - margin]
+inline void particle_fractions(const unsigned n, double& a, double& b, double& c, const double margin = 0.) {
+	a = std::sin(1.3*n) * (0.5 - margin) + 0.5;
+	b = std::sin(2.1*n + 1) * (0.5 - margin) + 0.5;
+	c = std::sin(0.7*n + 2) * (0.5 - margin) + 0.5;
+}
+
+// Scatter the first num_particles particles between the first and the last
+// cell centers of an nx*ny*nz grid with unit cells, with velocity components
+// of magnitude up to vel_scale
+template<typename particles_t>
+void fill_particles(particles_t& particles, const unsigned num_particles,
+                    const unsigned nx, const unsigned ny, const unsigned nz, const double vel_scale = 1.) {
+	for (unsigned n = 0; n < num_particles; ++n) {
+		double a, b, c;
+		particle_fractions(n, a, b, c);
+		particles.x[n] = a * nx - 0.5;
+		particles.y[n] = b * ny - 0.5;
+		particles.z[n] = c * nz - 0.5;
+		particles.u[n] = vel_scale * std::cos(0.3*n);
+		particles.v[n] = vel_scale * std::cos(0.5*n + 1);
+		particles.w[n] = vel_scale * std::cos(0.9*n + 2);
+	}
+}
+
 std::string validation_data_dir = "/validation_data/";
 #ifdef CMAKE_SOURCE_DIR
 	// Macros to convert preprocessor variable to string, see
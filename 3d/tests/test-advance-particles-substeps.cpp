@@ -0,0 +1,51 @@
+/*
+ * A test to check that advancing the particles through all substeps in one
+ * pass gives the same positions as one pass per substep, including particles
+ * which leave the grid, with an incomplete last batch of particles
+ */
+#include <cmath>
+
+#include "includes/watersim-test-common.h"
+#include "FLIP.h"
+
+
+int main() {
+	const unsigned nx = 12, ny = 10, nz = 14;
+	const unsigned num_particles = 4001;
+	const int num_substeps = 5;
+	const double dt = 0.4;
+
+	Mac3d* grids[2];
+	Particles* particles[2];
+	FLIP* flips[2];
+	for (unsigned t = 0; t < 2; ++t) {
+		SimConfig cfg;
+		grids[t] = new Mac3d(nx, ny, nz, nx, ny, nz);
+		particles[t] = new Particles(num_particles, *grids[t]);
+
+		for (unsigned idx = 0; idx < (nx+1)*ny*nz; ++idx) grids[t]->pu_[idx] = 3*std::sin(0.7*idx);
+		for (unsigned idx = 0; idx < nx*(ny+1)*nz; ++idx) grids[t]->pv_[idx] = 3*std::cos(1.3*idx);
+		for (unsigned idx = 0; idx < nx*ny*(nz+1); ++idx) grids[t]->pw_[idx] = 3*std::sin(0.4*idx + 1);
+
+		fill_particles(*particles[t], num_particles, nx, ny, nz, 4);
+
+		flips[t] = new FLIP(*particles[t], grids[t], cfg);
+	}
+
+	flips[0]->advance_particles(dt / num_substeps, num_substeps);
+	for (int s = 0; s < num_substeps; ++s) flips[1]->advance_particles(dt / num_substeps);
+
+	// bitwise equal, in single precision too: the positions are computed in
+	// real_t, so storing them between the passes does not round them
+	for (unsigned n = 0; n < num_particles; ++n) {
+		assert(particles[0]->x[n] == particles[1]->x[n]);
+		assert(particles[0]->y[n] == particles[1]->y[n]);
+		assert(particles[0]->z[n] == particles[1]->z[n]);
+	}
+
+	for (unsigned t = 0; t < 2; ++t) {
+		delete flips[t];
+		delete particles[t];
+		delete grids[t];
+	}
+}
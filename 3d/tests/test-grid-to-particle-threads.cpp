@@ -0,0 +1,57 @@
+/*
+ * A test to check that the grid-to-particle transfer, the CFL timestep and
+ * the advection give identical results with any number of threads, including
+ * particles close to the boundaries and an incomplete last batch
+ */
+#include <cmath>
+
+#include "includes/watersim-test-common.h"
+#include "FLIP.h"
+
+
+int main() {
+	const unsigned nx = 20, ny = 16, nz = 24;
+	const unsigned num_particles = 20003;
+	const double dt = 0.5;
+
+	Mac3d* grids[4];
+	Particles* particles[4];
+	FLIP* flips[4];
+	double dt_new[4];
+	const int num_threads[4] = {1, 2, 3, 7};
+	for (unsigned t = 0; t < 4; ++t) {
+		SimConfig cfg;
+		cfg.setNumThreads(num_threads[t]);
+		grids[t] = new Mac3d(nx, ny, nz, nx, ny, nz);
+		particles[t] = new Particles(num_particles, *grids[t], num_threads[t]);
+
+		for (unsigned idx = 0; idx < (nx+1)*ny*nz; ++idx) { grids[t]->pu_[idx] = 3*std::sin(0.7*idx); grids[t]->pu_star_[idx] = std::cos(0.2*idx); }
+		for (unsigned idx = 0; idx < nx*(ny+1)*nz; ++idx) { grids[t]->pv_[idx] = 3*std::cos(1.3*idx); grids[t]->pv_star_[idx] = std::sin(0.1*idx); }
+		for (unsigned idx = 0; idx < nx*ny*(nz+1); ++idx) { grids[t]->pw_[idx] = 3*std::sin(0.4*idx + 1); grids[t]->pw_star_[idx] = std::cos(0.3*idx); }
+
+		fill_particles(*particles[t], num_particles, nx, ny, nz);
+
+		flips[t] = new FLIP(*particles[t], grids[t], cfg);
+		flips[t]->grid_to_particle();
+		dt_new[t] = flips[t]->compute_timestep(dt);
+		flips[t]->advance_particles(dt / 3, 3);
+	}
+
+	for (unsigned t = 1; t < 4; ++t) {
+		assert(dt_new[t] == dt_new[0]);
+		for (unsigned n = 0; n < num_particles; ++n) {
+			assert(particles[t]->u[n] == particles[0]->u[n]);
+			assert(particles[t]->v[n] == particles[0]->v[n]);
+			assert(particles[t]->w[n] == particles[0]->w[n]);
+			assert(particles[t]->x[n] == particles[0]->x[n]);
+			assert(particles[t]->y[n] == particles[0]->y[n]);
+			assert(particles[t]->z[n] == particles[0]->z[n]);
+		}
+	}
+
+	for (unsigned t = 0; t < 4; ++t) {
+		delete flips[t];
+		delete particles[t];
+		delete grids[t];
+	}
+}
@@ -0,0 +1,84 @@
+/*
+ * A test to check the index helpers of indices.h, which convert, offset and
+ * gather 4 indices at a time, the face and cell counts of the grid, and that
+ * the storage positions of the particles and the bounds of the backward sweep
+ * of the pressure solver do not wrap around for large indices
+ */
+#include <cstddef>
+#include <cstring>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "Particles.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	// indices up to 2^31 - 1 in the 32-bit build, beyond 2^32 in the 64-bit one
+	const double large = sizeof(index_t) == 8 ? 6442450941. : 2147483641.;
+	{
+		const double values[4] = {0., 5., large - 3, large};
+		const simd::index4_t converted = simd::add_index(simd::to_index(_mm256_loadu_pd(values)), 2);
+		index_t idx[4];
+		static_assert(sizeof(idx) == sizeof(converted), "4 indices per register");
+		std::memcpy(idx, &converted, sizeof(idx));
+		for (unsigned l = 0; l < 4; ++l) assert(idx[l] == index_t(values[l]) + 2);
+		assert(idx[3] == index_t(large) + 2);
+	}
+
+	// gathers from double and float arrays
+	{
+		double g[16];
+		float g_f[16];
+		for (unsigned c = 0; c < 16; ++c) { g[c] = 0.5 * c + 1; g_f[c] = g[c]; }
+		const index_t idx[4] = {1, 4, 2, 7};
+		const simd::index4_t offset = simd::add_index(simd::load_index(idx), 3);
+		double result[4], result_f[4];
+		_mm256_storeu_pd(result, simd::gather(g, offset));
+		_mm256_storeu_pd(result_f, simd::gather(g_f, offset));
+		for (unsigned l = 0; l < 4; ++l) {
+			assert(result[l] == g[idx[l] + 3]);
+			assert(result_f[l] == g[idx[l] + 3]);
+		}
+	}
+
+	// face and cell counts
+	{
+		const unsigned nx = 7, ny = 5, nz = 6;
+		Mac3d grid(nx, ny, nz, nx, ny, nz);
+		assert(grid.get_num_cells() == nx*ny*nz);
+		assert(grid.get_num_faces(Mac3d::GRID_U) == (nx+1)*ny*nz);
+		assert(grid.get_num_faces(Mac3d::GRID_V) == nx*(ny+1)*nz);
+		assert(grid.get_num_faces(Mac3d::GRID_W) == nx*ny*(nz+1));
+	}
+
+	// storage positions of particles beyond 2^32 / 6
+	for (Particles::particleIdx_t n : {Particles::particleIdx_t(0), Particles::particleIdx_t(13),
+	                                   Particles::particleIdx_t(1u << 30) + 5}) {
+#ifdef WATERSIM_PARTICLES_AOSOA
+		const std::size_t expected = std::size_t(n / Particles::block_size) * Particles::block_size * Particles::num_components
+		                             + n % Particles::block_size;
+#else
+		const std::size_t expected = n;
+#endif
+		assert(Particles::storage_index(n) == expected);
+	}
+
+	// backward sweep over x-rows of unknowns up to 2^31 in the 32-bit build and
+	// beyond 2^32 in the 64-bit one
+	{
+		const index_t first = sizeof(index_t) == 8 ? (index_t(1) << 32) + 5 : (index_t(1) << 31) - 9;
+		for (const index_t begin : {index_t(0), index_t(3), first}) {
+			for (const index_t length : {index_t(0), index_t(1), index_t(7)}) {
+				index_t expected = begin + length;
+				ICConjugateGradientSolver::for_each_cell_reverse(begin, begin + length, [&](const index_t c) {
+					assert(c + 1 == expected);
+					expected = c;
+				});
+				assert(expected == begin);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * A test to check that the batch interpolation of Mac3d, on the ghost fields,
+ * gives the same values as grid_interpolate (up to rounding), for positions
+ * inside the staggered grids, on their boundaries and in the half cell outside
+ * of them, both for the velocities and for the blended fields u - c*u*, and
+ * that the boundary cells of the batch stencils are those of get_cell_index
+ */
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "Particles.h"
+
+
+/** Load simd::vec::width values of p starting at n, rounded to real_t */
+simd::vec::type load_batch(const std::vector<double>& p, const unsigned n) {
+	alignas(32) real_t values[simd::vec::width];
+	std::copy(p.begin() + n, p.begin() + n + simd::vec::width, values);
+	return simd::vec::load_aligned(values);
+}
+
+
+template<Mac3d::GRID grid_name>
+void check_batch(Mac3d& mac, const std::vector<double>& px, const std::vector<double>& py, const std::vector<double>& pz,
+                 const double coeff) {
+	const unsigned num_points = px.size();
+	for (unsigned n = 0; n < num_points; n += simd::vec::width) {
+		const simd::vec::type pos_x = load_batch(px, n);
+		const simd::vec::type pos_y = load_batch(py, n);
+		const simd::vec::type pos_z = load_batch(pz, n);
+		alignas(32) real_t values[simd::vec::width], values_blend[simd::vec::width];
+		simd::vec::store_aligned(values, mac.grid_interpolate_batch<grid_name>(pos_x, pos_y, pos_z));
+		simd::vec::store_aligned(values_blend, mac.grid_interpolate_batch<grid_name, Mac3d::GHOST_BLEND>(pos_x, pos_y, pos_z));
+		for (unsigned b = 0; b < simd::vec::width; ++b) {
+			double expected, expected_star;
+			std::tie(expected, expected_star) = mac.grid_interpolate<grid_name, Mac3d::INTERPOLATE_BOTH>(px[n+b], py[n+b], pz[n+b]);
+			const double expected_blend = expected - coeff * expected_star;
+			assert(std::abs(expected - values[b]) < 4096 * real_epsilon * std::max(1., std::abs(expected)));
+			assert(std::abs(expected_blend - values_blend[b]) < 4096 * real_epsilon * std::max(1., std::abs(expected_star)));
+		}
+	}
+}
+
+
+int main() {
+	const unsigned nx = 7, ny = 5, nz = 6;
+	Mac3d mac(nx, ny, nz, 14, 10, 12);
+
+	for (unsigned idx = 0; idx < (nx+1)*ny*nz; ++idx) { mac.pu_[idx] = std::sin(0.7*idx); mac.pu_star_[idx] = idx*idx; }
+	for (unsigned idx = 0; idx < nx*(ny+1)*nz; ++idx) { mac.pv_[idx] = std::cos(1.3*idx); mac.pv_star_[idx] = -3.*idx; }
+	for (unsigned idx = 0; idx < nx*ny*(nz+1); ++idx) { mac.pw_[idx] = std::sin(0.4*idx + 1); mac.pw_star_[idx] = 0.5*idx; }
+	const double coeff = 0.95;
+	mac.update_ghost_fields();
+	mac.update_blend_ghost_fields(coeff);
+
+	// points of a lattice with a spacing of a quarter cell over the domain of
+	// the particles, (-0.5, n-0.5) cells along each axis, which includes the
+	// positions of the faces and the boundaries of the staggered grids, and
+	// some irregular points
+	std::vector<double> px, py, pz;
+	for (unsigned k = 1; k < 4*nz; ++k) {
+		for (unsigned j = 1; j < 4*ny; ++j) {
+			for (unsigned i = 1; i < 4*nx; ++i) {
+				px.push_back((0.25*i - 0.5) * mac.cell_sizex_);
+				py.push_back((0.25*j - 0.5) * mac.cell_sizey_);
+				pz.push_back((0.25*k - 0.5) * mac.cell_sizez_);
+			}
+		}
+	}
+	for (unsigned n = 0; px.size() % simd::vec::width != 0 or n < 1000; ++n) {
+		double a, b, c;
+		particle_fractions(n, a, b, c, 0.01);
+		px.push_back(a * mac.sizex_ - 0.5 * mac.cell_sizex_);
+		py.push_back(b * mac.sizey_ - 0.5 * mac.cell_sizey_);
+		pz.push_back(c * mac.sizez_ - 0.5 * mac.cell_sizez_);
+	}
+
+	check_batch<Mac3d::GRID_U>(mac, px, py, pz, coeff);
+	check_batch<Mac3d::GRID_V>(mac, px, py, pz, coeff);
+	check_batch<Mac3d::GRID_W>(mac, px, py, pz, coeff);
+
+	Particles particles(px.size(), mac);
+	for (unsigned n = 0; n < px.size(); ++n) {
+		particles.x[n] = px[n];
+		particles.y[n] = py[n];
+		particles.z[n] = pz[n];
+	}
+	for (unsigned n = 0; n < px.size(); n += simd::vec::width) {
+		const Mac3d::BatchStencil stencil = mac.compute_stencil_batch(load_batch(px, n), load_batch(py, n), load_batch(pz, n));
+		const int on_boundary = mac.stencil_on_boundary(stencil);
+		for (unsigned b = 0; b < simd::vec::width; ++b) {
+			Mac3d::cellIdx_t i, j, k;
+			particles.get_cell_index(n + b, i, j, k);
+			const bool expected = (i == 0 or i == (int)nx-1 or j == 0 or j == (int)ny-1 or k == 0 or k == (int)nz-1);
+			assert(expected == bool(on_boundary >> b & 1));
+		}
+	}
+}
@@ -12,8 +12,8 @@ int main() {
 	double sy = 10;
 	double sz = 10;
 	Mac3d mac(nx, ny, nz, sx, sy, sz);
-	double* g = mac.pu_;
-	double* h = mac.pu_star_;
+	real_t* g = mac.pu_;
+	real_t* h = mac.pu_star_;
 	double offset_x = -0.5 * mac.cell_sizex_;
 	double offset_y = 0;
 	double offset_z = 0;
@@ -439,7 +439,7 @@ int main() {
 		unsigned cell_y = norm_py;
 		unsigned cell_z = norm_pz;
 
-		double* p = mac.pu_;
+		real_t* p = mac.pu_;
 
 		unsigned i000 = (cell_x    ) + (nx+1) * (cell_y    ) + ny * (nx+1) * (cell_z    );
 		unsigned i001 = (cell_x    ) + (nx+1) * (cell_y    ) + ny * (nx+1) * (cell_z + 1);
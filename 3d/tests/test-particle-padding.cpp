@@ -0,0 +1,57 @@
+/*
+ * A test to check that the particles are padded to whole blocks, that the
+ * batches of 4 particles are aligned, and that the padding particles stay at
+ * the origin with zero velocity through the grid-to-particle transfer, the
+ * advection and the sort, with several threads
+ */
+#include <cmath>
+#include <cstdint>
+
+#include "includes/watersim-test-common.h"
+#include "FLIP.h"
+
+
+void check_padding(const Particles& particles) {
+	for (Particles::particleIdx_t n = particles.get_num_particles(); n < particles.get_num_padded(); ++n) {
+		assert(particles.x[n] == 0. and particles.y[n] == 0. and particles.z[n] == 0.);
+		assert(particles.u[n] == 0. and particles.v[n] == 0. and particles.w[n] == 0.);
+	}
+}
+
+
+int main() {
+	const unsigned nx = 14, ny = 10, nz = 12;
+	const double dt = 0.5;
+
+	for (unsigned num_particles : {1u, 7u, 8u, 1001u, 4005u}) {
+		SimConfig cfg;
+		cfg.setNumThreads(3);
+		Mac3d grid(nx, ny, nz, nx, ny, nz);
+		Particles particles(num_particles, grid, cfg.getNumThreads());
+
+		assert(particles.get_num_padded() % Particles::block_size == 0);
+		assert(particles.get_num_padded() >= num_particles);
+		assert(particles.get_num_padded() < num_particles + Particles::block_size);
+		for (Particles::particleIdx_t n = 0; n < particles.get_num_padded(); n += 4) {
+			for (const Particles::Component* c : {&particles.x, &particles.y, &particles.z,
+			                                      &particles.u, &particles.v, &particles.w}) {
+				assert(reinterpret_cast<std::uintptr_t>(c->batch(n)) % (4 * sizeof(real_t)) == 0);
+			}
+		}
+
+		for (unsigned idx = 0; idx < (nx+1)*ny*nz; ++idx) { grid.pu_[idx] = 3*std::sin(0.7*idx); grid.pu_star_[idx] = std::cos(0.2*idx); }
+		for (unsigned idx = 0; idx < nx*(ny+1)*nz; ++idx) { grid.pv_[idx] = 3*std::cos(1.3*idx); grid.pv_star_[idx] = std::sin(0.1*idx); }
+		for (unsigned idx = 0; idx < nx*ny*(nz+1); ++idx) { grid.pw_[idx] = 3*std::sin(0.4*idx + 1); grid.pw_star_[idx] = std::cos(0.3*idx); }
+
+		fill_particles(particles, num_particles, nx, ny, nz);
+		check_padding(particles);
+
+		FLIP flip(particles, &grid, cfg);
+		flip.grid_to_particle();
+		check_padding(particles);
+		flip.advance_particles(dt / 3, 3);
+		check_padding(particles);
+		particles.sort_by_cell(Particles::SORT_MORTON);
+		check_padding(particles);
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * A test to check that sorting the particles by cell permutes all six arrays
+ * together, orders the particles by cell and keeps the order within a cell
+ */
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "includes/watersim-test-common.h"
+#include "Particles.h"
+
+
+int main() {
+	const unsigned nx = 20, ny = 12, nz = 9;
+	const unsigned num_particles = 5000;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+	for (auto order : {Particles::SORT_CELL, Particles::SORT_MORTON}) {
+		Particles particles(num_particles, grid);
+		std::vector<std::array<double, 6>> original(num_particles);
+		for (unsigned n = 0; n < num_particles; ++n) {
+			// includes particles on the upper boundary of the domain
+			double a, b, c;
+			particle_fractions(n, a, b, c);
+			particles.x[n] = std::min<double>(nx, a * (nx + 1));
+			particles.y[n] = b * ny;
+			particles.z[n] = c * nz;
+			// the velocity identifies the particle
+			particles.u[n] = n;
+			particles.v[n] = -1. * n;
+			particles.w[n] = 2. * n;
+			original[n] = {particles.x[n], particles.y[n], particles.z[n], particles.u[n], particles.v[n], particles.w[n]};
+		}
+
+		// sorting twice, the second sort must not change anything
+		for (unsigned repeat = 0; repeat < 2; ++repeat) {
+			particles.sort_by_cell(order);
+
+			std::vector<bool> seen(num_particles, false);
+			for (unsigned n = 0; n < num_particles; ++n) {
+				const unsigned id = particles.u[n];
+				assert(not seen[id]);
+				seen[id] = true;
+				assert(particles.x[n] == original[id][0] and particles.y[n] == original[id][1]
+				       and particles.z[n] == original[id][2] and particles.v[n] == original[id][4]
+				       and particles.w[n] == original[id][5]);
+			}
+
+			// particles of the same cell are contiguous and in their original order,
+			// cells follow each other in the right order
+			std::vector<int> last_id(nx*ny*nz, -1);
+			Mac3d::cellIdx_t pi = 0, pj = 0, pk = 0;
+			for (unsigned n = 0; n < num_particles; ++n) {
+				Mac3d::cellIdx_t i, j, k;
+				particles.get_cell_index(n, i, j, k);
+				i = std::min<Mac3d::cellIdx_t>(i, nx - 1);
+				j = std::min<Mac3d::cellIdx_t>(j, ny - 1);
+				k = std::min<Mac3d::cellIdx_t>(k, nz - 1);
+				const unsigned cellidx = i + j*nx + k*nx*ny;
+				if (n > 0 and (i != pi or j != pj or k != pk)) {
+					assert(last_id[cellidx] == -1);
+					if (order == Particles::SORT_CELL) {
+						assert(cellidx > pi + pj*nx + pk*nx*ny);
+					} else {
+						// the Morton curve visits the octants of any aligned block one after the other
+						for (unsigned level = 1; level < 8; ++level) {
+							if ((i >> level) == (pi >> level) and (j >> level) == (pj >> level) and (k >> level) == (pk >> level)) {
+								const unsigned octant = (i >> (level-1) & 1) | (j >> (level-1) & 1) << 1 | (k >> (level-1) & 1) << 2;
+								const unsigned prev_octant = (pi >> (level-1) & 1) | (pj >> (level-1) & 1) << 1 | (pk >> (level-1) & 1) << 2;
+								assert(octant >= prev_octant);
+								break;
+							}
+						}
+					}
+				}
+				assert(last_id[cellidx] < (int) particles.u[n]);
+				last_id[cellidx] = particles.u[n];
+				pi = i; pj = j; pk = k;
+			}
+		}
+	}
+}
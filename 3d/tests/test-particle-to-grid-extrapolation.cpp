@@ -0,0 +1,74 @@
+/*
+ * A test to check that the velocity extrapolation after the particle-to-grid
+ * transfer fills exactly the faces within the configured number of layers
+ * (in steps between neighboring faces) of the visited faces, with any number
+ * of threads
+ */
+#include <cmath>
+#include <vector>
+#include <queue>
+
+#include "includes/watersim-test-common.h"
+#include "FLIP.h"
+
+
+/* Check a velocity field of dimensions n, m, l: the faces at most num_layers
+ * steps away from a visited face have the velocity vel, the others zero */
+void check_layers(const real_t* field, const std::uint64_t* visited, const double vel,
+                  const int n, const int m, const int l, const int num_layers) {
+	std::vector<int> dist(n*m*l, -1);
+	std::queue<int> queue;
+	for (int idx = 0; idx < n*m*l; ++idx) {
+		if (Mac3d::is_visited(visited, idx)) { dist[idx] = 0; queue.push(idx); }
+	}
+	while (!queue.empty()) {
+		const int idx = queue.front(); queue.pop();
+		const int i = idx % n, j = (idx / n) % m, k = idx / (n*m);
+		const int neighbors[6][4] = {{i > 0, -1}, {i < n-1, 1}, {j > 0, -n}, {j < m-1, n}, {k > 0, -n*m}, {k < l-1, n*m}};
+		for (auto& neighbor : neighbors) {
+			if (neighbor[0] and dist[idx + neighbor[1]] < 0) {
+				dist[idx + neighbor[1]] = dist[idx] + 1;
+				queue.push(idx + neighbor[1]);
+			}
+		}
+	}
+	for (int idx = 0; idx < n*m*l; ++idx) {
+		if (dist[idx] >= 0 and dist[idx] <= num_layers) assert(std::abs(field[idx] - vel) < 1e-12);
+		else assert(field[idx] == 0.);
+	}
+}
+
+
+int main() {
+	const unsigned nx = 20, ny = 16, nz = 24;
+	const unsigned num_particles = 2000;
+
+	for (const int num_layers : {1, 3, 6}) {
+	for (const int num_threads : {1, 3}) {
+		SimConfig cfg;
+		cfg.setNumThreads(num_threads);
+		cfg.setExtrapolationLayers(num_layers);
+		Mac3d grid(nx, ny, nz, nx, ny, nz);
+		Particles particles(num_particles, grid);
+
+		// a blob of particles with the same velocity
+		for (unsigned n = 0; n < num_particles; ++n) {
+			double a, b, c;
+			particle_fractions(n, a, b, c);
+			particles.x[n] = 5 + 4 * a;
+			particles.y[n] = 3 + 5 * b;
+			particles.z[n] = 12 + 6 * c;
+			particles.u[n] = 1.;
+			particles.v[n] = -2.;
+			particles.w[n] = 0.5;
+		}
+
+		FLIP flip(particles, &grid, cfg);
+		flip.particle_to_grid();
+
+		check_layers(grid.pu_, grid.pvisited_u_,  1. , nx+1, ny, nz, num_layers);
+		check_layers(grid.pv_, grid.pvisited_v_, -2. , nx, ny+1, nz, num_layers);
+		check_layers(grid.pw_, grid.pvisited_w_,  0.5, nx, ny, nz+1, num_layers);
+	}
+	}
+}
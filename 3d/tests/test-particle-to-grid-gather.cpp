@@ -0,0 +1,67 @@
+/*
+ * A test to check that the gathering particle-to-grid transfer gives the same
+ * velocity field and fluid cells as the scattering one, up to rounding, for
+ * every kernel
+ */
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+#include "includes/watersim-test-common.h"
+#include "FLIP.h"
+
+
+int main() {
+	const unsigned nx = 20, ny = 16, nz = 24;
+	const unsigned num_particles = 20000;
+
+	for (const std::string kernel : {"sph", "trilinear", "quadratic"}) {
+		Mac3d* grids[2];
+		Particles* particles[2];
+		FLIP* flips[2];
+		for (unsigned m = 0; m < 2; ++m) {
+			SimConfig cfg;
+			cfg.setParticleToGridKernel(kernel);
+			cfg.setParticleToGridMethod(m == 0 ? "scatter" : "gather");
+			grids[m] = new Mac3d(nx, ny, nz, nx, ny, nz);
+			particles[m] = new Particles(num_particles, *grids[m]);
+
+			// particles in a pool covering the whole bottom, and a blob in the middle
+			for (unsigned n = 0; n < num_particles; ++n) {
+				double a, b, c;
+				particle_fractions(n, a, b, c);
+				if (n % 3 == 0) {
+					particles[m]->x[n] = 6 + 8*a;
+					particles[m]->y[n] = 8 + 6*b;
+					particles[m]->z[n] = 4 + 16*c;
+				} else {
+					particles[m]->x[n] = (nx - 1) * a;
+					particles[m]->y[n] = 5 * b;
+					particles[m]->z[n] = (nz - 1) * c;
+				}
+				particles[m]->u[n] = std::cos(0.3*n);
+				particles[m]->v[n] = std::cos(0.5*n + 1);
+				particles[m]->w[n] = std::cos(0.9*n + 2);
+			}
+
+			flips[m] = new FLIP(*particles[m], grids[m], cfg);
+			// the second transfer reuses the cell list of the first one
+			flips[m]->particle_to_grid();
+			flips[m]->particle_to_grid();
+		}
+
+		auto check = [](const real_t* a, const real_t* b, unsigned size) {
+			for (unsigned idx = 0; idx < size; ++idx) assert(std::abs(a[idx] - b[idx]) < 4096 * real_epsilon * (1 + std::abs(a[idx])));
+		};
+		check(grids[0]->pu_, grids[1]->pu_, (nx+1)*ny*nz);
+		check(grids[0]->pv_, grids[1]->pv_, nx*(ny+1)*nz);
+		check(grids[0]->pw_, grids[1]->pw_, nx*ny*(nz+1));
+		for (unsigned idx = 0; idx < nx*ny*nz; ++idx) assert(grids[0]->pfluid_[idx] == grids[1]->pfluid_[idx]);
+
+		for (unsigned m = 0; m < 2; ++m) {
+			delete flips[m];
+			delete particles[m];
+			delete grids[m];
+		}
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * A test to check that the B-spline kernels of the particle-to-grid transfer
+ * spread a particle over 2x2x2 (trilinear) or 3x3x3 (quadratic) faces per
+ * component, with weights which sum to one and are centered on the particle
+ */
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+#include "includes/watersim-test-common.h"
+#include "FLIP.h"
+
+
+int main() {
+	const unsigned nx = 12, ny = 10, nz = 11;
+
+	for (const std::string kernel : {"trilinear", "quadratic"}) {
+		const unsigned width = (kernel == "trilinear") ? 2 : 3;
+		SimConfig cfg;
+		cfg.setParticleToGridKernel(kernel);
+		Mac3d grid(nx, ny, nz, nx, ny, nz);
+		Particles particles(1, grid);
+		particles.x[0] = 5.3;
+		particles.y[0] = 6.7;
+		particles.z[0] = 4.45;
+		particles.u[0] = 1.5;
+		particles.v[0] = -2.;
+		particles.w[0] = 0.25;
+
+		FLIP flip(particles, &grid, cfg);
+		flip.particle_to_grid();
+
+		// cell centers at integer coordinates, faces half a cell below them
+		auto check = [&](const real_t* vel, const real_t* weights, unsigned n, unsigned m, unsigned l,
+		                 double offset_x, double offset_y, double offset_z, double vel_particle) {
+			unsigned num_faces = 0;
+			double sum = 0., x = 0., y = 0., z = 0.;
+			for (unsigned k = 0; k < l; ++k) {
+				for (unsigned j = 0; j < m; ++j) {
+					for (unsigned i = 0; i < n; ++i) {
+						const unsigned idx = i + n * (j + m*k);
+						if (weights[idx] == 0.) continue;
+						++num_faces;
+						sum += weights[idx];
+						x += weights[idx] * (i - offset_x);
+						y += weights[idx] * (j - offset_y);
+						z += weights[idx] * (k - offset_z);
+						assert(std::abs(vel[idx] - vel_particle) < 64 * real_epsilon * std::max(1., std::abs(vel_particle)));
+					}
+				}
+			}
+			assert(num_faces == width*width*width);
+			assert(std::abs(sum - 1.) < 64 * real_epsilon);
+			assert(std::abs(x - particles.x[0]) < 512 * real_epsilon * std::abs(particles.x[0]));
+			assert(std::abs(y - particles.y[0]) < 512 * real_epsilon * std::abs(particles.y[0]));
+			assert(std::abs(z - particles.z[0]) < 512 * real_epsilon * std::abs(particles.z[0]));
+		};
+		check(grid.pu_, grid.pweights_u_, nx+1, ny, nz, 0.5, 0., 0., particles.u[0]);
+		check(grid.pv_, grid.pweights_v_, nx, ny+1, nz, 0., 0.5, 0., particles.v[0]);
+		check(grid.pw_, grid.pweights_w_, nx, ny, nz+1, 0., 0., 0.5, particles.w[0]);
+
+		// the cell of the particle is fluid
+		unsigned num_fluid = 0;
+		for (unsigned cellidx = 0; cellidx < nx*ny*nz; ++cellidx) num_fluid += grid.pfluid_[cellidx];
+		assert(num_fluid == 1 and grid.pfluid_[5 + nx*7 + nx*ny*4]);
+	}
+}
@@ -0,0 +1,68 @@
+/*
+ * A test to check that the particle-to-grid transfer gives identical results
+ * with any number of threads, including particles close to the boundaries,
+ * for every kernel and method
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "FLIP.h"
+#include <string>
+
+
+int main() {
+	const unsigned nx = 20, ny = 16, nz = 24;
+	const unsigned num_particles = 20000;
+
+	for (const std::string method : {"scatter", "gather"}) {
+	for (const std::string kernel : {"sph", "trilinear", "quadratic"}) {
+		Mac3d* grids[4];
+		Particles* particles[4];
+		FLIP* flips[4];
+		const int num_threads[4] = {1, 2, 3, 7};
+		for (unsigned t = 0; t < 4; ++t) {
+			SimConfig cfg;
+			cfg.setNumThreads(num_threads[t]);
+			cfg.setParticleToGridKernel(kernel);
+			cfg.setParticleToGridMethod(method);
+			grids[t] = new Mac3d(nx, ny, nz, nx, ny, nz);
+			particles[t] = new Particles(num_particles, *grids[t]);
+
+			// particles in a pool covering the whole bottom, and a blob in the middle
+			for (unsigned n = 0; n < num_particles; ++n) {
+				double a, b, c;
+				particle_fractions(n, a, b, c);
+				if (n % 3 == 0) {
+					particles[t]->x[n] = 6 + 8*a;
+					particles[t]->y[n] = 8 + 6*b;
+					particles[t]->z[n] = 4 + 16*c;
+				} else {
+					particles[t]->x[n] = (nx - 1) * a;
+					particles[t]->y[n] = 5 * b;
+					particles[t]->z[n] = (nz - 1) * c;
+				}
+				particles[t]->u[n] = std::cos(0.3*n);
+				particles[t]->v[n] = std::cos(0.5*n + 1);
+				particles[t]->w[n] = std::cos(0.9*n + 2);
+			}
+
+			flips[t] = new FLIP(*particles[t], grids[t], cfg);
+			flips[t]->particle_to_grid();
+		}
+
+		for (unsigned t = 1; t < 4; ++t) {
+			for (unsigned idx = 0; idx < (nx+1)*ny*nz; ++idx) assert(grids[t]->pu_[idx] == grids[0]->pu_[idx]);
+			for (unsigned idx = 0; idx < nx*(ny+1)*nz; ++idx) assert(grids[t]->pv_[idx] == grids[0]->pv_[idx]);
+			for (unsigned idx = 0; idx < nx*ny*(nz+1); ++idx) assert(grids[t]->pw_[idx] == grids[0]->pw_[idx]);
+			for (unsigned idx = 0; idx < nx*ny*nz; ++idx) assert(grids[t]->pfluid_[idx] == grids[0]->pfluid_[idx]);
+		}
+
+		for (unsigned t = 0; t < 4; ++t) {
+			delete flips[t];
+			delete particles[t];
+			delete grids[t];
+		}
+	}
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ * A test to check that solving small fluid components (droplets) directly
+ * gives the same pressure as solving all fluid cells by CG, serially and in
+ * parallel, that only the small components are taken out of the CG system,
+ * and that the size of the directly solved components is limited
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	const unsigned nx = 24, ny = 16, nz = 20;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+	const unsigned num_cells = nx*ny*nz;
+	auto set_fluid = [&](unsigned i0, unsigned j0, unsigned k0, unsigned si, unsigned sj, unsigned sk) {
+		for (unsigned k = k0; k < k0 + sk; ++k) {
+			for (unsigned j = j0; j < j0 + sj; ++j) {
+				for (unsigned i = i0; i < i0 + si; ++i) grid.pfluid_[i + j*nx + k*nx*ny] = true;
+			}
+		}
+	};
+
+	// pool of fluid
+	set_fluid(0, 0, 0, nx, ny/3, nz);
+	// droplets of one, two and six cells, one of them in a corner of the domain
+	set_fluid(3, 10, 4, 1, 1, 1);
+	set_fluid(nx-1, ny-1, nz-1, 1, 1, 1);
+	set_fluid(8, 12, 9, 2, 1, 1);
+	set_fluid(15, 9, 2, 1, 2, 3);
+	// a larger blob, which stays in the CG system
+	set_fluid(10, 8, 12, 3, 3, 3);
+
+	double* rhs = new (std::align_val_t(32)) double[num_cells];
+	for (unsigned cellidx = 0; cellidx < num_cells; ++cellidx) {
+		rhs[cellidx] = grid.pfluid_[cellidx] ? std::sin(0.37*cellidx) + 0.2 : 0;
+	}
+
+	ICConjugateGradientSolver solver_cg(500, grid, 1);
+	double* p_cg = new (std::align_val_t(32)) double[num_cells];
+	solver_cg.solve(rhs, p_cg);
+	assert(solver_cg.get_num_iterations() < 500);
+	assert(solver_cg.get_num_direct_components() == 0);
+
+	for (int num_threads : {1, 3}) {
+		ICConjugateGradientSolver solver(500, grid, num_threads);
+		solver.set_direct_solve_size(8);
+		double* p = new (std::align_val_t(32)) double[num_cells];
+		solver.solve(rhs, p);
+		assert(solver.get_num_direct_components() == 4);
+		assert(solver.get_num_fluid_cells() == solver_cg.get_num_fluid_cells());
+
+		for (unsigned cellidx = 0; cellidx < num_cells; ++cellidx) {
+			assert(std::abs(p[cellidx] - p_cg[cellidx]) < 1e-8 * (1 + std::abs(p_cg[cellidx])));
+		}
+
+		// every fluid cell appears once in the compact numbering
+		const index_t* fluid_cells = solver.get_fluid_cells();
+		std::vector<bool> seen(num_cells, false);
+		for (index_t c = 0; c < solver.get_num_fluid_cells(); ++c) {
+			assert(grid.pfluid_[fluid_cells[c]] and not seen[fluid_cells[c]]);
+			seen[fluid_cells[c]] = true;
+		}
+
+		delete[] p;
+	}
+
+	// the size of the directly solved components is limited
+	ICConjugateGradientSolver solver_large(500, grid);
+	solver_large.set_direct_solve_size(100000);
+	assert(solver_large.get_direct_solve_size() == ICConjugateGradientSolver::max_direct_solve_size);
+
+	delete[] rhs;
+	delete[] p_cg;
+}
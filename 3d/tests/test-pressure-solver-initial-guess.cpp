@@ -0,0 +1,63 @@
+/*
+ * A test to check that the pressure solver converges to the same solution
+ * when started from an initial guess, and needs fewer iterations from a good one
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	const unsigned nx = 20, ny = 14, nz = 12;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+	// pool of fluid at the bottom of the domain
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny/2; ++j) {
+			for (unsigned i = 0; i < nx; ++i) {
+				grid.pfluid_[i + j*nx + k*nx*ny] = true;
+			}
+		}
+	}
+
+	ICConjugateGradientSolver solver(500, grid, 1);
+	solver.update_fluid_cells();
+	const index_t num_fluid = solver.get_num_fluid_cells();
+	const index_t* fluid_cells = solver.get_fluid_cells();
+
+	// the solver kernels require 32-byte aligned vectors, an initial guess
+	// needs the padding entry
+	double* rhs = new (std::align_val_t(32)) double[num_fluid];
+	double* p_zero = new (std::align_val_t(32)) double[num_fluid + 1];
+	double* p_guess = new (std::align_val_t(32)) double[num_fluid + 1];
+	for (unsigned c = 0; c < num_fluid; ++c) {
+		const unsigned i = fluid_cells[c] % nx;
+		const unsigned k = fluid_cells[c] / (nx*ny);
+		rhs[c] = std::sin(0.5*i) * std::cos(0.3*k);
+	}
+
+	solver.solve_compact(rhs, p_zero);
+	const unsigned zero_guess_iterations = solver.get_num_iterations();
+	assert(solver.get_initial_residual() == solver.get_rhs_norm());
+
+	// starting from the solution, no iteration is needed
+	std::copy(p_zero, p_zero + num_fluid, p_guess);
+	solver.solve_compact(rhs, p_guess, true);
+	assert(solver.get_num_iterations() <= 1);
+
+	// starting from a perturbed solution converges to the same solution
+	for (unsigned c = 0; c < num_fluid; ++c) p_guess[c] = p_zero[c] * (1 + 0.01*std::sin(1.7*c));
+	solver.solve_compact(rhs, p_guess, true);
+	assert(solver.get_initial_residual() < solver.get_rhs_norm());
+	assert(solver.get_num_iterations() < zero_guess_iterations);
+	for (unsigned c = 0; c < num_fluid; ++c) {
+		assert(std::abs(p_guess[c] - p_zero[c]) < 1e-8 * (1 + std::abs(p_zero[c])));
+	}
+
+	delete[] rhs;
+	delete[] p_zero;
+	delete[] p_guess;
+}
@@ -0,0 +1,96 @@
+/*
+ * A test to check that the mixed precision pressure solver reaches the
+ * tolerance of the double precision solver, with both preconditioners
+ */
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+// max norm of the residual rhs - A p of the fluid cells, in long double so
+// that it is not dominated by the rounding error of A p for large pressures
+double max_residual(const Mac3d& grid, const double* rhs, const double* p) {
+	const unsigned nx = grid.N_, ny = grid.M_, nz = grid.L_;
+	long double max_abs = 0;
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny; ++j) {
+			for (unsigned i = 0; i < nx; ++i) {
+				const unsigned c = i + j*nx + k*nx*ny;
+				if (!grid.pfluid_[c]) continue;
+				long double r = rhs[c] - (long double) grid.A_diag_val[c] * p[c];
+				if (i > 0    and grid.pfluid_[c - 1]    ) r += p[c - 1];
+				if (i + 1 < nx and grid.pfluid_[c + 1]    ) r += p[c + 1];
+				if (j > 0    and grid.pfluid_[c - nx]   ) r += p[c - nx];
+				if (j + 1 < ny and grid.pfluid_[c + nx]   ) r += p[c + nx];
+				if (k > 0    and grid.pfluid_[c - nx*ny]) r += p[c - nx*ny];
+				if (k + 1 < nz and grid.pfluid_[c + nx*ny]) r += p[c + nx*ny];
+				max_abs = std::max(max_abs, std::abs(r));
+			}
+		}
+	}
+	return max_abs;
+}
+
+
+int main() {
+	const unsigned nx = 32, ny = 20, nz = 24;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+	// pool of fluid with a column of fluid on top of it
+	const unsigned num_cells = nx*ny*nz;
+	double* rhs = new (std::align_val_t(32)) double[num_cells];
+	std::fill(rhs, rhs + num_cells, 0);
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny; ++j) {
+			for (unsigned i = 0; i < nx; ++i) {
+				if (j >= ny/3 and (i > nx/3 or k > nz/2)) continue;
+				const unsigned cellidx = i + j*nx + k*nx*ny;
+				grid.pfluid_[cellidx] = true;
+				// large values, as in the simulation
+				rhs[cellidx] = 1e4 * (std::sin(0.4*i) * std::cos(0.3*k) + 0.1*j);
+			}
+		}
+	}
+
+	for (auto preconditioner : {ICConjugateGradientSolver::PRECONDITIONER_IC0,
+	                            ICConjugateGradientSolver::PRECONDITIONER_MULTIGRID}) {
+		ICConjugateGradientSolver solver_double(500, grid, 2);
+		ICConjugateGradientSolver solver_mixed(500, grid, 2);
+		solver_double.set_preconditioner(preconditioner);
+		solver_mixed.set_preconditioner(preconditioner);
+		solver_mixed.set_precision(ICConjugateGradientSolver::PRECISION_MIXED);
+
+		double* p_double = new (std::align_val_t(32)) double[num_cells];
+		double* p_mixed = new (std::align_val_t(32)) double[num_cells];
+		solver_double.solve(rhs, p_double);
+
+		// the mixed precision solve must converge without a warning
+		std::ostringstream output;
+		std::streambuf* const cout_buf = std::cout.rdbuf(output.rdbuf());
+		solver_mixed.solve(rhs, p_mixed);
+		std::cout.rdbuf(cout_buf);
+		assert(output.str().find("WARNING") == std::string::npos);
+		assert(solver_mixed.get_num_iterations() < 500);
+
+		// the mixed precision solution must reach the tolerance: with pressures
+		// this large, the residual computed in double precision carries a
+		// rounding error close to the tolerance, which the solver compensates
+		assert(max_residual(grid, rhs, p_mixed) < solver_mixed.get_tolerance());
+		const index_t num_fluid = solver_mixed.get_num_fluid_cells();
+		const index_t* fluid_cells = solver_mixed.get_fluid_cells();
+		for (unsigned c = 0; c < num_fluid; ++c) {
+			const unsigned cellidx = fluid_cells[c];
+			assert(std::abs(p_double[cellidx] - p_mixed[cellidx]) < 1e-8 * (1 + std::abs(p_double[cellidx])));
+		}
+
+		delete[] p_double;
+		delete[] p_mixed;
+	}
+
+	delete[] rhs;
+}
@@ -0,0 +1,74 @@
+/*
+ * A test to check that the multigrid preconditioned pressure solver solves the
+ * system and needs fewer iterations than the incomplete Cholesky one
+ */
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	for (unsigned n : {16, 33, 64}) {
+		const unsigned nx = n, ny = n/2 + 3, nz = n;
+		Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+		// pool of fluid at the bottom of the domain with a falling blob above it
+		const unsigned num_cells = nx*ny*nz;
+		// the solver kernels require 32-byte aligned vectors
+		double* rhs = new (std::align_val_t(32)) double[num_cells];
+		std::fill(rhs, rhs + num_cells, 0);
+		for (unsigned k = 0; k < nz; ++k) {
+			for (unsigned j = 0; j < ny; ++j) {
+				for (unsigned i = 0; i < nx; ++i) {
+					const double dx = i - 0.5*nx, dy = j - 0.7*ny, dz = k - 0.5*nz;
+					const bool pool = j < ny/3;
+					const bool blob = dx*dx + dy*dy + dz*dz < 0.04*n*n;
+					if (not (pool or blob)) continue;
+					const unsigned cellidx = i + j*nx + k*nx*ny;
+					grid.pfluid_[cellidx] = true;
+					rhs[cellidx] = std::sin(6.0*i/nx) * std::cos(4.0*k/nz) + (blob ? 0.5 : 0);
+				}
+			}
+		}
+
+		ICConjugateGradientSolver solver_ic(500, grid, 1);
+		ICConjugateGradientSolver solver_mg(500, grid, 2);
+		solver_mg.set_preconditioner(ICConjugateGradientSolver::PRECONDITIONER_MULTIGRID);
+
+		double* p_ic = new (std::align_val_t(32)) double[num_cells];
+		double* p_mg = new (std::align_val_t(32)) double[num_cells];
+		double* residual = new (std::align_val_t(32)) double[num_cells];
+
+		solver_ic.solve(rhs, p_ic);
+		solver_mg.solve(rhs, p_mg);
+		std::cout << nx << "x" << ny << "x" << nz << ": "
+		          << solver_ic.get_num_iterations() << " IC(0) iterations, "
+		          << solver_mg.get_num_iterations() << " multigrid iterations" << std::endl;
+
+		// the multigrid solution must solve the system, applyA works on the
+		// compact numbering of the fluid cells, with a padding zero at the end
+		const index_t num_fluid = solver_mg.get_num_fluid_cells();
+		const index_t* fluid_cells = solver_mg.get_fluid_cells();
+		double* p_compact = new (std::align_val_t(32)) double[num_fluid + 1];
+		for (unsigned c = 0; c < num_fluid; ++c) p_compact[c] = p_mg[fluid_cells[c]];
+		p_compact[num_fluid] = 0;
+		solver_mg.applyA(p_compact, residual);
+		for (unsigned c = 0; c < num_fluid; ++c) {
+			const unsigned cellidx = fluid_cells[c];
+			assert(std::abs(residual[c] - rhs[cellidx]) < 1e-8);
+			assert(std::abs(p_ic[cellidx] - p_mg[cellidx]) < 1e-6 * (1 + std::abs(p_ic[cellidx])));
+		}
+
+		assert(solver_mg.get_num_iterations() < solver_ic.get_num_iterations());
+
+		delete[] p_ic;
+		delete[] p_mg;
+		delete[] residual;
+		delete[] p_compact;
+		delete[] rhs;
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * A test to check that the pressure solver converges to the same solution with
+ * every preconditioner, serially and in parallel, and that the modified
+ * incomplete Cholesky factorization needs fewer iterations than the plain one
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	const unsigned nx = 24, ny = 16, nz = 20;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+	// pool of fluid with a column of fluid on top of it
+	const unsigned num_cells = nx*ny*nz;
+	double* rhs = new (std::align_val_t(32)) double[num_cells];
+	std::fill(rhs, rhs + num_cells, 0);
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny; ++j) {
+			for (unsigned i = 0; i < nx; ++i) {
+				if (j >= ny/3 and (i > nx/3 or k > nz/2)) continue;
+				const unsigned cellidx = i + j*nx + k*nx*ny;
+				grid.pfluid_[cellidx] = true;
+				rhs[cellidx] = std::sin(0.4*i) * std::cos(0.3*k) + 0.1*j;
+			}
+		}
+	}
+
+	// reference solution
+	ICConjugateGradientSolver solver_ic0(1000, grid, 1);
+	double* p_ic0 = new (std::align_val_t(32)) double[num_cells];
+	solver_ic0.solve(rhs, p_ic0);
+	const unsigned ic0_iterations = solver_ic0.get_num_iterations();
+	assert(ic0_iterations < 1000);
+
+	for (auto precision : {ICConjugateGradientSolver::PRECISION_DOUBLE,
+	                       ICConjugateGradientSolver::PRECISION_MIXED}) {
+		for (auto preconditioner : {ICConjugateGradientSolver::PRECONDITIONER_NONE,
+		                            ICConjugateGradientSolver::PRECONDITIONER_JACOBI,
+		                            ICConjugateGradientSolver::PRECONDITIONER_IC0,
+		                            ICConjugateGradientSolver::PRECONDITIONER_MIC0,
+		                            ICConjugateGradientSolver::PRECONDITIONER_CHEBYSHEV,
+		                            ICConjugateGradientSolver::PRECONDITIONER_MULTIGRID}) {
+			for (int num_threads : {1, 3}) {
+				ICConjugateGradientSolver solver(1000, grid, num_threads);
+				solver.set_preconditioner(preconditioner);
+				solver.set_precision(precision);
+
+				double* p = new (std::align_val_t(32)) double[num_cells];
+				solver.solve(rhs, p);
+				assert(solver.get_num_iterations() < 1000);
+				for (unsigned cellidx = 0; cellidx < num_cells; ++cellidx) {
+					assert(std::abs(p[cellidx] - p_ic0[cellidx]) < 1e-8 * (1 + std::abs(p_ic0[cellidx])));
+				}
+				if (preconditioner == ICConjugateGradientSolver::PRECONDITIONER_MIC0
+				    and precision == ICConjugateGradientSolver::PRECISION_DOUBLE) {
+					assert(solver.get_num_iterations() < ic0_iterations);
+				}
+
+				delete[] p;
+			}
+		}
+	}
+
+	// tau = 0 is IC(0)
+	ICConjugateGradientSolver solver_tau0(1000, grid, 1);
+	solver_tau0.set_preconditioner(ICConjugateGradientSolver::PRECONDITIONER_MIC0);
+	solver_tau0.set_mic_parameters(0, 0);
+	double* p_tau0 = new (std::align_val_t(32)) double[num_cells];
+	solver_tau0.solve(rhs, p_tau0);
+	assert(solver_tau0.get_num_iterations() == ic0_iterations);
+	for (unsigned cellidx = 0; cellidx < num_cells; ++cellidx) {
+		assert(std::abs(p_tau0[cellidx] - p_ic0[cellidx]) < 1e-12 * (1 + std::abs(p_ic0[cellidx])));
+	}
+
+	delete[] rhs;
+	delete[] p_ic0;
+	delete[] p_tau0;
+}
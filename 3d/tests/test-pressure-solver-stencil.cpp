@@ -0,0 +1,71 @@
+/*
+ * A test to check the matrix-vector product of the pressure solver against the
+ * Laplacian stencil on the grid. The vectorized kernel must give identical
+ * results on every cell, independently of how the cells are split between
+ * the SIMD loop and the scalar loop (which depends on the number of threads).
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	const unsigned nx = 37, ny = 13, nz = 9;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+	// irregular fluid region, so that x-rows contain several runs of fluid cells
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny; ++j) {
+			for (unsigned i = 0; i < nx; ++i) {
+				grid.pfluid_[i + j*nx + k*nx*ny] = (i*7 + j*3 + k*5) % 11 < 8;
+			}
+		}
+	}
+
+	ICConjugateGradientSolver solver_serial(100, grid, 1);
+	ICConjugateGradientSolver solver_parallel(100, grid, 3);
+	solver_serial.update_fluid_cells();
+	solver_parallel.update_fluid_cells();
+	const index_t num_fluid = solver_serial.get_num_fluid_cells();
+	const index_t* fluid_cells = solver_serial.get_fluid_cells();
+	assert(solver_parallel.get_num_fluid_cells() == num_fluid);
+
+	// applyA needs the padding zero entry
+	double* b = new (std::align_val_t(32)) double[num_fluid + 1];
+	double* y_serial = new (std::align_val_t(32)) double[num_fluid];
+	double* y_parallel = new (std::align_val_t(32)) double[num_fluid];
+	double* b_grid = new double[nx*ny*nz];
+	std::fill(b_grid, b_grid + nx*ny*nz, 0);
+	for (unsigned c = 0; c < num_fluid; ++c) {
+		b[c] = std::sin(0.37*c) + 0.5;
+		b_grid[fluid_cells[c]] = b[c];
+	}
+	b[num_fluid] = 0;
+
+	solver_serial.applyA(b, y_serial);
+	solver_parallel.applyA(b, y_parallel);
+
+	for (unsigned c = 0; c < num_fluid; ++c) {
+		assert(y_serial[c] == y_parallel[c]);
+
+		// Laplacian stencil, non-fluid neighbours have zero pressure
+		const unsigned cellidx = fluid_cells[c];
+		const unsigned i = cellidx % nx, j = (cellidx / nx) % ny, k = cellidx / (nx*ny);
+		double expected = grid.A_diag_val[cellidx] * b_grid[cellidx];
+		if (i > 0) expected -= b_grid[cellidx - 1];
+		if (i + 1 < nx) expected -= b_grid[cellidx + 1];
+		if (j > 0) expected -= b_grid[cellidx - nx];
+		if (j + 1 < ny) expected -= b_grid[cellidx + nx];
+		if (k > 0) expected -= b_grid[cellidx - nx*ny];
+		if (k + 1 < nz) expected -= b_grid[cellidx + nx*ny];
+		assert(std::abs(y_serial[c] - expected) < 1e-12);
+	}
+
+	delete[] b;
+	delete[] y_serial;
+	delete[] y_parallel;
+	delete[] b_grid;
+}
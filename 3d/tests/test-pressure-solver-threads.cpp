@@ -0,0 +1,78 @@
+/*
+ * A test to check that the multi-threaded pressure solver solves the system
+ * and agrees with the single-threaded one, for both preconditioner sweeps
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	const unsigned nx = 23, ny = 17, nz = 11;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+	// block of fluid surrounded by air, with a hole of air in the middle
+	const unsigned num_cells = nx*ny*nz;
+	// the solver kernels require 32-byte aligned vectors
+	double* rhs = new (std::align_val_t(32)) double[num_cells];
+	std::fill(rhs, rhs + num_cells, 0);
+	for (unsigned k = 1; k < nz-2; ++k) {
+		for (unsigned j = 2; j < ny-1; ++j) {
+			for (unsigned i = 1; i < nx-3; ++i) {
+				const unsigned cellidx = i + j*nx + k*nx*ny;
+				if (i == nx/2 && j == ny/2) continue;
+				grid.pfluid_[cellidx] = true;
+				rhs[cellidx] = std::sin(0.3*i) + std::cos(0.7*j) - 0.1*k;
+			}
+		}
+	}
+
+	ICConjugateGradientSolver solver_serial(200, grid, 1);
+	ICConjugateGradientSolver solver_parallel(200, grid, 4);
+	ICConjugateGradientSolver solver_wavefront(200, grid, 4);
+	solver_wavefront.set_sweep(ICConjugateGradientSolver::SWEEP_WAVEFRONT);
+
+	double* p_serial = new (std::align_val_t(32)) double[num_cells];
+	double* p_parallel = new (std::align_val_t(32)) double[num_cells];
+	double* p_wavefront = new (std::align_val_t(32)) double[num_cells];
+	double* residual = new (std::align_val_t(32)) double[num_cells];
+
+	solver_serial.solve(rhs, p_serial);
+	solver_parallel.solve(rhs, p_parallel);
+	solver_wavefront.solve(rhs, p_wavefront);
+
+	// the parallel solution must solve the system, applyA works on the
+	// compact numbering of the fluid cells, with a padding zero at the end
+	const index_t num_fluid = solver_parallel.get_num_fluid_cells();
+	const index_t* fluid_cells = solver_parallel.get_fluid_cells();
+	double* p_compact = new (std::align_val_t(32)) double[num_fluid + 1];
+	for (unsigned c = 0; c < num_fluid; ++c) p_compact[c] = p_parallel[fluid_cells[c]];
+	p_compact[num_fluid] = 0;
+	solver_parallel.applyA(p_compact, residual);
+	for (unsigned c = 0; c < num_fluid; ++c) {
+		assert(std::abs(residual[c] - rhs[fluid_cells[c]]) < 1e-8);
+	}
+
+	// and agree with the serial solution up to rounding
+	// (the solution is zero on all other cells)
+	for (unsigned c = 0; c < num_cells; ++c) {
+		assert(std::abs(p_serial[c] - p_parallel[c]) < 1e-8 * (1 + std::abs(p_serial[c])));
+		if (not grid.pfluid_[c]) assert(p_parallel[c] == 0);
+	}
+
+	// the wavefront sweep performs the same operations as the lexicographic one
+	assert(solver_wavefront.get_num_iterations() == solver_parallel.get_num_iterations());
+	for (unsigned c = 0; c < num_cells; ++c) {
+		assert(p_wavefront[c] == p_parallel[c]);
+	}
+
+	delete[] p_serial;
+	delete[] p_parallel;
+	delete[] p_wavefront;
+	delete[] residual;
+	delete[] p_compact;
+	delete[] rhs;
+}
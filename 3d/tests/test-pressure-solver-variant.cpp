@@ -0,0 +1,77 @@
+/*
+ * A test to check that the Chronopoulos-Gear formulation of the pressure solver
+ * converges to the same solution as the standard one in about as many iterations
+ */
+#include <cmath>
+#include <algorithm>
+
+#include "includes/watersim-test-common.h"
+#include "Mac3d.h"
+#include "ConjugateGradient.hpp"
+
+
+int main() {
+	const unsigned nx = 24, ny = 16, nz = 20;
+	Mac3d grid(nx, ny, nz, nx, ny, nz);
+
+	// pool of fluid with a column of fluid on top of it
+	const unsigned num_cells = nx*ny*nz;
+	double* rhs = new (std::align_val_t(32)) double[num_cells];
+	std::fill(rhs, rhs + num_cells, 0);
+	for (unsigned k = 0; k < nz; ++k) {
+		for (unsigned j = 0; j < ny; ++j) {
+			for (unsigned i = 0; i < nx; ++i) {
+				if (j >= ny/3 and (i > nx/3 or k > nz/2)) continue;
+				const unsigned cellidx = i + j*nx + k*nx*ny;
+				grid.pfluid_[cellidx] = true;
+				rhs[cellidx] = std::sin(0.4*i) * std::cos(0.3*k) + 0.1*j;
+			}
+		}
+	}
+
+	for (auto preconditioner : {ICConjugateGradientSolver::PRECONDITIONER_IC0,
+	                            ICConjugateGradientSolver::PRECONDITIONER_MULTIGRID}) {
+		for (int num_threads : {1, 3}) {
+			ICConjugateGradientSolver solver_standard(500, grid, num_threads);
+			ICConjugateGradientSolver solver_cg(500, grid, num_threads);
+			solver_standard.set_preconditioner(preconditioner);
+			solver_cg.set_preconditioner(preconditioner);
+			solver_cg.set_variant(ICConjugateGradientSolver::VARIANT_CHRONOPOULOS_GEAR);
+
+			double* p_standard = new (std::align_val_t(32)) double[num_cells];
+			double* p_cg = new (std::align_val_t(32)) double[num_cells];
+			solver_standard.solve(rhs, p_standard);
+			solver_cg.solve(rhs, p_cg);
+			const int standard_iterations = solver_standard.get_num_iterations();
+			const int cg_iterations = solver_cg.get_num_iterations();
+			assert(cg_iterations < 500);
+			assert(std::abs(cg_iterations - standard_iterations) <= 2);
+			for (unsigned cellidx = 0; cellidx < num_cells; ++cellidx) {
+				assert(std::abs(p_standard[cellidx] - p_cg[cellidx]) < 1e-8 * (1 + std::abs(p_standard[cellidx])));
+			}
+
+			// starting from a perturbed solution converges to the same solution
+			const index_t num_fluid = solver_cg.get_num_fluid_cells();
+			const index_t* fluid_cells = solver_cg.get_fluid_cells();
+			double* rhs_compact = new (std::align_val_t(32)) double[num_fluid];
+			double* p_guess = new (std::align_val_t(32)) double[num_fluid + 1];
+			for (unsigned c = 0; c < num_fluid; ++c) {
+				rhs_compact[c] = rhs[fluid_cells[c]];
+				p_guess[c] = p_standard[fluid_cells[c]] * (1 + 0.01*std::sin(1.7*c));
+			}
+			solver_cg.solve_compact(rhs_compact, p_guess, true);
+			assert(solver_cg.get_num_iterations() < (unsigned) cg_iterations);
+			for (unsigned c = 0; c < num_fluid; ++c) {
+				const double p = p_standard[fluid_cells[c]];
+				assert(std::abs(p_guess[c] - p) < 1e-8 * (1 + std::abs(p)));
+			}
+
+			delete[] p_standard;
+			delete[] p_cg;
+			delete[] rhs_compact;
+			delete[] p_guess;
+		}
+	}
+
+	delete[] rhs;
+}
@@ -272,7 +272,7 @@ public:
 
 		ImGui::Text("Max pressure: %.5f", pressure_max);
 		ImGui::Text("Min pressure: %.5f", pressure_min);
-		ImGui::Text("%d particles", p_waterSim->m_watersim.getNumParticles());
+		ImGui::Text("%llu particles", (unsigned long long) p_waterSim->m_watersim.getNumParticles());
 		ImGui::Text("%d cells (%d x %d x %d)", nx*ny*nz, nx, ny, nz);
 	}
 
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+
+"""
+This script runs WaterSim benchmarks for several values of a single configuration key and reports the mean
+number of cycles spent in each timed section, together with the speedup relative to the first value.
+Sections whose timing tag is numeric (e.g. the number of CG iterations of `pressure_solve`) are additionally
+reported with the mean value of their tag.
+Run with -h for usage instructions.
+
+Example: thread scaling of two benchmarks, run from the `3d/benchmarks` directory:
+
+    python3 ../../scripts/benchmark-variants.py --cli ../build/watersim-cli --key numThreads --values 1 2 4 8 \
+        --output scaling benchmark-1-3.json benchmark-2-3.json
+
+For every benchmark and value, a directory `<output>/<benchmark>/<key>-<value>` is created, containing the modified
+configuration file, the log of the run and the `timings.json` file written by the simulation.
+"""
+import argparse
+import itertools
+import json
+import os
+import statistics
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from load_timing_info import load_timings, get_duration_stats  # noqa: E402
+
+
+def parse_value(value):
+    """ Interpret a command line value as JSON if possible (numbers, booleans, lists), as string otherwise. """
+    try:
+        return json.loads(value)
+    except json.JSONDecodeError:
+        return value
+
+
+def get_tag_means(timing_data):
+    """ Mean of the timing tags of all sections whose tags are numeric. """
+    tags = dict()
+    non_numeric = set()
+    for t in itertools.chain.from_iterable(timing_data):
+        try:
+            tags.setdefault(t['name'], []).append(float(t['tag']))
+        except ValueError:
+            non_numeric.add(t['name'])
+    return {name: statistics.mean(values) for name, values in tags.items() if name not in non_numeric}
+
+
+def run_variant(cli, config_file, key, value, overrides, max_steps, directory):
+    """ Run a single benchmark with config[key] = value and return the timing statistics. """
+    with open(config_file) as f:
+        config = json.load(f)
+    config.update(overrides)
+    config[key] = value
+    if max_steps is not None:
+        config['maxSteps'] = max_steps
+
+    os.makedirs(directory, exist_ok=True)
+    with open(os.path.join(directory, 'config.json'), 'w') as f:
+        json.dump(config, f, indent=4)
+
+    with open(os.path.join(directory, 'watersim.log'), 'w') as log:
+        subprocess.run([os.path.abspath(cli), '-y', 'config.json'], cwd=directory, stdout=log, check=True)
+
+    timing_data = load_timings(os.path.join(directory, 'timings.json'))
+    return get_duration_stats(timing_data), get_tag_means(timing_data)
+
+
+def print_report(benchmark, key, values, stats, tags):
+    """ Print mean cycles per section and speedup relative to the first value, and the mean numeric tags. """
+    print(f"\n{benchmark}: mean cycles per step, speedup relative to {key} = {values[0]}")
+    header = f"{'Section' : >28}" + ''.join(f"\t{f'{key}={v}' : >22}" for v in values)
+    print(header)
+    print(len(header.expandtabs()) * "=")
+    for section in dict.fromkeys(section for s in stats for section in s):
+        reference = stats[0][section]['mean'] if section in stats[0] else float('nan')
+        row = f"{section : >28}"
+        for s in stats:
+            mean = s[section]['mean'] if section in s else float('nan')
+            speedup = reference / mean if mean > 0 else float('nan')
+            row += f"\t{f'{mean:.4g} ({speedup:.2f}x)' : >22}"
+        print(row)
+
+    for section in tags[0]:
+        row = f"{section + ' (tag)' : >28}"
+        for t in tags:
+            row += f"\t{t.get(section, float('nan')) : >22.4g}"
+        print(row)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run WaterSim benchmarks for several values of a config key.")
+    parser.add_argument('benchmarks', nargs='+', help="benchmark configuration files")
+    parser.add_argument('--cli', default='../build/watersim-cli', help="path to the watersim-cli executable")
+    parser.add_argument('--key', required=True, help="configuration key to vary, e.g. numThreads")
+    parser.add_argument('--values', nargs='+', required=True, help="values of the key (parsed as JSON)")
+    parser.add_argument('--set', action='append', default=[], metavar='KEY=VALUE',
+                        help="override a configuration entry for all runs (value parsed as JSON), can be repeated")
+    parser.add_argument('--max-steps', type=int, default=None, help="override maxSteps of the benchmarks")
+    parser.add_argument('--output', default='variants', help="directory for the benchmark output")
+    args = parser.parse_args()
+
+    values = [parse_value(v) for v in args.values]
+    overrides = {k: parse_value(v) for k, v in (o.split('=', 1) for o in args.set)}
+    for config_file in args.benchmarks:
+        benchmark = os.path.splitext(os.path.basename(config_file))[0]
+        stats, tags = [], []
+        for value in values:
+            directory = os.path.join(args.output, benchmark, f"{args.key}-{value}")
+            print(f"Running '{benchmark}' with {args.key} = {value}...", file=sys.stderr)
+            s, t = run_variant(args.cli, config_file, args.key, value, overrides, args.max_steps, directory)
+            stats.append(s)
+            tags.append(t)
+        print_report(benchmark, args.key, values, stats, tags)
+
+
+if __name__ == '__main__':
+    main()
@@ -22,8 +22,10 @@ def get_durations(timing_data_group):
 def get_duration_stats(timing_data):
     durations = list(map(get_durations, timing_data))
     duration_moments = dict()
-    for key in durations[0]:
-        dur_vals = [duration[key] for duration in durations]
+    # sections may be timed only in some steps, e.g. the periodic particle sort
+    keys = list(dict.fromkeys(key for duration in durations for key in duration))
+    for key in keys:
+        dur_vals = [duration[key] for duration in durations if key in duration]
         duration_moments[key] = {
             'mean': statistics.mean(dur_vals),
             'median': statistics.median(dur_vals),